@@ -0,0 +1,112 @@
+import argparse, sys, os, time, codecs, random, re
+from tabulate import tabulate
+import MeCab
+import npycrf as nlp
+
+# 単語境界の位置の集合
+def boundaries(words):
+	positions = set()
+	position = 0
+	for word in words[:-1]:
+		position += len(word)
+		positions.add(position)
+	return positions
+
+def main():
+	assert args.working_directory is not None
+
+	# 辞書
+	dictionary = nlp.dictionary(os.path.join(args.working_directory, "char.dict"))
+
+	# モデル
+	crf_filename = os.path.join(args.working_directory, "crf.model")
+	quantized_crf_filename = os.path.join(args.working_directory, "crf.int{}.model".format(args.bits))
+	crf = nlp.crf(crf_filename)
+	npylm = nlp.npylm(os.path.join(args.working_directory, "npylm.model"))
+	npycrf = nlp.npycrf(npylm=npylm, crf=crf)
+
+	# 量子化して保存し、読み込み直す
+	assert crf.save_quantized(quantized_crf_filename, bits=args.bits, threshold=args.threshold)
+	quantized_crf = nlp.crf(quantized_crf_filename)
+	quantized_npycrf = nlp.npycrf(npylm=npylm, crf=quantized_crf)
+
+	assert args.test_filename is not None or args.test_directory is not None
+	sentence_list = []
+
+	def preprocess(sentence):
+		sentence = re.sub(r"[0-9.,]+", "#", sentence);
+		sentence = sentence.strip()
+		return sentence
+
+	if args.test_filename is not None:
+		with codecs.open(args.test_filename, "r", "utf-8") as f:
+			for sentence_str in f:
+				sentence_str = preprocess(sentence_str)
+				sentence_list.append(sentence_str)
+
+	if args.test_directory is not None:
+		for filename in os.listdir(args.test_directory):
+			with codecs.open(os.path.join(args.test_directory, filename), "r", "utf-8") as f:
+				for sentence_str in f:
+					sentence_str = preprocess(sentence_str)
+					sentence_list.append(sentence_str)
+
+	# 正解はMeCabによる分割
+	tagger = MeCab.Tagger() if args.neologd_path is None else MeCab.Tagger("-d " + args.neologd_path)
+	tagger.parse("")	# バグ回避のため空データを分割
+	num_true = 0
+	num_estimated = [0, 0]
+	num_correct = [0, 0]
+	elapsed_time = [0, 0]
+	num_sentences = 0
+	num_changed_sentences = 0
+	for sentence_str in sentence_list:
+		sentence_str = sentence_str.strip()
+		m = tagger.parseToNode(sentence_str)	# 形態素解析
+		words_true = []
+		while m:
+			word = m.surface
+			if len(word) > 0:
+				words_true.append(word)
+			m = m.next
+		if len(words_true) == 0:
+			continue
+		boundaries_true = boundaries(words_true)
+		num_true += len(boundaries_true)
+		num_sentences += 1
+		results = []
+		for index, model in enumerate([npycrf, quantized_npycrf]):
+			start_time = time.time()
+			words = model.parse(sentence_str, dictionary)
+			elapsed_time[index] += time.time() - start_time
+			boundaries_estimated = boundaries(words)
+			num_estimated[index] += len(boundaries_estimated)
+			num_correct[index] += len(boundaries_true & boundaries_estimated)
+			results.append(words)
+		if results[0] != results[1]:
+			num_changed_sentences += 1
+
+	table = []
+	scores = []
+	for index, (name, model, filename) in enumerate([("double", crf, crf_filename), ("int{}".format(args.bits), quantized_crf, quantized_crf_filename)]):
+		precision = num_correct[index] / max(1, num_estimated[index])
+		recall = num_correct[index] / max(1, num_true)
+		f_measure = 2 * precision * recall / max(1e-12, precision + recall)
+		scores.append((precision, recall, f_measure))
+		table.append([name, model.get_num_features(), os.path.getsize(filename), precision, recall, f_measure, elapsed_time[index]])
+	table.append(["delta", "", "", scores[1][0] - scores[0][0], scores[1][1] - scores[0][1], scores[1][2] - scores[0][2], ""])
+	print(tabulate(table, headers=["CRF", "#features", "Bytes", "Precision", "Recall", "F-measure", "Time (sec)"]))
+	print("{} / {} sentences were segmented differently.".format(num_changed_sentences, num_sentences))
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser()
+	# 以下のどちらかを必ず指定
+	parser.add_argument("--test-filename", "-file", type=str, default=None)
+	parser.add_argument("--test-directory", "-dir", type=str, default=None)
+
+	parser.add_argument("--working-directory", "-cwd", type=str, default="out", help="ワーキングディレクトリ")
+	parser.add_argument("--neologd-path", "-neologd", type=str, default=None)
+	parser.add_argument("--bits", type=int, default=8, choices=[8, 16], help="量子化した重みのビット数")
+	parser.add_argument("--threshold", type=float, default=0.0, help="絶対値がこれ未満の重みの素性は除く")
+	args = parser.parse_args()
+	main()
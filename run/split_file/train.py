@@ -124,14 +124,22 @@ def main():
 				feature_x_identical_2_start=args.crf_feature_x_identical_2_start,
 				feature_x_identical_2_end=args.crf_feature_x_identical_2_end,
 				initial_lambda_0=args.crf_lambda_0,
-				sigma=args.crf_prior_sigma)
+				sigma=args.crf_prior_sigma,
+				feature_hash_bits=args.crf_feature_hash_bits,
+				feature_min_count={
+					"unigram": args.crf_feature_min_count_unigram,
+					"bigram": args.crf_feature_min_count_bigram,
+					"identical": args.crf_feature_min_count_identical,
+					"type": args.crf_feature_min_count_type,
+				})
 
 	npylm = nlp.npylm(max_word_length=args.max_word_length,
 					g0=1.0 / num_character_ids,
 					initial_lambda_a=args.npylm_lambda_a,
 					initial_lambda_b=args.npylm_lambda_b,
 					vpylm_beta_stop=args.vpylm_beta_stop,
-					vpylm_beta_pass=args.vpylm_beta_pass)
+					vpylm_beta_pass=args.vpylm_beta_pass,
+					ngram=args.ngram)
 
 	npycrf = nlp.npycrf(npylm=npylm, crf=crf)
 
@@ -143,7 +151,8 @@ def main():
 						dataset_unlabeled=dataset_u,
 						dictionary=dictionary,
 						npycrf=npycrf,
-						crf_regularization_constant=10.0)
+						crf_regularization_constant=10.0,
+						crf_l1_regularization_constant=args.crf_l1_regularization_constant)
 
 	# 文字列の単語IDが衝突しているかどうかをチェック
 	# 時間の無駄なので一度したらしなくてよい
@@ -155,6 +164,10 @@ def main():
 
 	learning_rate = args.crf_learning_rate
 	batchsize = 32
+	trainer.set_gibbs_batchsize(args.gibbs_batchsize)	# 1より大きければ複数の文を並列にサンプリング
+	trainer.set_num_threads(args.num_threads)
+	if args.precompute_substring_ids:
+		trainer.set_substring_word_id_precomputation(True)	# 部分文字列のIDを文ごとに保持して反復をまたいで使う
 
 	# 初期化
 	trainer.add_labeled_data_to_npylm()						# 教師データをNPYLMに追加
@@ -200,6 +213,8 @@ def main():
 
 		# trainer.print_p_k_vpylm()
 		print("lambda_0:", crf.get_lambda_0())
+		if args.crf_l1_regularization_constant > 0:
+			print("#zero weights:", crf.get_num_zero_weights(), "/", crf.get_num_features())
 
 if __name__ == "__main__":
 	parser = argparse.ArgumentParser()
@@ -220,6 +235,7 @@ if __name__ == "__main__":
 	parser.add_argument("--vpylm-beta-stop", "-beta-stop", type=float, default=4)
 	parser.add_argument("--vpylm-beta-pass", "-beta-pass", type=float, default=1)
 	parser.add_argument("--max-word-length", "-l", type=int, default=12, help="可能な単語の最大長.")
+	parser.add_argument("--ngram", type=int, default=3, choices=[2, 3], help="単語n-gramのn. 2にすると分割が速くなる.")
 	parser.add_argument("--max-sentence-length", type=int, default=300, help="長すぎる文を除外する.")
 
 	# CRF
@@ -237,7 +253,16 @@ if __name__ == "__main__":
 	parser.add_argument("--crf-feature-x-identical-2-end", type=int, default=1)
 	parser.add_argument("--crf-lambda-0", "-lam-0", type=float, default=1.0, help="モデル補完重みの初期値")
 	parser.add_argument("--crf-prior-sigma", type=float, default=1.0)
+	parser.add_argument("--crf-feature-hash-bits", type=int, default=0, help="0でなければ素性を2^nの重みにハッシュする. 文字の種類が多い場合に使う.")
+	parser.add_argument("--crf-feature-min-count-unigram", type=int, default=1, help="教師データでの出現回数がこれ未満の素性は作らない.")
+	parser.add_argument("--crf-feature-min-count-bigram", type=int, default=1)
+	parser.add_argument("--crf-feature-min-count-identical", type=int, default=1)
+	parser.add_argument("--crf-feature-min-count-type", type=int, default=1)
 	parser.add_argument("--crf-learning-rate", "-lr", type=float, default=0.01)
+	parser.add_argument("--crf-l1-regularization-constant", type=float, default=0, help="L1正則化の強さ. 0より大きくすると多くの重みが0になり、保存するモデルが小さくなる.")
+	parser.add_argument("--gibbs-batchsize", type=int, default=1, help="まとめて並列にサンプリングする文の数. 1なら1文ずつ.")
+	parser.add_argument("--num-threads", type=int, default=0, help="並列サンプリングのスレッド数. 0ならCPUのスレッド数.")
+	parser.add_argument("--precompute-substring-ids", action="store_true", default=False, help="全ての文の部分文字列のIDを前計算する. 文字数×最大単語長のIDを保持するのでメモリに余裕がある場合のみ.")
 
 	args = parser.parse_args()
 
@@ -3,6 +3,9 @@
 #include <cassert>
 #include <execinfo.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
 
 namespace npycrf {
 	namespace index {
@@ -22,70 +25,111 @@ namespace npycrf {
 		}
 	}
 	namespace mat {
+		// 全要素を1つの連続したバッファに置く
+		// 先頭はキャッシュラインに揃える
+		const size_t ALIGNMENT = 64;
+		template<typename T>
+		T* allocate(size_t size){
+			if(size == 0){
+				return nullptr;
+			}
+			void* ptr = nullptr;
+			if(posix_memalign(&ptr, ALIGNMENT, size * sizeof(T)) != 0){
+				throw std::bad_alloc();
+			}
+			return static_cast<T*>(ptr);
+		}
+		template<typename T>
+		void deallocate(T* ptr){
+			free(ptr);
+		}
 		template<typename T>
 		class bi {
 		private:
+			std::size_t _capacity;
 			void _delete(){
-				for(int t = 0;t < _t_size;t++){
-					delete[] _array[t];
-				}
-				delete[] _array;
+				deallocate(_array);
+				_array = nullptr;
+				_capacity = 0;
 			}
+			// 確保済みの領域で足りる場合は再利用する
 			void _alloc(){
-				_array = new T*[_t_size];
-				for(int t = 0;t < _t_size;t++){
-					_array[t] = new T[_k_size];
-					for(int k = 0;k < _k_size;k++){
-						_array[t][k] = 0;
-					}
+				std::size_t size = (std::size_t)_t_size * _k_size;
+				if(size > _capacity){
+					_delete();
+					_array = allocate<T>(size);
+					_capacity = size;
 				}
+				std::fill(_array, _array + size, T());
 			}
 		public:
-			T** _array;
+			T* _array;
 			int _t_size;
 			int _k_size;
 			bi(){
 				_array = nullptr;
+				_capacity = 0;
 				_t_size = 0;
 				_k_size = 0;
 			}
 			bi(int t_size, int k_size){
+				_array = nullptr;
+				_capacity = 0;
 				_t_size = t_size;
 				_k_size = k_size;
 				_alloc();
 			}
 			bi(const bi &a){
-				if(_array != nullptr){
-					_delete();
-				}
+				_array = nullptr;
+				_capacity = 0;
 				_t_size = a._t_size;
 				_k_size = a._k_size;
 				_alloc();
-				for(int t = 0;t < _t_size;t++){
-					for(int k = 0;k < _k_size;k++){
-						_array[t][k] = a._array[t][k];
-					}
-				}
+				std::copy(a._array, a._array + a.size(), _array);
+			}
+			bi(bi &&a){
+				_array = a._array;
+				_capacity = a._capacity;
+				_t_size = a._t_size;
+				_k_size = a._k_size;
+				a._array = nullptr;
+				a._capacity = 0;
 			}
 			~bi(){
-				if(_array != nullptr){
-					_delete();
-				}
+				_delete();
 			}
 			bi &operator=(const bi &a){
-				if(_array != nullptr){
-					_delete();
+				if(this == &a){
+					return *this;
 				}
 				_t_size = a._t_size;
 				_k_size = a._k_size;
 				_alloc();
-				for(int t = 0;t < _t_size;t++){
-					for(int k = 0;k < _k_size;k++){
-						_array[t][k] = a._array[t][k];
-					}
+				std::copy(a._array, a._array + a.size(), _array);
+				return *this;
+			}
+			bi &operator=(bi &&a){
+				if(this == &a){
+					return *this;
 				}
+				_delete();
+				_array = a._array;
+				_capacity = a._capacity;
+				_t_size = a._t_size;
+				_k_size = a._k_size;
+				a._array = nullptr;
+				a._capacity = 0;
 				return *this;
 			}
+			// 形状を変更して0で初期化
+			void resize(int t_size, int k_size){
+				_t_size = t_size;
+				_k_size = k_size;
+				_alloc();
+			}
+			std::size_t size() const {
+				return (std::size_t)_t_size * _k_size;
+			}
 			int size_t(){
 				return _t_size;
 			}
@@ -96,102 +140,125 @@ namespace npycrf {
 				fill(value, _t_size);
 			}
 			void fill(T value, int t_size){
-				for(int t = 0;t < t_size;t++){
-					for(int k = 0;k < _k_size;k++){
-						_array[t][k] = value;
-					}
-				}
+				assert(t_size <= _t_size);
+				std::fill(_array, _array + (std::size_t)t_size * _k_size, value);
+			}
+			// tの行の先頭
+			T* row(int t){
+				assert(t < _t_size);
+				return _array + (std::size_t)t * _k_size;
 			}
 			T &operator()(int t, int k) {
 				assert(t < _t_size);
 				assert(k < _k_size);
-				return _array[t][k];
+				return _array[(std::size_t)t * _k_size + k];
 			}
 			const T &operator()(int t, int k) const {
 				assert(t < _t_size);
 				assert(k < _k_size);
-				return _array[t][k];
+				return _array[(std::size_t)t * _k_size + k];
 			}
 		};
 		template<typename T>
 		class tri {
 		private:
+			std::size_t _capacity;
 			void _delete(){
-				for(int t = 0;t < _t_size;t++){
-					for(int k = 0;k < _k_size;k++){
-						delete[] _array[t][k];
-					}
-					delete[] _array[t];
-				}
-				delete[] _array;
+				deallocate(_array);
+				_array = nullptr;
+				_capacity = 0;
 			}
+			// 確保済みの領域で足りる場合は再利用する
 			void _alloc(){
-				_array = new T**[_t_size];
-				for(int t = 0;t < _t_size;t++){
-					_array[t] = new T*[_k_size];
-					for(int k = 0;k < _k_size;k++){
-						_array[t][k] = new T[_j_size];
-						for(int j = 0;j < _j_size;j++){
-							_array[t][k][j] = 0;
-						}
-					}
+				_stride_t = (std::size_t)_k_size * _j_size;
+				std::size_t size = _t_size * _stride_t;
+				if(size > _capacity){
+					_delete();
+					_array = allocate<T>(size);
+					_capacity = size;
 				}
+				std::fill(_array, _array + size, T());
 			}
 		public:
-			T*** _array;
+			T* _array;
 			int _t_size;
 			int _k_size;
 			int _j_size;
+			std::size_t _stride_t;
 			tri(){
 				_array = nullptr;
+				_capacity = 0;
 				_t_size = 0;
 				_k_size = 0;
 				_j_size = 0;
+				_stride_t = 0;
 			}
 			tri(int t_size, int k_size, int j_size){
+				_array = nullptr;
+				_capacity = 0;
 				_t_size = t_size;
 				_k_size = k_size;
 				_j_size = j_size;
 				_alloc();
 			}
 			tri(const tri &a){
-				if(_array != nullptr){
-					_delete();
-				}
+				_array = nullptr;
+				_capacity = 0;
 				_t_size = a._t_size;
 				_k_size = a._k_size;
 				_j_size = a._j_size;
 				_alloc();
-				for(int t = 0;t < _t_size;t++){
-					for(int k = 0;k < _k_size;k++){
-						for(int j = 0;j < _j_size;j++){
-							_array[t][k][j] = a._array[t][k][j];
-						}
-					}
-				}
+				std::copy(a._array, a._array + a.size(), _array);
+			}
+			tri(tri &&a){
+				_array = a._array;
+				_capacity = a._capacity;
+				_t_size = a._t_size;
+				_k_size = a._k_size;
+				_j_size = a._j_size;
+				_stride_t = a._stride_t;
+				a._array = nullptr;
+				a._capacity = 0;
 			}
 			~tri(){
-				if(_array != nullptr){
-					_delete();
-				}
+				_delete();
 			}
 			tri &operator=(const tri &a){
-				if(_array != nullptr){
-					_delete();
+				if(this == &a){
+					return *this;
 				}
 				_t_size = a._t_size;
 				_k_size = a._k_size;
 				_j_size = a._j_size;
 				_alloc();
-				for(int t = 0;t < _t_size;t++){
-					for(int k = 0;k < _k_size;k++){
-						for(int j = 0;j < _j_size;j++){
-							_array[t][k][j] = a._array[t][k][j];
-						}
-					}
+				std::copy(a._array, a._array + a.size(), _array);
+				return *this;
+			}
+			tri &operator=(tri &&a){
+				if(this == &a){
+					return *this;
 				}
+				_delete();
+				_array = a._array;
+				_capacity = a._capacity;
+				_t_size = a._t_size;
+				_k_size = a._k_size;
+				_j_size = a._j_size;
+				_stride_t = a._stride_t;
+				a._array = nullptr;
+				a._capacity = 0;
 				return *this;
 			}
+			// 形状を変更して0で初期化
+			void resize(int t_size, int k_size, int j_size){
+				_t_size = t_size;
+				_k_size = k_size;
+				_j_size = j_size;
+				_alloc();
+			}
+			std::size_t size() const {
+				return _t_size * _stride_t;
+			}
 			int size_t(){
 				return _t_size;
 			}
@@ -205,71 +272,70 @@ namespace npycrf {
 				fill(value, _t_size);
 			}
 			void fill(T value, int t_size){
-				for(int t = 0;t < t_size;t++){
-					for(int k = 0;k < _k_size;k++){
-						for(int j = 0;j < _j_size;j++){
-							_array[t][k][j] = value;
-						}
-					}
-				}
+				assert(t_size <= _t_size);
+				std::fill(_array, _array + t_size * _stride_t, value);
+			}
+			// (t, k)の行の先頭
+			T* row(int t, int k){
+				assert(t < _t_size);
+				assert(k < _k_size);
+				return _array + t * _stride_t + (std::size_t)k * _j_size;
 			}
 			T &operator()(int t, int k, int j) {
 				assert(t < _t_size);
 				assert(k < _k_size);
 				assert(j < _j_size);
-				return _array[t][k][j];
+				return _array[t * _stride_t + (std::size_t)k * _j_size + j];
 			}
 			const T &operator()(int t, int k, int j) const {
 				assert(t < _t_size);
 				assert(k < _k_size);
 				assert(j < _j_size);
-				return _array[t][k][j];
+				return _array[t * _stride_t + (std::size_t)k * _j_size + j];
 			}
 		};
 		template<typename T>
 		class quad {
 		private:
+			std::size_t _capacity;
 			void _delete(){
-				for(int t = 0;t < _t_size;t++){
-					for(int k = 0;k < _k_size;k++){
-						for(int j = 0;j < _j_size;j++){
-							delete[] _array[t][k][j];
-						}
-						delete[] _array[t][k];
-					}
-					delete[] _array[t];
-				}
-				delete[] _array;
+				deallocate(_array);
+				_array = nullptr;
+				_capacity = 0;
 			}
+			// 確保済みの領域で足りる場合は再利用する
 			void _alloc(){
-				_array = new T***[_t_size];
-				for(int t = 0;t < _t_size;t++){
-					_array[t] = new T**[_k_size];
-					for(int k = 0;k < _k_size;k++){
-						_array[t][k] = new T*[_j_size];
-						for(int j = 0;j < _j_size;j++){
-							_array[t][k][j] = new T[_i_size];
-							for(int i = 0;i < _i_size;i++){
-								_array[t][k][j][i] = 0;
-							}
-						}
-					}
+				_stride_k = (std::size_t)_j_size * _i_size;
+				_stride_t = _k_size * _stride_k;
+				std::size_t size = _t_size * _stride_t;
+				if(size > _capacity){
+					_delete();
+					_array = allocate<T>(size);
+					_capacity = size;
 				}
+				std::fill(_array, _array + size, T());
 			}
 		public:
-			T**** _array;
+			T* _array;
 			int _t_size;
 			int _k_size;
 			int _j_size;
 			int _i_size;
+			std::size_t _stride_t;
+			std::size_t _stride_k;
 			quad(){
 				_array = nullptr;
+				_capacity = 0;
 				_t_size = 0;
 				_k_size = 0;
 				_j_size = 0;
 				_i_size = 0;
+				_stride_t = 0;
+				_stride_k = 0;
 			}
 			quad(int t_size, int k_size, int j_size, int i_size){
+				_array = nullptr;
+				_capacity = 0;
 				_t_size = t_size;
 				_k_size = k_size;
 				_j_size = j_size;
@@ -277,49 +343,70 @@ namespace npycrf {
 				_alloc();
 			}
 			quad(const quad &a){
-				if(_array != nullptr){
-					_delete();
-				}
+				_array = nullptr;
+				_capacity = 0;
 				_t_size = a._t_size;
 				_k_size = a._k_size;
 				_j_size = a._j_size;
 				_i_size = a._i_size;
 				_alloc();
-				for(int t = 0;t < _t_size;t++){
-					for(int k = 0;k < _k_size;k++){
-						for(int j = 0;j < _j_size;j++){
-							for(int i = 0;i < _i_size;i++){
-								_array[t][k][j][i] = a._array[t][k][j][i];
-							}
-						}
-					}
-				}
+				std::copy(a._array, a._array + a.size(), _array);
+			}
+			quad(quad &&a){
+				_array = a._array;
+				_capacity = a._capacity;
+				_t_size = a._t_size;
+				_k_size = a._k_size;
+				_j_size = a._j_size;
+				_i_size = a._i_size;
+				_stride_t = a._stride_t;
+				_stride_k = a._stride_k;
+				a._array = nullptr;
+				a._capacity = 0;
 			}
 			~quad(){
-				if(_array != nullptr){
-					_delete();
-				}
+				_delete();
 			}
 			quad &operator=(const quad &a){
-				if(_array != nullptr){
-					_delete();
+				if(this == &a){
+					return *this;
 				}
 				_t_size = a._t_size;
 				_k_size = a._k_size;
 				_j_size = a._j_size;
 				_i_size = a._i_size;
 				_alloc();
-				for(int t = 0;t < _t_size;t++){
-					for(int k = 0;k < _k_size;k++){
-						for(int j = 0;j < _j_size;j++){
-							for(int i = 0;i < _i_size;i++){
-								_array[t][k][j][i] = a._array[t][k][j][i];
-							}
-						}
-					}
+				std::copy(a._array, a._array + a.size(), _array);
+				return *this;
+			}
+			quad &operator=(quad &&a){
+				if(this == &a){
+					return *this;
 				}
+				_delete();
+				_array = a._array;
+				_capacity = a._capacity;
+				_t_size = a._t_size;
+				_k_size = a._k_size;
+				_j_size = a._j_size;
+				_i_size = a._i_size;
+				_stride_t = a._stride_t;
+				_stride_k = a._stride_k;
+				a._array = nullptr;
+				a._capacity = 0;
 				return *this;
 			}
+			// 形状を変更して0で初期化
+			void resize(int t_size, int k_size, int j_size, int i_size){
+				_t_size = t_size;
+				_k_size = k_size;
+				_j_size = j_size;
+				_i_size = i_size;
+				_alloc();
+			}
+			std::size_t size() const {
+				return _t_size * _stride_t;
+			}
 			int size_t(){
 				return _t_size;
 			}
@@ -336,29 +423,29 @@ namespace npycrf {
 				fill(value, _t_size);
 			}
 			void fill(T value, int t_size){
-				for(int t = 0;t < t_size;t++){
-					for(int k = 0;k < _k_size;k++){
-						for(int j = 0;j < _j_size;j++){
-							for(int i = 0;i < _i_size;i++){
-								_array[t][k][j][i] = value;
-							}
-						}
-					}
-				}
+				assert(t_size <= _t_size);
+				std::fill(_array, _array + t_size * _stride_t, value);
+			}
+			// (t, k, j)の行の先頭
+			T* row(int t, int k, int j){
+				assert(t < _t_size);
+				assert(k < _k_size);
+				assert(j < _j_size);
+				return _array + t * _stride_t + k * _stride_k + (std::size_t)j * _i_size;
 			}
 			T &operator()(int t, int k, int j, int i) {
 				assert(t < _t_size);
 				assert(k < _k_size);
 				assert(j < _j_size);
 				assert(i < _i_size);
-				return _array[t][k][j][i];
+				return _array[t * _stride_t + k * _stride_k + (std::size_t)j * _i_size + i];
 			}
 			const T &operator()(int t, int k, int j, int i) const {
 				assert(t < _t_size);
 				assert(k < _k_size);
 				assert(j < _j_size);
 				assert(i < _i_size);
-				return _array[t][k][j][i];
+				return _array[t * _stride_t + k * _stride_k + (std::size_t)j * _i_size + i];
 			}
 		};
 	}
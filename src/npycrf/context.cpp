@@ -0,0 +1,46 @@
+#include <cassert>
+#include "context.h"
+
+namespace npycrf {
+	InferenceContext::InferenceContext(npylm::NPYLM* npylm, crf::CRF* crf, bool viterbi_only){
+		_npylm = npylm;
+		_crf = crf;
+		_lattice = new Lattice(npylm, crf);
+		_lattice->set_viterbi_only_mode(viterbi_only);
+	}
+	InferenceContext::~InferenceContext(){
+		delete _lattice;
+	}
+	// モデル側のreserveは呼ばない
+	void InferenceContext::reserve(int max_sentence_length){
+		_lattice->reserve(_npylm->_max_word_length, max_sentence_length);
+	}
+	void InferenceContext::viterbi_decode(Sentence* sentence, std::vector<int> &segments){
+		reserve(sentence->size());
+		if(_crf == NULL){
+			_lattice->set_pure_npylm_mode(true);
+		}else{
+			// 学習時に別のモードへ切り替えられている場合がある
+			// 素性IDを持たない文はラティス側で重みを直接引くので展開しない
+			_lattice->set_npycrf_mode();
+		}
+		_lattice->viterbi_decode(sentence, segments);
+	}
+	// 固定したモデルから分割をサンプリング
+	// 学習用のテーブルが必要なのでviterbi_only = falseで作ること
+	// モデルへの客の追加・削除は呼び出し側で行う
+	void InferenceContext::blocked_gibbs(Sentence* sentence, std::vector<int> &segments, std::mt19937 &mt){
+		assert(_crf != NULL);
+		assert(_lattice->get_viterbi_only_mode() == false);
+		assert(sentence->_features != NULL);
+		reserve(sentence->size());
+		_lattice->set_npycrf_mode();
+		_lattice->set_random_generator(&mt);
+		_lattice->blocked_gibbs(sentence, segments, true);
+		_lattice->set_random_generator(NULL);
+	}
+	void InferenceContext::parse(Sentence* sentence){
+		viterbi_decode(sentence, _segments);
+		sentence->split(_segments);
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <vector>
+#include <random>
+#include "common.h"
+#include "sentence.h"
+#include "lattice.h"
+#include "crf/crf.h"
+#include "npylm/npylm.h"
+
+namespace npycrf {
+	// 推論用の作業領域
+	// ラティスの各テーブルとNPYLMの作業用配列（g0のキャッシュなど）をまとめて持つ
+	// 分割中はNPYLMとCRFを読むだけなので、スレッドごとに1つ作れば1つのモデルを共有したまま並列に分割できる
+	class InferenceContext {
+	public:
+		npylm::NPYLM* _npylm;
+		crf::CRF* _crf;			// NULLならNPYLMのみで分割
+		Lattice* _lattice;
+		std::vector<int> _segments;		// 分割の一時保存用. 文ごとに使い回す
+		// viterbi_only = trueならビタビアルゴリズムに必要なテーブルのみ確保する
+		InferenceContext(npylm::NPYLM* npylm, crf::CRF* crf, bool viterbi_only = true);
+		~InferenceContext();
+		void reserve(int max_sentence_length);
+		void viterbi_decode(Sentence* sentence, std::vector<int> &segments);
+		void parse(Sentence* sentence);
+		void blocked_gibbs(Sentence* sentence, std::vector<int> &segments, std::mt19937 &mt);
+	};
+}
@@ -1,6 +1,9 @@
 #include <boost/serialization/split_member.hpp>
 #include <iostream>
 #include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
 #include "../ctype.h"
 #include "../sampler.h"
 #include "crf.h"
@@ -20,64 +23,226 @@ namespace npycrf {
 			delete _extractor;
 			delete _parameter;
 		}
+		// 重みが0の素性を除いたモデルを作る. 保存用
+		// 存在しない素性の重みは0として扱うので、分割の結果は変わらない
+		// 素性IDを振り直すので、元のモデルで展開したFeatureIndicesとは互換性がない
+		CRF* CRF::copy_without_zero_weights(){
+			if(_parameter->_quantized != NULL){
+				throw std::runtime_error("CRF: a quantized model has no weights to copy.");
+			}
+			FeatureExtractor* extractor = new FeatureExtractor(*_extractor);
+			Parameter* parameter = new Parameter();
+			parameter->_bias = _parameter->_bias;
+			parameter->_lambda_0 = _parameter->_lambda_0;
+			parameter->_sigma = _parameter->_sigma;
+			int num_features = _parameter->get_num_features();
+			if(_extractor->_hash_bits > 0){
+				// ハッシュモードでは重みの位置を変えられない
+				parameter->_weights = _parameter->_weights;
+				return new CRF(extractor, parameter);
+			}
+			// 元の素性IDの順に詰める
+			array<int64_t> function_ids(num_features);
+			for(auto &elem: _extractor->_function_id_to_feature_id){
+				function_ids[elem.second] = elem.first;
+			}
+			extractor->_function_id_to_feature_id.clear();
+			int num_nonzero_features = num_features - _parameter->get_num_zero_weights();
+			parameter->_weights = array<double>(num_nonzero_features);
+			int new_feature_id = 0;
+			for(int k = 0;k < num_features;k++){
+				if(_parameter->_weights[k] == 0){
+					continue;
+				}
+				extractor->_function_id_to_feature_id[function_ids[k]] = new_feature_id;
+				parameter->_weights[new_feature_id] = _parameter->_weights[k];
+				new_feature_id += 1;
+			}
+			assert(new_feature_id == num_nonzero_features);
+			return new CRF(extractor, parameter);
+		}
+		// 重みを素性テンプレートごとのスケールでbitsビットの整数に量子化したモデルを作る. 分割用
+		// 絶対値がthreshold未満の重みと、量子化して0になる重みの素性は除く
+		// ハッシュモードでは素性テンプレートが分からないので、全体で1つのスケールを使い、素性も除かない
+		CRF* CRF::copy_quantized(int bits, double threshold){
+			if(_parameter->_quantized != NULL){
+				throw std::runtime_error("CRF: the model is already quantized.");
+			}
+			if(bits != 8 && bits != 16){
+				throw std::invalid_argument("CRF: bits must be 8 or 16.");
+			}
+			int num_features = _parameter->get_num_features();
+			bool hashed = _extractor->_hash_bits > 0;
+			array<int64_t> function_ids(num_features);
+			array<int> feature_templates(num_features);
+			for(int k = 0;k < num_features;k++){
+				feature_templates[k] = 0;
+			}
+			if(hashed == false){
+				for(auto &elem: _extractor->_function_id_to_feature_id){
+					function_ids[elem.second] = elem.first;
+					feature_templates[elem.second] = _extractor->get_feature_template(elem.first);
+				}
+			}
+			// テンプレートごとのスケール
+			double max_code = (bits == 8) ? INT8_MAX : INT16_MAX;
+			double scale[FEATURE_NUM_TEMPLATES];
+			for(int t = 0;t < FEATURE_NUM_TEMPLATES;t++){
+				scale[t] = 0;
+			}
+			for(int k = 0;k < num_features;k++){
+				double w = std::abs(_parameter->_weights[k]);
+				if(hashed || w >= threshold){
+					scale[feature_templates[k]] = std::max(scale[feature_templates[k]], w / max_code);
+				}
+			}
+			array<int> codes(num_features);
+			int num_kept_features = 0;
+			for(int k = 0;k < num_features;k++){
+				int t = feature_templates[k];
+				double w = _parameter->_weights[k];
+				codes[k] = 0;
+				if(scale[t] > 0 && (hashed || std::abs(w) >= threshold)){
+					codes[k] = std::max(-max_code, std::min(max_code, std::round(w / scale[t])));
+				}
+				if(hashed || codes[k] != 0){
+					num_kept_features += 1;
+				}
+			}
+			// テンプレートの順に素性IDを振り直す
+			FeatureExtractor* extractor = new FeatureExtractor(*_extractor);
+			Parameter* parameter = new Parameter();
+			parameter->_bias = _parameter->_bias;
+			parameter->_lambda_0 = _parameter->_lambda_0;
+			parameter->_sigma = _parameter->_sigma;
+			QuantizedWeights* quantized = new QuantizedWeights(bits, num_kept_features);
+			if(hashed){
+				for(int k = 0;k < num_features;k++){
+					quantized->set_code(k, codes[k]);
+				}
+				for(int t = 0;t < FEATURE_NUM_TEMPLATES;t++){
+					quantized->_scale[t] = scale[0];
+				}
+			}else{
+				extractor->_function_id_to_feature_id.clear();
+				int new_feature_id = 0;
+				for(int t = 0;t < FEATURE_NUM_TEMPLATES;t++){
+					for(int k = 0;k < num_features;k++){
+						if(feature_templates[k] != t || codes[k] == 0){
+							continue;
+						}
+						extractor->_function_id_to_feature_id[function_ids[k]] = new_feature_id;
+						quantized->set_code(new_feature_id, codes[k]);
+						new_feature_id += 1;
+					}
+					quantized->_scale[t] = scale[t];
+					quantized->_template_end[t] = new_feature_id;
+				}
+				assert(new_feature_id == num_kept_features);
+			}
+			parameter->_quantized = quantized;
+			return new CRF(extractor, parameter);
+		}
 		int CRF::get_num_features(){
-			return _extractor->_function_id_to_feature_id.size();
+			return _extractor->get_num_features();
 		}
 		double CRF::w_label_u(int y_i) const {
 			int index = _extractor->feature_id_label_u(y_i);
-			return _parameter->_weights[index];
+			if(index == -1){	// 存在しない素性
+				return 0;
+			}
+			return _parameter->get_weight(index);
 		}
 		double CRF::w_label_b(int y_i_1, int y_i) const {
 			int index = _extractor->feature_id_label_b(y_i_1, y_i);
-			return _parameter->_weights[index];
+			if(index == -1){	// 存在しない素性
+				return 0;
+			}
+			return _parameter->get_weight(index);
 		}
 		double CRF::w_unigram_u(int y_i, int i, int x_i) const {
 			int index = _extractor->feature_id_unigram_u(y_i, i, x_i);
-			return _parameter->_weights[index];
+			if(index == -1){	// 存在しない素性
+				return 0;
+			}
+			return _parameter->get_weight(index);
 		}
 		double CRF::w_unigram_b(int y_i_1, int y_i, int i, int x_i) const {
 			int index = _extractor->feature_id_unigram_b(y_i_1, y_i, i, x_i);
-			return _parameter->_weights[index];
+			if(index == -1){	// 存在しない素性
+				return 0;
+			}
+			return _parameter->get_weight(index);
 		}
 		double CRF::w_bigram_u(int y_i, int i, int x_i_1, int x_i) const {
 			int index = _extractor->feature_id_bigram_u(y_i, i, x_i_1, x_i);
-			return _parameter->_weights[index];
+			if(index == -1){	// 存在しない素性
+				return 0;
+			}
+			return _parameter->get_weight(index);
 		}
 		double CRF::w_bigram_b(int y_i_1, int y_i, int i, int x_i_1, int x_i) const {
 			int index = _extractor->feature_id_bigram_b(y_i_1, y_i, i, x_i_1, x_i);
-			return _parameter->_weights[index];
+			if(index == -1){	// 存在しない素性
+				return 0;
+			}
+			return _parameter->get_weight(index);
 		}
 		double CRF::w_identical_1_u(int y_i, int i) const {
 			int index = _extractor->feature_id_identical_1_u(y_i, i);
-			return _parameter->_weights[index];
+			if(index == -1){	// 存在しない素性
+				return 0;
+			}
+			return _parameter->get_weight(index);
 		}
 		double CRF::w_identical_1_b(int y_i_1, int y_i, int i) const {
 			int index = _extractor->feature_id_identical_1_b(y_i_1, y_i, i);
-			return _parameter->_weights[index];
+			if(index == -1){	// 存在しない素性
+				return 0;
+			}
+			return _parameter->get_weight(index);
 		}
 		double CRF::w_identical_2_u(int y_i, int i) const {
 			int index = _extractor->feature_id_identical_2_u(y_i, i);
-			return _parameter->_weights[index];
+			if(index == -1){	// 存在しない素性
+				return 0;
+			}
+			return _parameter->get_weight(index);
 		}
 		double CRF::w_identical_2_b(int y_i_1, int y_i, int i) const {
 			int index = _extractor->feature_id_identical_2_b(y_i_1, y_i, i);
-			return _parameter->_weights[index];
+			if(index == -1){	// 存在しない素性
+				return 0;
+			}
+			return _parameter->get_weight(index);
 		}
 		double CRF::w_unigram_type_u(int y_i, int type_i) const {
 			int index = _extractor->feature_id_unigram_type_u(y_i, type_i);
-			return _parameter->_weights[index];
+			if(index == -1){	// 存在しない素性
+				return 0;
+			}
+			return _parameter->get_weight(index);
 		}
 		double CRF::w_unigram_type_b(int y_i_1, int y_i, int type_i) const {
 			int index = _extractor->feature_id_unigram_type_b(y_i_1, y_i, type_i);
-			return _parameter->_weights[index];
+			if(index == -1){	// 存在しない素性
+				return 0;
+			}
+			return _parameter->get_weight(index);
 		}
 		double CRF::w_bigram_type_u(int y_i, int type_i_1, int type_i) const {
 			int index = _extractor->feature_id_bigram_type_u(y_i, type_i_1, type_i);
-			return _parameter->_weights[index];
+			if(index == -1){	// 存在しない素性
+				return 0;
+			}
+			return _parameter->get_weight(index);
 		}
 		double CRF::w_bigram_type_b(int y_i_1, int y_i, int type_i_1, int type_i) const {
 			int index = _extractor->feature_id_bigram_type_b(y_i_1, y_i, type_i_1, type_i);
-			return _parameter->_weights[index];
+			if(index == -1){	// 存在しない素性
+				return 0;
+			}
+			return _parameter->get_weight(index);
 		}
 		// void CRF::set_w_label_u(int y_i, double value){
 		// 	int index = _extractor->feature_id_label_u(y_i);
@@ -163,6 +328,93 @@ namespace npycrf {
 			}
 			return sum_cost;
 		}
+		// 文の全ての位置のパスのコストを列挙
+		// path_cost(i, y_{i-1}, y_i)はcompute_path_cost(sentence, i - 1, i, y_{i-1}, y_i)と同じ
+		// cumulative_path_cost_0_0[i]は位置2からiまでの(0, 0)のパスのコストの和
+		void CRF::enumerate_path_costs(Sentence* sentence, mat::tri<double> &path_cost, array<double> &cumulative_path_cost_0_0){
+			int character_ids_length = sentence->size();
+			cumulative_path_cost_0_0[0] = 0;
+			cumulative_path_cost_0_0[1] = 0;
+			for(int i = 2;i <= character_ids_length + 2;i++){
+				// </s>以降はy_i = 1のみ
+				int start_y_i = (i > character_ids_length) ? 1 : 0;
+				for(int y_i_1 = 0;y_i_1 <= 1;y_i_1++){
+					for(int y_i = start_y_i;y_i <= 1;y_i++){
+						path_cost(i, y_i_1, y_i) = compute_path_cost(sentence, i - 1, i, y_i_1, y_i);
+					}
+				}
+				if(i > character_ids_length){
+					cumulative_path_cost_0_0[i] = cumulative_path_cost_0_0[i - 1];
+				}else{
+					cumulative_path_cost_0_0[i] = cumulative_path_cost_0_0[i - 1] + path_cost(i, 0, 0);
+				}
+			}
+		}
+		// 素性IDを展開せずに文字から直接パスのコストを列挙する
+		// 分割のみを行う場合に使う. 表を使い回せばヒープ領域を確保しない
+		// FeatureIndicesを使う場合と同じ順に重みを足すので結果は一致する
+		void CRF::enumerate_path_costs_without_features(Sentence* sentence, Potentials* potentials){
+			int character_ids_length = sentence->size();
+			int seq_length = character_ids_length + 3;
+			potentials->resize(character_ids_length);
+			mat::tri<double> &path_cost = potentials->_path_cost;
+			array<double> &cumulative_path_cost_0_0 = potentials->_cumulative_path_cost_0_0;
+			for(int i = 2;i <= character_ids_length + 2;i++){
+				for(int y_i_1 = 0;y_i_1 <= 1;y_i_1++){
+					for(int y_i = 0;y_i <= 1;y_i++){
+						path_cost(i, y_i_1, y_i) = 0;
+					}
+				}
+			}
+			// 列の番号からi, y_{i-1}, y_iを戻して重みを足す
+			// ラベルunigram素性の列はラベルbigram素性の列より先に列挙されるので足す順はFeatureIndicesと同じ
+			_extractor->_enumerate_function_ids(sentence, [&](int row, int feature_template, int64_t function_id){
+				if(row < seq_length * 2){
+					int i = row >> 1;
+					int y_i = row & 1;
+					// </s>以降はy_i = 1のみ
+					if(i < 2 || (i > character_ids_length && y_i == 0)){
+						return;
+					}
+					double weight = _weight_of_function(function_id, feature_template);
+					path_cost(i, 0, y_i) += weight;
+					path_cost(i, 1, y_i) += weight;
+				}else{
+					int r = row - seq_length * 2;
+					int i = r >> 2;
+					int y_i_1 = (r >> 1) & 1;
+					int y_i = r & 1;
+					if(i < 2 || (i > character_ids_length && y_i == 0)){
+						return;
+					}
+					path_cost(i, y_i_1, y_i) += _weight_of_function(function_id, feature_template);
+				}
+			});
+			cumulative_path_cost_0_0[0] = 0;
+			cumulative_path_cost_0_0[1] = 0;
+			for(int i = 2;i <= character_ids_length + 2;i++){
+				if(i > character_ids_length){
+					cumulative_path_cost_0_0[i] = cumulative_path_cost_0_0[i - 1];
+				}else{
+					cumulative_path_cost_0_0[i] = cumulative_path_cost_0_0[i - 1] + path_cost(i, 0, 0);
+				}
+			}
+		}
+		// 素性関数の重み. 学習データに現れなかった素性は0
+		double CRF::_weight_of_function(int64_t function_id, int feature_template){
+			int feature_id = _extractor->function_id_to_feature_id(function_id, false);
+			if(feature_id == -1){
+				return 0;
+			}
+			return _parameter->get_weight(feature_id, feature_template);
+		}
+		// 素性IDを使って文のパスのコストの表を作る
+		// 表を使い回せばヒープ領域を確保しない
+		void CRF::enumerate_potentials(Sentence* sentence, Potentials* potentials){
+			potentials->resize(sentence->size());
+			enumerate_path_costs(sentence, potentials->_path_cost, potentials->_cumulative_path_cost_0_0);
+			potentials->_version = _parameter->_version;
+		}
 		// 隣接するノード間[i-1,i]のパスのコストを計算
 		// yはクラス（0か1）
 		// iはノードの位置（1スタートなので注意。インデックスではない.ただし実際は隣接ノードが取れるi>=2のみ可）
@@ -182,13 +434,25 @@ namespace npycrf {
 				assert(y_i == 1);
 			}
 			FeatureIndices* features = sentence->_features;
-			for(int m = 0;m < features->_num_features_u(i, y_i);m++){
-				int k = features->_feature_indices_u[i][y_i][m];
-				cost += _parameter->_weights[k];
-			}
-			for(int m = 0;m < features->_num_features_b(i, y_i_1, y_i);m++){
-				int k = features->_feature_indices_b[i][y_i_1][y_i][m];
-				cost += _parameter->_weights[k];
+			QuantizedWeights* quantized = _parameter->_quantized;
+			if(quantized != NULL){
+				int t = 0;
+				for(int const* k = features->begin_u(i, y_i), *end = features->end_u(i, y_i);k != end;k++){
+					t = quantized->get_template(*k, t);
+					cost += quantized->get(*k, t);
+				}
+				t = 0;
+				for(int const* k = features->begin_b(i, y_i_1, y_i), *end = features->end_b(i, y_i_1, y_i);k != end;k++){
+					t = quantized->get_template(*k, t);
+					cost += quantized->get(*k, t);
+				}
+			}else{
+				for(int const* k = features->begin_u(i, y_i), *end = features->end_u(i, y_i);k != end;k++){
+					cost += _parameter->_weights[*k];
+				}
+				for(int const* k = features->begin_b(i, y_i_1, y_i), *end = features->end_b(i, y_i_1, y_i);k != end;k++){
+					cost += _parameter->_weights[*k];
+				}
 			}
 
 			#ifdef __DEBUG__
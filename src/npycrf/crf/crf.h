@@ -6,6 +6,7 @@
 #include "../array.h"
 #include "../sentence.h"
 #include "parameter.h"
+#include "potentials.h"
 #include "feature/indices.h"
 #include "feature/extractor.h"
 
@@ -32,6 +33,8 @@ namespace npycrf {
 			CRF(FeatureExtractor* extractor, Parameter* parameter);
 			CRF();
 			~CRF();
+			CRF* copy_without_zero_weights();
+			CRF* copy_quantized(int bits, double threshold);
 			int get_num_features();
 			double w_label_u(int y_i) const;
 			double w_label_b(int y_i_1, int y_i) const;
@@ -62,6 +65,10 @@ namespace npycrf {
 			// void set_w_bigram_type_u(int y_i, int type_i_1, int type_i, double value);
 			// void set_w_bigram_type_b(int y_i_1, int y_i, int type_i_1, int type_i, double value);
 			double compute_gamma(Sentence* sentence, int s, int t);
+			void enumerate_path_costs(Sentence* sentence, mat::tri<double> &path_cost, array<double> &cumulative_path_cost_0_0);
+			void enumerate_potentials(Sentence* sentence, Potentials* potentials);
+			void enumerate_path_costs_without_features(Sentence* sentence, Potentials* potentials);
+			double _weight_of_function(int64_t function_id, int feature_template);
 			double compute_path_cost(Sentence* sentence, int i_1, int i, int y_i_1, int y_i);
 			double _compute_cost_label_features(int y_i_1, int y_i);
 			double _compute_cost_unigram_features(array<int> &character_ids, int character_ids_length, int i, int y_i_1, int y_i);
@@ -1,3 +1,4 @@
+#include <boost/serialization/split_member.hpp>
 #include <cassert>
 #include "extractor.h"
 #include "../../ctype.h"
@@ -5,8 +6,16 @@
 namespace npycrf {
 	namespace crf {
 		namespace feature {
+			// 素性関数の番号を64bitのまま混ぜる
+			static inline uint64_t hash_function_id(int64_t function_id){
+				uint64_t x = (uint64_t)function_id;
+				x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+				x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+				return x ^ (x >> 31);
+			}
 			FeatureExtractor::FeatureExtractor(){
-
+				_hash_bits = 0;
+				_hash_mask = 0;
 			}
 			FeatureExtractor::FeatureExtractor(
 				int num_character_ids,
@@ -18,7 +27,8 @@ namespace npycrf {
 				int feature_x_identical_1_start,
 				int feature_x_identical_1_end,
 				int feature_x_identical_2_start,
-				int feature_x_identical_2_end
+				int feature_x_identical_2_end,
+				int hash_bits
 			){
 				_num_character_ids = num_character_ids;
 				_num_character_types = num_character_types;
@@ -27,6 +37,7 @@ namespace npycrf {
 				assert(feature_x_bigram_start <= feature_x_bigram_end);
 				assert(feature_x_identical_1_start <= feature_x_identical_1_end);
 				assert(feature_x_identical_2_start <= feature_x_identical_2_end);
+				assert(0 <= hash_bits && hash_bits <= 30);	// 素性IDはint
 
 				_x_unigram_start = feature_x_unigram_start;
 				_x_unigram_end = feature_x_unigram_end;
@@ -37,11 +48,21 @@ namespace npycrf {
 				_x_identical_2_start = feature_x_identical_2_start;
 				_x_identical_2_end = feature_x_identical_2_end;
 
-				_x_range_unigram = feature_x_unigram_end - feature_x_unigram_start + 1;
-				_x_range_bigram = feature_x_bigram_end - feature_x_bigram_start + 1;
-				_x_range_identical_1 = feature_x_identical_1_end - feature_x_identical_1_start + 1;
-				_x_range_identical_2 = feature_x_identical_2_end - feature_x_identical_2_start + 1;
+				_hash_bits = hash_bits;
+				_hash_mask = (hash_bits == 0) ? 0 : ((int64_t)1 << hash_bits) - 1;
 
+				_init_function_id_space();
+			}
+			// 素性関数の番号の範囲を決める
+			// 文字bigram素性は文字種の2乗に比例するのでintでは溢れることがある
+			void FeatureExtractor::_init_function_id_space(){
+				_x_range_unigram = _x_unigram_end - _x_unigram_start + 1;
+				_x_range_bigram = _x_bigram_end - _x_bigram_start + 1;
+				_x_range_identical_1 = _x_identical_1_end - _x_identical_1_start + 1;
+				_x_range_identical_2 = _x_identical_2_end - _x_identical_2_start + 1;
+
+				int64_t num_character_ids = _num_character_ids;
+				int64_t num_character_types = _num_character_types;
 				// (y_i), (y_{i-1}, y_i)
 				_w_size_label_u = 2;
 				_w_size_label_b = 2 * 2;
@@ -123,96 +144,101 @@ namespace npycrf {
 										+ _w_size_unigram_type_u + _w_size_unigram_type_b
 										+ _w_size_bigram_type_u;
 			}
-			int FeatureExtractor::function_id_label_u(int y_i){
-				int index = y_i;
+			int64_t FeatureExtractor::function_id_label_u(int y_i){
+				int64_t index = y_i;
 				assert(index < _w_size_label_u);
 				return index + _offset_w_label_u;
 			}
-			int FeatureExtractor::function_id_label_b(int y_i_1, int y_i){
-				int index =  y_i_1 * 2 + y_i;
+			int64_t FeatureExtractor::function_id_label_b(int y_i_1, int y_i){
+				int64_t index =  y_i_1 * 2 + y_i;
 				assert(index < _w_size_label_b);
 				return index + _offset_w_label_b;
 			}
-			int FeatureExtractor::function_id_unigram_u(int y_i, int i, int x_i){
+			int64_t FeatureExtractor::function_id_unigram_u(int y_i, int i, int x_i){
 				assert(x_i < _num_character_ids);
 				assert(1 <= i && i <= _x_range_unigram);
-				int index = x_i * _x_range_unigram * 2 + (i - 1) * 2 + y_i;
+				int64_t index = (int64_t)x_i * _x_range_unigram * 2 + (i - 1) * 2 + y_i;
 				assert(index < _w_size_unigram_u);
 				return index + _offset_w_unigram_u;
 			}
-			int FeatureExtractor::function_id_unigram_b(int y_i_1, int y_i, int i, int x_i){
+			int64_t FeatureExtractor::function_id_unigram_b(int y_i_1, int y_i, int i, int x_i){
 				assert(x_i < _num_character_ids);
 				assert(1 <= i && i <= _x_range_unigram);
-				int index = x_i * _x_range_unigram * 2 * 2 + (i - 1) * 2 * 2 + y_i * 2 + y_i_1;
+				int64_t index = (int64_t)x_i * _x_range_unigram * 2 * 2 + (i - 1) * 2 * 2 + y_i * 2 + y_i_1;
 				assert(index < _w_size_unigram_b);
 				return index + _offset_w_unigram_b;
 			}
-			int FeatureExtractor::function_id_bigram_u(int y_i, int i, int x_i_1, int x_i){
+			int64_t FeatureExtractor::function_id_bigram_u(int y_i, int i, int x_i_1, int x_i){
 				assert(x_i_1 < _num_character_ids);
 				assert(x_i < _num_character_ids);
 				assert(1 <= i && i <= _x_range_bigram);
-				int index = x_i * _num_character_ids * _x_range_bigram * 2 + x_i_1 * _x_range_bigram * 2 + (i - 1) * 2 + y_i;
+				int64_t index = (int64_t)x_i * _num_character_ids * _x_range_bigram * 2 + (int64_t)x_i_1 * _x_range_bigram * 2 + (i - 1) * 2 + y_i;
 				assert(index < _w_size_bigram_u);
 				return index + _offset_w_bigram_u;
 			}
-			int FeatureExtractor::function_id_bigram_b(int y_i_1, int y_i, int i, int x_i_1, int x_i){
+			int64_t FeatureExtractor::function_id_bigram_b(int y_i_1, int y_i, int i, int x_i_1, int x_i){
 				assert(x_i_1 < _num_character_ids);
 				assert(x_i < _num_character_ids);
 				assert(1 <= i && i <= _x_range_bigram);
-				int index = x_i * _num_character_ids * _x_range_bigram * 2 * 2 + x_i_1 * _x_range_bigram * 2 * 2 + (i - 1) * 2 * 2 + y_i * 2 + y_i_1;
+				int64_t index = (int64_t)x_i * _num_character_ids * _x_range_bigram * 2 * 2 + (int64_t)x_i_1 * _x_range_bigram * 2 * 2 + (i - 1) * 2 * 2 + y_i * 2 + y_i_1;
 				assert(index < _w_size_bigram_b);
 				return index + _offset_w_bigram_b;
 			}
-			int FeatureExtractor::function_id_identical_1_u(int y_i, int i){
+			int64_t FeatureExtractor::function_id_identical_1_u(int y_i, int i){
 				assert(1 <= i && i <= _x_range_identical_1);
-				int index = (i - 1) * 2 + y_i;
+				int64_t index = (i - 1) * 2 + y_i;
 				assert(index < _w_size_identical_1_u);
 				return index + _offset_w_identical_1_u;
 			}
-			int FeatureExtractor::function_id_identical_1_b(int y_i_1, int y_i, int i){
+			int64_t FeatureExtractor::function_id_identical_1_b(int y_i_1, int y_i, int i){
 				assert(1 <= i && i <= _x_range_identical_1);
-				int index = (i - 1) * 2 * 2 + y_i * 2 + y_i_1;
+				int64_t index = (i - 1) * 2 * 2 + y_i * 2 + y_i_1;
 				assert(index < _w_size_identical_1_b);
 				return index + _offset_w_identical_1_b;
 			}
-			int FeatureExtractor::function_id_identical_2_u(int y_i, int i){
+			int64_t FeatureExtractor::function_id_identical_2_u(int y_i, int i){
 				assert(1 <= i && i <= _x_range_identical_2);
-				int index = (i - 1) * 2 + y_i;
+				int64_t index = (i - 1) * 2 + y_i;
 				assert(index < _w_size_identical_2_u);
 				return index + _offset_w_identical_2_u;
 			}
-			int FeatureExtractor::function_id_identical_2_b(int y_i_1, int y_i, int i){
+			int64_t FeatureExtractor::function_id_identical_2_b(int y_i_1, int y_i, int i){
 				assert(1 <= i && i <= _x_range_identical_2);
-				int index = (i - 1) * 2 * 2 + y_i * 2 + y_i_1;
+				int64_t index = (i - 1) * 2 * 2 + y_i * 2 + y_i_1;
 				assert(index < _w_size_identical_2_b);
 				return index + _offset_w_identical_2_b;
 			}
-			int FeatureExtractor::function_id_unigram_type_u(int y_i, int type_i){
-				int index = type_i * 2 + y_i;
+			int64_t FeatureExtractor::function_id_unigram_type_u(int y_i, int type_i){
+				int64_t index = type_i * 2 + y_i;
 				assert(index < _w_size_unigram_type_u);
 				return index + _offset_w_unigram_type_u;
 			}
-			int FeatureExtractor::function_id_unigram_type_b(int y_i_1, int y_i, int type_i){
+			int64_t FeatureExtractor::function_id_unigram_type_b(int y_i_1, int y_i, int type_i){
 				assert(type_i < _num_character_types);
-				int index = type_i * 2 * 2 + y_i * 2 + y_i_1;
+				int64_t index = type_i * 2 * 2 + y_i * 2 + y_i_1;
 				assert(index < _w_size_unigram_type_b);
 				return index + _offset_w_unigram_type_b;
 			}
-			int FeatureExtractor::function_id_bigram_type_u(int y_i, int type_i_1, int type_i){
+			int64_t FeatureExtractor::function_id_bigram_type_u(int y_i, int type_i_1, int type_i){
 				assert(type_i_1 < _num_character_types);
 				assert(type_i < _num_character_types);
-				int index = type_i * _num_character_types * 2 + type_i_1 * 2 + y_i;
+				int64_t index = type_i * _num_character_types * 2 + type_i_1 * 2 + y_i;
 				assert(index < _w_size_bigram_type_u);
 				return index + _offset_w_bigram_type_u;
 			}
-			int FeatureExtractor::function_id_bigram_type_b(int y_i_1, int y_i, int type_i_1, int type_i){
+			int64_t FeatureExtractor::function_id_bigram_type_b(int y_i_1, int y_i, int type_i_1, int type_i){
 				assert(type_i_1 < _num_character_types);
 				assert(type_i < _num_character_types);
-				int index = type_i * _num_character_types * 2 * 2 + type_i_1 * 2 * 2 + y_i * 2 + y_i_1;
+				int64_t index = type_i * _num_character_types * 2 * 2 + type_i_1 * 2 * 2 + y_i * 2 + y_i_1;
 				assert(index < _w_size_bigram_type_b);
 				return index + _offset_w_bigram_type_b;
 			}
-			int FeatureExtractor::function_id_to_feature_id(int function_id, bool generate_feature_id_if_needed){
+			// ハッシュモードでは表を引かずに重みの位置を決める
+			// 別の素性関数が同じ重みを共有することがある
+			int FeatureExtractor::function_id_to_feature_id(int64_t function_id, bool generate_feature_id_if_needed){
+				if(_hash_bits > 0){
+					return (int)(hash_function_id(function_id) & _hash_mask);
+				}
 				auto itr = _function_id_to_feature_id.find(function_id);
 				if(itr == _function_id_to_feature_id.end()){
 					if(generate_feature_id_if_needed == false){
@@ -224,307 +250,178 @@ namespace npycrf {
 				}
 				return itr->second;
 			}
+			int FeatureExtractor::get_num_features(){
+				if(_hash_bits > 0){
+					return (int)(_hash_mask + 1);
+				}
+				return _function_id_to_feature_id.size();
+			}
 			int FeatureExtractor::feature_id_label_u(int y_i){
-				int function_id = function_id_label_u(y_i);
+				int64_t function_id = function_id_label_u(y_i);
 				return function_id_to_feature_id(function_id, false);
 			}
 			int FeatureExtractor::feature_id_label_b(int y_i_1, int y_i){
-				int function_id = function_id_label_b(y_i_1, y_i);
+				int64_t function_id = function_id_label_b(y_i_1, y_i);
 				return function_id_to_feature_id(function_id, false);
 			}
 			int FeatureExtractor::feature_id_unigram_u(int y_i, int i, int x_i){
-				int function_id = function_id_unigram_u(y_i, i, x_i);
+				int64_t function_id = function_id_unigram_u(y_i, i, x_i);
 				return function_id_to_feature_id(function_id, false);
 			}
 			int FeatureExtractor::feature_id_unigram_b(int y_i_1, int y_i, int i, int x_i){
-				int function_id = function_id_unigram_b(y_i_1, y_i, i, x_i);
+				int64_t function_id = function_id_unigram_b(y_i_1, y_i, i, x_i);
 				return function_id_to_feature_id(function_id, false);
 			}
 			int FeatureExtractor::feature_id_bigram_u(int y_i, int i, int x_i_1, int x_i){
-				int function_id = function_id_bigram_u(y_i, i, x_i_1, x_i);
+				int64_t function_id = function_id_bigram_u(y_i, i, x_i_1, x_i);
 				return function_id_to_feature_id(function_id, false);
 			}
 			int FeatureExtractor::feature_id_bigram_b(int y_i_1, int y_i, int i, int x_i_1, int x_i){
-				int function_id = function_id_bigram_b(y_i_1, y_i, i, x_i_1, x_i);
+				int64_t function_id = function_id_bigram_b(y_i_1, y_i, i, x_i_1, x_i);
 				return function_id_to_feature_id(function_id, false);
 			}
 			int FeatureExtractor::feature_id_identical_1_u(int y_i, int i){
-				int function_id = function_id_identical_1_u(y_i, i);
+				int64_t function_id = function_id_identical_1_u(y_i, i);
 				return function_id_to_feature_id(function_id, false);
 			}
 			int FeatureExtractor::feature_id_identical_1_b(int y_i_1, int y_i, int i){
-				int function_id = function_id_identical_1_b(y_i_1, y_i, i);
+				int64_t function_id = function_id_identical_1_b(y_i_1, y_i, i);
 				return function_id_to_feature_id(function_id, false);
 			}
 			int FeatureExtractor::feature_id_identical_2_u(int y_i, int i){
-				int function_id = function_id_identical_2_u(y_i, i);
+				int64_t function_id = function_id_identical_2_u(y_i, i);
 				return function_id_to_feature_id(function_id, false);
 			}
 			int FeatureExtractor::feature_id_identical_2_b(int y_i_1, int y_i, int i){
-				int function_id = function_id_identical_2_b(y_i_1, y_i, i);
+				int64_t function_id = function_id_identical_2_b(y_i_1, y_i, i);
 				return function_id_to_feature_id(function_id, false);
 			}
 			int FeatureExtractor::feature_id_unigram_type_u(int y_i, int type_i){
-				int function_id = function_id_unigram_type_u(y_i, type_i);
+				int64_t function_id = function_id_unigram_type_u(y_i, type_i);
 				return function_id_to_feature_id(function_id, false);
 			}
 			int FeatureExtractor::feature_id_unigram_type_b(int y_i_1, int y_i, int type_i){
-				int function_id = function_id_unigram_type_b(y_i_1, y_i, type_i);
+				int64_t function_id = function_id_unigram_type_b(y_i_1, y_i, type_i);
 				return function_id_to_feature_id(function_id, false);
 			}
 			int FeatureExtractor::feature_id_bigram_type_u(int y_i, int type_i_1, int type_i){
-				int function_id = function_id_bigram_type_u(y_i, type_i_1, type_i);
+				int64_t function_id = function_id_bigram_type_u(y_i, type_i_1, type_i);
 				return function_id_to_feature_id(function_id, false);
 			}
 			int FeatureExtractor::feature_id_bigram_type_b(int y_i_1, int y_i, int type_i_1, int type_i){
-				int function_id = function_id_bigram_type_b(y_i_1, y_i, type_i_1, type_i);
+				int64_t function_id = function_id_bigram_type_b(y_i_1, y_i, type_i_1, type_i);
 				return function_id_to_feature_id(function_id, false);
 			}
 			FeatureIndices* FeatureExtractor::extract(Sentence* sentence, bool generate_feature_id_if_needed){
 				assert(sentence->_features == NULL);
-
-				array<int> &character_ids = sentence->_character_ids;
-				wchar_t const* characters = sentence->_characters;
-				int character_ids_length = sentence->size();
-				int feature_id;
-
-				// CRFのラベルunigram素性の数
-				mat::bi<int> num_crf_features_u(character_ids_length + 3, 2);
-				int*** crf_feature_indices_u = new int**[character_ids_length + 3];
-
-				// ラベルunigram素性
-				for(int i = 1;i <= character_ids_length + 2;i++){	// 末尾に<eos>が2つ入る
-					crf_feature_indices_u[i] = new int*[2];
-					for(int y_i = 0;y_i <= 1;y_i++){
-						std::vector<int> indices_u;
-						int r_start, r_end;
-						// ラベル素性
-						feature_id = function_id_to_feature_id(function_id_label_u(y_i), generate_feature_id_if_needed);
-						if(feature_id != -1){
-							indices_u.push_back(feature_id);
-						}
-						// 文字unigram素性
-						r_start = std::max(1, i + _x_unigram_start);
-						r_end = std::min(character_ids_length + 2, i + _x_unigram_end);	// <eos>2つを考慮
-						for(int r = r_start;r <= r_end;r++){
-							int pos = r - i - _x_unigram_start + 1;	// [1, _x_range_unigram]
-							int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
-							feature_id = function_id_to_feature_id(function_id_unigram_u(y_i, pos, x_i), generate_feature_id_if_needed);
-							if(feature_id != -1){
-								indices_u.push_back(feature_id);
-							}
-						}
-						// 文字bigram素性
-						r_start = std::max(2, i + _x_bigram_start);
-						r_end = std::min(character_ids_length + 2, i + _x_bigram_end);
-						for(int r = r_start;r <= r_end;r++){
-							int pos = r - i - _x_bigram_start + 1;	// [1, _x_range_bigram]
-							int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
-							int x_i_1 = (r - 1 <= character_ids_length) ? character_ids[r - 2] : SPECIAL_CHARACTER_END;
-							feature_id = function_id_to_feature_id(function_id_bigram_u(y_i, pos, x_i_1, x_i), generate_feature_id_if_needed);
-							if(feature_id != -1){
-								indices_u.push_back(feature_id);
-							}
-						}
-						// identical_1素性
-						r_start = std::max(2, i + _x_identical_1_start);
-						r_end = std::min(character_ids_length + 2, i + _x_identical_1_end);
-						for(int r = r_start;r <= r_end;r++){
-							int pos = r - i - _x_identical_1_start + 1;	// [1, _x_range_identical_1]
-							int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
-							int x_i_1 = (r - 1 <= character_ids_length) ? character_ids[r - 2] : SPECIAL_CHARACTER_END;
-							if(x_i == x_i_1){
-								feature_id = function_id_to_feature_id(function_id_identical_1_u(y_i, pos), generate_feature_id_if_needed);
-								if(feature_id != -1){
-									indices_u.push_back(feature_id);
-								}
-							}
-						}
-						// identical_2素性
-						r_start = std::max(3, i + _x_identical_2_start);
-						r_end = std::min(character_ids_length + 2, i + _x_identical_2_end);
-						for(int r = r_start;r <= r_end;r++){
-							int pos = r - i - _x_identical_2_start + 1;	// [1, _x_range_identical_2]
-							int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
-							int x_i_2 = (r - 2 <= character_ids_length) ? character_ids[r - 3] : SPECIAL_CHARACTER_END;
-							if(x_i == x_i_2){
-								feature_id = function_id_to_feature_id(function_id_identical_2_u(y_i, pos), generate_feature_id_if_needed);
-								if(feature_id != -1){
-									indices_u.push_back(feature_id);
-								}
-							}
-						}
-						// 文字種unigram・bigram素性
-						int type_i = (i <= character_ids_length) ? ctype::get_type(characters[i - 1]) : CTYPE_UNKNOWN;
-						int type_i_1 = (i - 1 <= character_ids_length) ? ctype::get_type(characters[i - 2]) : CTYPE_UNKNOWN;
-						feature_id = function_id_to_feature_id(function_id_unigram_type_u(y_i, type_i), generate_feature_id_if_needed);
-						if(feature_id != -1){
-							indices_u.push_back(feature_id);
-						}
-						feature_id = function_id_to_feature_id(function_id_bigram_type_u(y_i, type_i_1, type_i), generate_feature_id_if_needed);
-						if(feature_id != -1){
-							indices_u.push_back(feature_id);
-						}
-
-						int num_features = indices_u.size();
-						num_crf_features_u(i, y_i) = num_features;
-						if(num_features > 0){
-							crf_feature_indices_u[i][y_i] = new int[num_features];
-							for(int n = 0;n < num_features;n++){
-								crf_feature_indices_u[i][y_i][n] = indices_u[n];
-							}
-						}
+				FeatureIndices* features = new FeatureIndices(sentence->size() + 3);
+				_enumerate_function_ids(sentence, [&](int row, int feature_template, int64_t function_id){
+					features->begin_row(row);
+					int feature_id = function_id_to_feature_id(function_id, generate_feature_id_if_needed);
+					if(feature_id != -1){
+						features->push(feature_id);
+					}
+				});
+				features->finalize();
+				return features;
+			}
+			// 素性の刈り込み用に文中の素性関数の出現回数を数える
+			void FeatureExtractor::count_function_ids(Sentence* sentence, hashmap<int64_t, int> &counts){
+				_enumerate_function_ids(sentence, [&](int row, int feature_template, int64_t function_id){
+					counts[function_id] += 1;
+				});
+			}
+			// 出現回数が素性テンプレートごとの閾値以上の素性関数にだけ素性IDを割り当てる
+			// 全ての文について呼んだ後はextract(sentence, false)で素性を展開する
+			// 素性IDは閾値が1の場合のextract(sentence, true)と同じ順に振られる
+			void FeatureExtractor::register_frequent_function_ids(Sentence* sentence, hashmap<int64_t, int> &counts, int* min_count){
+				assert(_hash_bits == 0);
+				_enumerate_function_ids(sentence, [&](int row, int feature_template, int64_t function_id){
+					auto itr = counts.find(function_id);
+					assert(itr != counts.end());
+					if(itr->second >= min_count[feature_template]){
+						function_id_to_feature_id(function_id, true);
 					}
+				});
+			}
+			// 素性テンプレートごとに素性関数の種類数と残った数を数える
+			void FeatureExtractor::count_features_per_template(hashmap<int64_t, int> &counts, int* num_seen, int* num_kept){
+				for(int feature_template = 0;feature_template < FEATURE_NUM_TEMPLATES;feature_template++){
+					num_seen[feature_template] = 0;
+					num_kept[feature_template] = 0;
 				}
-
-				// CRFのラベルbigram素性の数
-				mat::tri<int> num_crf_features_b(character_ids_length + 3, 2, 2);
-				int**** crf_feature_indices_b = new int***[character_ids_length + 3];
-
-				// ラベルbigram素性
-				for(int i = 1;i <= character_ids_length + 2;i++){	// 末尾に<eos>が2つ入る
-					crf_feature_indices_b[i] = new int**[2];
-					for(int y_i_1 = 0;y_i_1 <= 1;y_i_1++){
-						crf_feature_indices_b[i][y_i_1] = new int*[2];
-						for(int y_i = 0;y_i <= 1;y_i++){
-							std::vector<int> indices_b;
-							int r_start, r_end;
-							// ラベル素性
-							feature_id = function_id_to_feature_id(function_id_label_b(y_i_1, y_i), generate_feature_id_if_needed);
-							if(feature_id != -1){
-								indices_b.push_back(feature_id);
-							}
-							// 文字unigram素性
-							r_start = std::max(1, i + _x_unigram_start);
-							r_end = std::min(character_ids_length + 2, i + _x_unigram_end);	// <eos>2つを考慮
-							for(int r = r_start;r <= r_end;r++){
-								int pos = r - i - _x_unigram_start + 1;	// [1, _x_range_unigram]
-								int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
-								feature_id = function_id_to_feature_id(function_id_unigram_b(y_i_1, y_i, pos, x_i), generate_feature_id_if_needed);
-								if(feature_id != -1){
-									indices_b.push_back(feature_id);
-								}
-							}
-							// 文字bigram素性
-							r_start = std::max(2, i + _x_bigram_start);
-							r_end = std::min(character_ids_length + 2, i + _x_bigram_end);
-							for(int r = r_start;r <= r_end;r++){
-								int pos = r - i - _x_bigram_start + 1;	// [1, _x_range_bigram]
-								int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
-								int x_i_1 = (r - 1 <= character_ids_length) ? character_ids[r - 2] : SPECIAL_CHARACTER_END;
-								feature_id = function_id_to_feature_id(function_id_bigram_b(y_i_1, y_i, pos, x_i_1, x_i), generate_feature_id_if_needed);
-								if(feature_id != -1){
-									indices_b.push_back(feature_id);
-								}
-							}
-							// identical_1素性
-							r_start = std::max(2, i + _x_identical_1_start);
-							r_end = std::min(character_ids_length + 2, i + _x_identical_1_end);
-							for(int r = r_start;r <= r_end;r++){
-								int pos = r - i - _x_identical_1_start + 1;	// [1, _x_range_identical_1]
-								int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
-								int x_i_1 = (r - 1 <= character_ids_length) ? character_ids[r - 2] : SPECIAL_CHARACTER_END;
-								if(x_i == x_i_1){
-									feature_id = function_id_to_feature_id(function_id_identical_1_b(y_i_1, y_i, pos), generate_feature_id_if_needed);
-									if(feature_id != -1){
-										indices_b.push_back(feature_id);
-									}
-								}
-							}
-							// identical_2素性
-							r_start = std::max(3, i + _x_identical_2_start);
-							r_end = std::min(character_ids_length + 2, i + _x_identical_2_end);
-							for(int r = r_start;r <= r_end;r++){
-								int pos = r - i - _x_identical_2_start + 1;	// [1, _x_range_identical_2]
-								int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
-								int x_i_2 = (r - 2 <= character_ids_length) ? character_ids[r - 3] : SPECIAL_CHARACTER_END;
-								if(x_i == x_i_2){
-									feature_id = function_id_to_feature_id(function_id_identical_2_b(y_i_1, y_i, pos), generate_feature_id_if_needed);
-									if(feature_id != -1){
-										indices_b.push_back(feature_id);
-									}
-								}
-							}
-							// 文字種unigram・bigram素性
-							int type_i = (i <= character_ids_length) ? ctype::get_type(characters[i - 1]) : CTYPE_UNKNOWN;
-							int type_i_1 = (i - 1 <= character_ids_length) ? ctype::get_type(characters[i - 2]) : CTYPE_UNKNOWN;
-							feature_id = function_id_to_feature_id(function_id_unigram_type_b(y_i_1, y_i, type_i), generate_feature_id_if_needed);
-							if(feature_id != -1){
-								indices_b.push_back(feature_id);
-							}
-							feature_id = function_id_to_feature_id(function_id_bigram_type_b(y_i_1, y_i, type_i_1, type_i), generate_feature_id_if_needed);
-							if(feature_id != -1){
-								indices_b.push_back(feature_id);
-							}
-
-							// 更新
-							int num_features = indices_b.size();
-							num_crf_features_b(i, y_i_1, y_i) = num_features;
-							if(num_features > 0){
-								crf_feature_indices_b[i][y_i_1][y_i] = new int[num_features];
-								for(int n = 0;n < num_features;n++){
-									crf_feature_indices_b[i][y_i_1][y_i][n] = indices_b[n];
-								}
-							}
-						}
+				for(auto &elem: counts){
+					int feature_template = get_feature_template(elem.first);
+					num_seen[feature_template] += 1;
+					if(_function_id_to_feature_id.find(elem.first) != _function_id_to_feature_id.end()){
+						num_kept[feature_template] += 1;
 					}
 				}
-				FeatureIndices* features = new FeatureIndices();
-				features->_num_features_u = num_crf_features_u;
-				features->_num_features_b = num_crf_features_b;
-				features->_feature_indices_u = crf_feature_indices_u;
-				features->_feature_indices_b = crf_feature_indices_b;
-				features->_seq_length = character_ids_length + 3;
-				return features;
+			}
+			int FeatureExtractor::get_feature_template(int64_t function_id){
+				assert(0 <= function_id && function_id < _weight_size);
+				if(function_id < _offset_w_unigram_u){
+					return FEATURE_TEMPLATE_LABEL;
+				}
+				if(function_id < _offset_w_bigram_u){
+					return FEATURE_TEMPLATE_UNIGRAM;
+				}
+				if(function_id < _offset_w_identical_1_u){
+					return FEATURE_TEMPLATE_BIGRAM;
+				}
+				if(function_id < _offset_w_unigram_type_u){
+					return FEATURE_TEMPLATE_IDENTICAL;
+				}
+				return FEATURE_TEMPLATE_TYPE;
 			}
 			template <class Archive>
-			void FeatureExtractor::serialize(Archive &ar, unsigned int version)
+			void FeatureExtractor::serialize(Archive &archive, unsigned int version)
 			{
-				ar & _num_character_ids;
-				ar & _num_character_types;
-				ar & _x_unigram_start;
-				ar & _x_unigram_end;
-				ar & _x_bigram_start;
-				ar & _x_bigram_end;
-				ar & _x_identical_1_start;
-				ar & _x_identical_1_end;
-				ar & _x_identical_2_start;
-				ar & _x_identical_2_end;
-				ar & _x_range_unigram;
-				ar & _x_range_bigram;
-				ar & _x_range_identical_1;
-				ar & _x_range_identical_2;
-				ar & _w_size_label_u;
-				ar & _w_size_label_b;
-				ar & _w_size_unigram_u;
-				ar & _w_size_unigram_b;
-				ar & _w_size_bigram_u;
-				ar & _w_size_bigram_b;
-				ar & _w_size_identical_1_u;
-				ar & _w_size_identical_1_b;
-				ar & _w_size_identical_2_u;
-				ar & _w_size_identical_2_b;
-				ar & _w_size_unigram_type_u;
-				ar & _w_size_unigram_type_b;
-				ar & _w_size_bigram_type_u;
-				ar & _w_size_bigram_type_b;
-				ar & _offset_w_label_u;
-				ar & _offset_w_label_b;
-				ar & _offset_w_unigram_u;
-				ar & _offset_w_unigram_b;
-				ar & _offset_w_bigram_u;
-				ar & _offset_w_bigram_b;
-				ar & _offset_w_identical_1_u;
-				ar & _offset_w_identical_1_b;
-				ar & _offset_w_identical_2_u;
-				ar & _offset_w_identical_2_b;
-				ar & _offset_w_unigram_type_u;
-				ar & _offset_w_unigram_type_b;
-				ar & _offset_w_bigram_type_u;
-				ar & _offset_w_bigram_type_b;
+				boost::serialization::split_member(archive, *this, version);
 			}
 			template void FeatureExtractor::serialize(boost::archive::binary_iarchive &ar, unsigned int version);
 			template void FeatureExtractor::serialize(boost::archive::binary_oarchive &ar, unsigned int version);
+			// 素性の大きさと位置は範囲から決まるので保存しない
+			void FeatureExtractor::save(boost::archive::binary_oarchive &archive, unsigned int version) const {
+				archive & _num_character_ids;
+				archive & _num_character_types;
+				archive & _x_unigram_start;
+				archive & _x_unigram_end;
+				archive & _x_bigram_start;
+				archive & _x_bigram_end;
+				archive & _x_identical_1_start;
+				archive & _x_identical_1_end;
+				archive & _x_identical_2_start;
+				archive & _x_identical_2_end;
+				archive & _hash_bits;
+				archive & _function_id_to_feature_id;
+			}
+			void FeatureExtractor::load(boost::archive::binary_iarchive &archive, unsigned int version) {
+				archive & _num_character_ids;
+				archive & _num_character_types;
+				archive & _x_unigram_start;
+				archive & _x_unigram_end;
+				archive & _x_bigram_start;
+				archive & _x_bigram_end;
+				archive & _x_identical_1_start;
+				archive & _x_identical_1_end;
+				archive & _x_identical_2_start;
+				archive & _x_identical_2_end;
+				_hash_bits = 0;
+				_function_id_to_feature_id.clear();
+				if(version >= 1){
+					archive & _hash_bits;
+					archive & _function_id_to_feature_id;
+				}else{
+					// 古い形式は範囲と素性の大きさ・位置をintで持っている
+					int unused;
+					for(int n = 0;n < 4 + 14 + 14;n++){
+						archive & unused;
+					}
+				}
+				_hash_mask = (_hash_bits == 0) ? 0 : ((int64_t)1 << _hash_bits) - 1;
+				_init_function_id_space();
+			}
 		}
 	}
 }
\ No newline at end of file
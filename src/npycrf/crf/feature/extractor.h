@@ -1,9 +1,19 @@
 #pragma once
+#include <cstdint>
 #include <boost/serialization/serialization.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 #include "../../array.h"
 #include "../../sentence.h"
+#include "../../ctype.h"
+
+// 素性テンプレートの種類. 刈り込みの閾値はこの単位で決める
+#define FEATURE_TEMPLATE_LABEL 0
+#define FEATURE_TEMPLATE_UNIGRAM 1
+#define FEATURE_TEMPLATE_BIGRAM 2
+#define FEATURE_TEMPLATE_IDENTICAL 3	// identical_1とidentical_2
+#define FEATURE_TEMPLATE_TYPE 4			// 文字種unigramとbigram
+#define FEATURE_NUM_TEMPLATES 5
 
 namespace npycrf {
 	namespace crf {
@@ -13,8 +23,13 @@ namespace npycrf {
 				friend class boost::serialization::access;
 				template <class Archive>
 				void serialize(Archive &archive, unsigned int version);
+				void save(boost::archive::binary_oarchive &archive, unsigned int version) const;
+				void load(boost::archive::binary_iarchive &archive, unsigned int version);
+				void _init_function_id_space();
 			public:
-				hashmap<int, int> _function_id_to_feature_id;	// 素性関数の番号から素性IDへの変換
+				hashmap<int64_t, int> _function_id_to_feature_id;	// 素性関数の番号から素性IDへの変換
+				int _hash_bits;				// 0でなければ素性関数の番号をハッシュして2^_hash_bits個の重みに直接割り当てる
+				int64_t _hash_mask;
 				int _num_character_ids;
 				int _num_character_types;
 				// y ∈ {0,1}
@@ -33,35 +48,35 @@ namespace npycrf {
 				int _x_identical_1_end;
 				int _x_identical_2_start;
 				int _x_identical_2_end;
-				int _w_size_label_u;		// (y_i)
-				int _w_size_label_b;		// (y_{i-1}, y_i)
-				int _w_size_unigram_u;		// (y_i, i, x_i)
-				int _w_size_unigram_b;		// (y_{i-1}, y_i, i, x_i)
-				int _w_size_bigram_u;		// (y_i, i, x_{i-1}, x_i)
-				int _w_size_bigram_b;		// (y_{i-1}, y_i, i, x_{i-1}, x_i)
-				int _w_size_identical_1_u;	// (y_i, i)
-				int _w_size_identical_1_b;	// (y_{i-1}, y_i, i)
-				int _w_size_identical_2_u;	// (y_i, i)
-				int _w_size_identical_2_b;	// (y_{i-1}, y_i, i)
-				int _w_size_unigram_type_u;	// (y_i, type)
-				int _w_size_unigram_type_b;	// (y_{i-1}, y_i, type)
-				int _w_size_bigram_type_u;	// (y_i, type, type)
-				int _w_size_bigram_type_b;	// (y_{i-1}, y_i, type, type)
-				int _weight_size;
-				int _offset_w_label_u;
-				int _offset_w_label_b;
-				int _offset_w_unigram_u;
-				int _offset_w_unigram_b;
-				int _offset_w_bigram_u;
-				int _offset_w_bigram_b;
-				int _offset_w_identical_1_u;
-				int _offset_w_identical_1_b;
-				int _offset_w_identical_2_u;
-				int _offset_w_identical_2_b;
-				int _offset_w_unigram_type_u;
-				int _offset_w_unigram_type_b;
-				int _offset_w_bigram_type_u;
-				int _offset_w_bigram_type_b;
+				int64_t _w_size_label_u;		// (y_i)
+				int64_t _w_size_label_b;		// (y_{i-1}, y_i)
+				int64_t _w_size_unigram_u;		// (y_i, i, x_i)
+				int64_t _w_size_unigram_b;		// (y_{i-1}, y_i, i, x_i)
+				int64_t _w_size_bigram_u;		// (y_i, i, x_{i-1}, x_i)
+				int64_t _w_size_bigram_b;		// (y_{i-1}, y_i, i, x_{i-1}, x_i)
+				int64_t _w_size_identical_1_u;	// (y_i, i)
+				int64_t _w_size_identical_1_b;	// (y_{i-1}, y_i, i)
+				int64_t _w_size_identical_2_u;	// (y_i, i)
+				int64_t _w_size_identical_2_b;	// (y_{i-1}, y_i, i)
+				int64_t _w_size_unigram_type_u;	// (y_i, type)
+				int64_t _w_size_unigram_type_b;	// (y_{i-1}, y_i, type)
+				int64_t _w_size_bigram_type_u;	// (y_i, type, type)
+				int64_t _w_size_bigram_type_b;	// (y_{i-1}, y_i, type, type)
+				int64_t _weight_size;
+				int64_t _offset_w_label_u;
+				int64_t _offset_w_label_b;
+				int64_t _offset_w_unigram_u;
+				int64_t _offset_w_unigram_b;
+				int64_t _offset_w_bigram_u;
+				int64_t _offset_w_bigram_b;
+				int64_t _offset_w_identical_1_u;
+				int64_t _offset_w_identical_1_b;
+				int64_t _offset_w_identical_2_u;
+				int64_t _offset_w_identical_2_b;
+				int64_t _offset_w_unigram_type_u;
+				int64_t _offset_w_unigram_type_b;
+				int64_t _offset_w_bigram_type_u;
+				int64_t _offset_w_bigram_type_b;
 				FeatureExtractor();
 				FeatureExtractor(int num_character_ids,		// 文字IDの総数
 								int num_character_types,	// 文字種の総数
@@ -72,28 +87,30 @@ namespace npycrf {
 								int feature_x_identical_1_start,
 								int feature_x_identical_1_end,
 								int feature_x_identical_2_start,
-								int feature_x_identical_2_end);
+								int feature_x_identical_2_end,
+								int hash_bits = 0);			// 0なら素性IDの表を使う
 				// 以下、iは左端を1とした番号
 				// 例）
 				// i=1,   2,   3, 4,   5
 				//   t-2, t-1, t, t+1, t+2
 				// ラベルyと入力xの組み合わせから一意な素性関数IDを生成
 				// 素性IDではない
-				int function_id_label_u(int y_i);
-				int function_id_label_b(int y_i_1, int y_i);
-				int function_id_unigram_u(int y_i, int i, int x_i);
-				int function_id_unigram_b(int y_i_1, int y_i, int i, int x_i);
-				int function_id_bigram_u(int y_i, int i, int x_i_1, int x_i);
-				int function_id_bigram_b(int y_i_1, int y_i, int i, int x_i_1, int x_i);
-				int function_id_identical_1_u(int y_i, int i);
-				int function_id_identical_1_b(int y_i_1, int y_i, int i);
-				int function_id_identical_2_u(int y_i, int i);
-				int function_id_identical_2_b(int y_i_1, int y_i, int i);
-				int function_id_unigram_type_u(int y_i, int type_i);
-				int function_id_unigram_type_b(int y_i_1, int y_i, int type_i);
-				int function_id_bigram_type_u(int y_i, int type_i_1, int type_i);
-				int function_id_bigram_type_b(int y_i_1, int y_i, int type_i_1, int type_i);
-				int function_id_to_feature_id(int function_id, bool generate_feature_id_if_needed);
+				int64_t function_id_label_u(int y_i);
+				int64_t function_id_label_b(int y_i_1, int y_i);
+				int64_t function_id_unigram_u(int y_i, int i, int x_i);
+				int64_t function_id_unigram_b(int y_i_1, int y_i, int i, int x_i);
+				int64_t function_id_bigram_u(int y_i, int i, int x_i_1, int x_i);
+				int64_t function_id_bigram_b(int y_i_1, int y_i, int i, int x_i_1, int x_i);
+				int64_t function_id_identical_1_u(int y_i, int i);
+				int64_t function_id_identical_1_b(int y_i_1, int y_i, int i);
+				int64_t function_id_identical_2_u(int y_i, int i);
+				int64_t function_id_identical_2_b(int y_i_1, int y_i, int i);
+				int64_t function_id_unigram_type_u(int y_i, int type_i);
+				int64_t function_id_unigram_type_b(int y_i_1, int y_i, int type_i);
+				int64_t function_id_bigram_type_u(int y_i, int type_i_1, int type_i);
+				int64_t function_id_bigram_type_b(int y_i_1, int y_i, int type_i_1, int type_i);
+				int function_id_to_feature_id(int64_t function_id, bool generate_feature_id_if_needed);
+				int get_num_features();
 				// 素性関数IDから素性IDを返す
 				// 存在しない場合は-1を返す
 				int feature_id_label_u(int y_i);
@@ -111,7 +128,135 @@ namespace npycrf {
 				int feature_id_bigram_type_u(int y_i, int type_i_1, int type_i);
 				int feature_id_bigram_type_b(int y_i_1, int y_i, int type_i_1, int type_i);
 				FeatureIndices* extract(Sentence* sentence, bool generate_feature_id_if_needed);
+				void count_function_ids(Sentence* sentence, hashmap<int64_t, int> &counts);
+				void register_frequent_function_ids(Sentence* sentence, hashmap<int64_t, int> &counts, int* min_count);
+				void count_features_per_template(hashmap<int64_t, int> &counts, int* num_seen, int* num_kept);
+				int get_feature_template(int64_t function_id);
+				template <class Callback>
+				void _enumerate_function_ids(Sentence* sentence, Callback callback);
 			};
+			// 文の各列で発火する素性関数の番号を列の順に列挙し、callback(row, feature_template, function_id)を呼ぶ
+			// 列の番号はFeatureIndicesと同じ
+			template <class Callback>
+			void FeatureExtractor::_enumerate_function_ids(Sentence* sentence, Callback callback){
+				array<int> &character_ids = sentence->_character_ids;
+				wchar_t const* characters = sentence->_characters;
+				int character_ids_length = sentence->size();
+				int seq_length = character_ids_length + 3;
+
+				// ラベルunigram素性
+				for(int i = 1;i <= character_ids_length + 2;i++){	// 末尾に<eos>が2つ入る
+					for(int y_i = 0;y_i <= 1;y_i++){
+						int row = i * 2 + y_i;
+						int r_start, r_end;
+						// ラベル素性
+						callback(row, FEATURE_TEMPLATE_LABEL, function_id_label_u(y_i));
+						// 文字unigram素性
+						r_start = std::max(1, i + _x_unigram_start);
+						r_end = std::min(character_ids_length + 2, i + _x_unigram_end);	// <eos>2つを考慮
+						for(int r = r_start;r <= r_end;r++){
+							int pos = r - i - _x_unigram_start + 1;	// [1, _x_range_unigram]
+							int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
+							callback(row, FEATURE_TEMPLATE_UNIGRAM, function_id_unigram_u(y_i, pos, x_i));
+						}
+						// 文字bigram素性
+						r_start = std::max(2, i + _x_bigram_start);
+						r_end = std::min(character_ids_length + 2, i + _x_bigram_end);
+						for(int r = r_start;r <= r_end;r++){
+							int pos = r - i - _x_bigram_start + 1;	// [1, _x_range_bigram]
+							int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
+							int x_i_1 = (r - 1 <= character_ids_length) ? character_ids[r - 2] : SPECIAL_CHARACTER_END;
+							callback(row, FEATURE_TEMPLATE_BIGRAM, function_id_bigram_u(y_i, pos, x_i_1, x_i));
+						}
+						// identical_1素性
+						r_start = std::max(2, i + _x_identical_1_start);
+						r_end = std::min(character_ids_length + 2, i + _x_identical_1_end);
+						for(int r = r_start;r <= r_end;r++){
+							int pos = r - i - _x_identical_1_start + 1;	// [1, _x_range_identical_1]
+							int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
+							int x_i_1 = (r - 1 <= character_ids_length) ? character_ids[r - 2] : SPECIAL_CHARACTER_END;
+							if(x_i == x_i_1){
+								callback(row, FEATURE_TEMPLATE_IDENTICAL, function_id_identical_1_u(y_i, pos));
+							}
+						}
+						// identical_2素性
+						r_start = std::max(3, i + _x_identical_2_start);
+						r_end = std::min(character_ids_length + 2, i + _x_identical_2_end);
+						for(int r = r_start;r <= r_end;r++){
+							int pos = r - i - _x_identical_2_start + 1;	// [1, _x_range_identical_2]
+							int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
+							int x_i_2 = (r - 2 <= character_ids_length) ? character_ids[r - 3] : SPECIAL_CHARACTER_END;
+							if(x_i == x_i_2){
+								callback(row, FEATURE_TEMPLATE_IDENTICAL, function_id_identical_2_u(y_i, pos));
+							}
+						}
+						// 文字種unigram・bigram素性
+						int type_i = (i <= character_ids_length) ? ctype::get_type(characters[i - 1]) : CTYPE_UNKNOWN;
+						int type_i_1 = (i - 1 <= character_ids_length) ? ctype::get_type(characters[i - 2]) : CTYPE_UNKNOWN;
+						callback(row, FEATURE_TEMPLATE_TYPE, function_id_unigram_type_u(y_i, type_i));
+						callback(row, FEATURE_TEMPLATE_TYPE, function_id_bigram_type_u(y_i, type_i_1, type_i));
+					}
+				}
+
+				// ラベルbigram素性
+				for(int i = 1;i <= character_ids_length + 2;i++){	// 末尾に<eos>が2つ入る
+					for(int y_i_1 = 0;y_i_1 <= 1;y_i_1++){
+						for(int y_i = 0;y_i <= 1;y_i++){
+							int row = seq_length * 2 + i * 2 * 2 + y_i_1 * 2 + y_i;
+							int r_start, r_end;
+							// ラベル素性
+							callback(row, FEATURE_TEMPLATE_LABEL, function_id_label_b(y_i_1, y_i));
+							// 文字unigram素性
+							r_start = std::max(1, i + _x_unigram_start);
+							r_end = std::min(character_ids_length + 2, i + _x_unigram_end);	// <eos>2つを考慮
+							for(int r = r_start;r <= r_end;r++){
+								int pos = r - i - _x_unigram_start + 1;	// [1, _x_range_unigram]
+								int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
+								callback(row, FEATURE_TEMPLATE_UNIGRAM, function_id_unigram_b(y_i_1, y_i, pos, x_i));
+							}
+							// 文字bigram素性
+							r_start = std::max(2, i + _x_bigram_start);
+							r_end = std::min(character_ids_length + 2, i + _x_bigram_end);
+							for(int r = r_start;r <= r_end;r++){
+								int pos = r - i - _x_bigram_start + 1;	// [1, _x_range_bigram]
+								int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
+								int x_i_1 = (r - 1 <= character_ids_length) ? character_ids[r - 2] : SPECIAL_CHARACTER_END;
+								callback(row, FEATURE_TEMPLATE_BIGRAM, function_id_bigram_b(y_i_1, y_i, pos, x_i_1, x_i));
+							}
+							// identical_1素性
+							r_start = std::max(2, i + _x_identical_1_start);
+							r_end = std::min(character_ids_length + 2, i + _x_identical_1_end);
+							for(int r = r_start;r <= r_end;r++){
+								int pos = r - i - _x_identical_1_start + 1;	// [1, _x_range_identical_1]
+								int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
+								int x_i_1 = (r - 1 <= character_ids_length) ? character_ids[r - 2] : SPECIAL_CHARACTER_END;
+								if(x_i == x_i_1){
+									callback(row, FEATURE_TEMPLATE_IDENTICAL, function_id_identical_1_b(y_i_1, y_i, pos));
+								}
+							}
+							// identical_2素性
+							r_start = std::max(3, i + _x_identical_2_start);
+							r_end = std::min(character_ids_length + 2, i + _x_identical_2_end);
+							for(int r = r_start;r <= r_end;r++){
+								int pos = r - i - _x_identical_2_start + 1;	// [1, _x_range_identical_2]
+								int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
+								int x_i_2 = (r - 2 <= character_ids_length) ? character_ids[r - 3] : SPECIAL_CHARACTER_END;
+								if(x_i == x_i_2){
+									callback(row, FEATURE_TEMPLATE_IDENTICAL, function_id_identical_2_b(y_i_1, y_i, pos));
+								}
+							}
+							// 文字種unigram・bigram素性
+							int type_i = (i <= character_ids_length) ? ctype::get_type(characters[i - 1]) : CTYPE_UNKNOWN;
+							int type_i_1 = (i - 1 <= character_ids_length) ? ctype::get_type(characters[i - 2]) : CTYPE_UNKNOWN;
+							callback(row, FEATURE_TEMPLATE_TYPE, function_id_unigram_type_b(y_i_1, y_i, type_i));
+							callback(row, FEATURE_TEMPLATE_TYPE, function_id_bigram_type_b(y_i_1, y_i, type_i_1, type_i));
+						}
+					}
+				}
+			}
 		}
 	}
-}
\ No newline at end of file
+}
+
+// 素性関数の番号を64bitにする前に保存したモデルはversion 0
+BOOST_CLASS_VERSION(npycrf::crf::feature::FeatureExtractor, 1)
\ No newline at end of file
@@ -3,39 +3,25 @@
 namespace npycrf {
 	namespace crf {
 		namespace feature {
+			FeatureIndices::FeatureIndices(int seq_length){
+				_seq_length = seq_length;
+				_offsets.reserve(get_num_rows() + 1);
+				_offsets.push_back(0);
+			}
 			FeatureIndices* FeatureIndices::copy(){
-				FeatureIndices* copy = new FeatureIndices();
-				copy->_seq_length = _seq_length;
-				copy->_num_features_u = _num_features_u;
-				copy->_num_features_b = _num_features_b;
-				copy->_feature_indices_u = new int**[_seq_length];
-				copy->_feature_indices_b = new int***[_seq_length];
-
-				for(int i = 0;i < _seq_length;i++){
-					copy->_feature_indices_u[i] = new int*[2];
-					for(int y_i = 0;y_i <= 1;y_i++){
-						copy->_feature_indices_u[i][y_i] = new int[_num_features_u(i, y_i)];
-						for(int n = 0;n < _num_features_u(i, y_i);n++){
-							copy->_feature_indices_u[i][y_i][n] = _feature_indices_u[i][y_i][n];
-						}
-					}
-				}
-
-				for(int i = 0;i < _seq_length;i++){
-					copy->_feature_indices_b[i] = new int**[2];
-					for(int y_i_1 = 0;y_i_1 <= 1;y_i_1++){
-						copy->_feature_indices_b[i][y_i_1] = new int*[2];
-						for(int y_i = 0;y_i <= 1;y_i++){
-							copy->_feature_indices_b[i][y_i_1][y_i] = new int[_num_features_b(i, y_i_1, y_i)];
-							for(int n = 0;n < _num_features_b(i, y_i_1, y_i);n++){
-								copy->_feature_indices_b[i][y_i_1][y_i][n] = _feature_indices_b[i][y_i_1][y_i][n];
-							}
-						}
-					}
-				}
-
+				FeatureIndices* copy = new FeatureIndices(_seq_length);
+				copy->_offsets = _offsets;
+				copy->_ids = _ids;
 				return copy;
 			}
+			// 残りの列を空で埋める
+			// 文ごとに持ち続けるので余分な領域を解放しておく
+			void FeatureIndices::finalize(){
+				begin_row(get_num_rows() - 1);
+				assert((int)_offsets.size() == get_num_rows() + 1);
+				_offsets.shrink_to_fit();
+				_ids.shrink_to_fit();
+			}
 		}
 	}
-}
\ No newline at end of file
+}
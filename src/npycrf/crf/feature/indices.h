@@ -1,18 +1,64 @@
 #pragma once
+#include <vector>
 #include "../../array.h"
 
 namespace npycrf {
 	namespace crf {
 		namespace feature {
+			// 文の各位置で発火する素性ID
+			// 位置とラベルの組ごとの素性IDの列を1つの配列に詰めて持つ
+			// 前半にy_tに関する列を(t, y_t)の順に、後半にy_{t-1}, y_tに関する列を(t, y_{t-1}, y_t)の順に並べる
+			// CRFに合わせてtは1スタート.
 			class FeatureIndices {
 			public:
 				int _seq_length;
-				mat::bi<int> _num_features_u;	// 位置tにおけるy_tに関する全ての素性IDの数. CRFに合わせてtは1スタート.
-				mat::tri<int> _num_features_b;	// 位置tにおけるy_{t-1}, y_tに関する全ての素性IDの数. CRFに合わせてtは1スタート.
-				int*** _feature_indices_u;		// 位置tにおけるy_tに関する全ての素性ID. CRFに合わせてtは1スタート.
-				int**** _feature_indices_b;		// 位置tにおけるy_{t-1}, y_tに関する全ての素性ID. CRFに合わせてtは1スタート.
+				std::vector<int> _offsets;	// 各列の開始位置. 最後に全体の素性数が入る
+				std::vector<int> _ids;		// 素性ID
+				FeatureIndices(int seq_length);
 				FeatureIndices* copy();
+				void finalize();
+				int get_num_rows(){
+					return _seq_length * 2 + _seq_length * 2 * 2;
+				}
+				int row_u(int t, int y_t){
+					return t * 2 + y_t;
+				}
+				int row_b(int t, int y_t_1, int y_t){
+					return _seq_length * 2 + t * 2 * 2 + y_t_1 * 2 + y_t;
+				}
+				// 列は番号の順に追加する. 飛ばした列は空になる
+				// 全て追加したらfinalizeを呼ぶ
+				void begin_row(int row){
+					assert(row >= (int)_offsets.size() - 2);
+					while((int)_offsets.size() - 1 <= row){
+						_offsets.push_back(_offsets.back());
+					}
+				}
+				void push(int feature_id){
+					_ids.push_back(feature_id);
+					_offsets.back() += 1;
+				}
+				int num_features_u(int t, int y_t){
+					int row = row_u(t, y_t);
+					return _offsets[row + 1] - _offsets[row];
+				}
+				int num_features_b(int t, int y_t_1, int y_t){
+					int row = row_b(t, y_t_1, y_t);
+					return _offsets[row + 1] - _offsets[row];
+				}
+				int const* begin_u(int t, int y_t){
+					return _ids.data() + _offsets[row_u(t, y_t)];
+				}
+				int const* end_u(int t, int y_t){
+					return _ids.data() + _offsets[row_u(t, y_t) + 1];
+				}
+				int const* begin_b(int t, int y_t_1, int y_t){
+					return _ids.data() + _offsets[row_b(t, y_t_1, y_t)];
+				}
+				int const* end_b(int t, int y_t_1, int y_t){
+					return _ids.data() + _offsets[row_b(t, y_t_1, y_t) + 1];
+				}
 			};
 		}
 	}
-}
\ No newline at end of file
+}
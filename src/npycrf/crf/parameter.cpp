@@ -4,11 +4,15 @@
 
 namespace npycrf {
 	namespace crf {
-		Parameter::Parameter(){
+		// 別のParameterと版が重ならないように全体で数える
+		static int next_version = 1;
 
+		Parameter::Parameter(){
+			_quantized = NULL;
+			update_version();
 		}
 		Parameter::~Parameter(){
-
+			delete _quantized;
 		}
 		Parameter::Parameter(double weight_size, double lambda_0, double sigma){
 			_bias = 0;
@@ -18,10 +22,28 @@ namespace npycrf {
 			}
 			_lambda_0 = lambda_0;
 			_sigma = sigma;
+			_quantized = NULL;
+			update_version();
 		}
 		int Parameter::get_num_features(){
+			if(_quantized != NULL){
+				return _quantized->_size;
+			}
 			return _weights.size();
 		}
+		int Parameter::get_num_zero_weights(){
+			int num_zeros = 0;
+			for(int k = 0;k < get_num_features();k++){
+				if(get_weight(k) == 0){
+					num_zeros += 1;
+				}
+			}
+			return num_zeros;
+		}
+		void Parameter::update_version(){
+			_version = next_version;
+			next_version += 1;
+		}
 		template <class Archive>
 		void Parameter::serialize(Archive &ar, unsigned int version)
 		{
@@ -38,6 +60,11 @@ namespace npycrf {
 			}
 			ar & _bias;
 			ar & _lambda_0;
+			bool quantized = (_quantized != NULL);
+			ar & quantized;
+			if(quantized){
+				ar & *_quantized;
+			}
 		}
 		void Parameter::load(boost::archive::binary_iarchive &ar, unsigned int version) {
 			int size = 0;
@@ -52,6 +79,17 @@ namespace npycrf {
 			}
 			ar & _bias;
 			ar & _lambda_0;
+			delete _quantized;
+			_quantized = NULL;
+			if(version >= 1){
+				bool quantized = false;
+				ar & quantized;
+				if(quantized){
+					_quantized = new QuantizedWeights();
+					ar & *_quantized;
+				}
+			}
+			update_version();
 		}
 	}
 }
\ No newline at end of file
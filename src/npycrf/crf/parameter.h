@@ -3,6 +3,7 @@
 #include <boost/archive/binary_oarchive.hpp>
 #include "../common.h"
 #include "../array.h"
+#include "quantized.h"
 
 namespace npycrf {
 	namespace crf {
@@ -18,10 +19,29 @@ namespace npycrf {
 			array<double> _weights;		// 重み
 			double _lambda_0;	// モデル補完重み
 			double _sigma;		// パラメータの事前分布の標準偏差
+			int _version;		// 重みを変更するたびに更新する. 文ごとのパスのコストの表の更新に使う
+			QuantizedWeights* _quantized;	// NULLでなければ量子化したモデル. _weightsは空で、分割にのみ使える
 			Parameter();
 			Parameter(double weight_size, double lambda_0, double sigma);
 			~Parameter();
 			int get_num_features();
+			int get_num_zero_weights();
+			void update_version();
+			double get_weight(int k) const {
+				if(_quantized != NULL){
+					return _quantized->get(k);
+				}
+				return _weights[k];
+			}
+			double get_weight(int k, int feature_template) const {
+				if(_quantized != NULL){
+					return _quantized->get(k, feature_template);
+				}
+				return _weights[k];
+			}
 		};
 	}
-}
\ No newline at end of file
+}
+
+// 量子化した重みを追加する前に保存したモデルはversion 0
+BOOST_CLASS_VERSION(npycrf::crf::Parameter, 1)
\ No newline at end of file
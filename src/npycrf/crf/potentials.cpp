@@ -0,0 +1,33 @@
+#include <cassert>
+#include "potentials.h"
+
+namespace npycrf {
+	namespace crf {
+		Potentials::Potentials(int character_ids_length){
+			_version = 0;
+			_path_cost = mat::tri<double>(character_ids_length + 3, 2, 2);	// 末尾に<eos>が2つ入る
+			_cumulative_path_cost_0_0 = array<double>(character_ids_length + 3);
+		}
+		// 使い回す場合に呼ぶ. 確保済みの領域で足りれば再確保しない
+		// 全てのコストは0になる
+		void Potentials::resize(int character_ids_length){
+			_version = 0;
+			_path_cost.resize(character_ids_length + 3, 2, 2);
+			if(_cumulative_path_cost_0_0.size() < character_ids_length + 3){
+				_cumulative_path_cost_0_0 = array<double>(character_ids_length + 3);
+			}
+		}
+		// 表を使って定数時間で計算する
+		double Potentials::compute_gamma(int s, int t){
+			if(t <= 1){
+				return 0;
+			}
+			assert(s < t);
+			if(t - s == 1){
+				return _path_cost(t, 1, 1);
+			}
+			// 間の(0, 0)のパスは累積和の差で求まる
+			return _path_cost(s + 1, 1, 0) + _path_cost(t, 0, 1) + (_cumulative_path_cost_0_0[t - 1] - _cumulative_path_cost_0_0[s + 1]);
+		}
+	}
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "../array.h"
+
+namespace npycrf {
+	namespace crf {
+		// 文の各位置のCRFのパスのコスト
+		// 重みが変わるまで同じ文のラティスの計算全てで使い回す
+		class Potentials {
+		public:
+			int _version;	// 計算したときのParameter::_version
+			mat::tri<double> _path_cost;				// path_cost(i, y_{i-1}, y_i)
+			array<double> _cumulative_path_cost_0_0;	// 位置2からiまでの(0, 0)のパスのコストの和
+			Potentials(int character_ids_length);
+			void resize(int character_ids_length);
+			double compute_gamma(int s, int t);
+		};
+	}
+}
@@ -0,0 +1,77 @@
+#include <boost/serialization/split_member.hpp>
+#include <cassert>
+#include "quantized.h"
+
+namespace npycrf {
+	namespace crf {
+		QuantizedWeights::QuantizedWeights(){
+			_bits = 0;
+			_size = 0;
+		}
+		QuantizedWeights::QuantizedWeights(int bits, int size){
+			assert(bits == 8 || bits == 16);
+			_bits = bits;
+			_size = size;
+			if(bits == 8){
+				_codes_8 = array<int8_t>(size);
+			}else{
+				_codes_16 = array<int16_t>(size);
+			}
+			for(int t = 0;t < FEATURE_NUM_TEMPLATES;t++){
+				_scale[t] = 0;
+				_template_end[t] = size;
+			}
+		}
+		int QuantizedWeights::get_max_code(){
+			return (_bits == 8) ? INT8_MAX : INT16_MAX;
+		}
+		void QuantizedWeights::set_code(int k, int code){
+			assert(-get_max_code() <= code && code <= get_max_code());
+			if(_bits == 8){
+				_codes_8[k] = code;
+			}else{
+				_codes_16[k] = code;
+			}
+		}
+		template <class Archive>
+		void QuantizedWeights::serialize(Archive &archive, unsigned int version)
+		{
+			boost::serialization::split_member(archive, *this, version);
+		}
+		template void QuantizedWeights::serialize(boost::archive::binary_iarchive &ar, unsigned int version);
+		template void QuantizedWeights::serialize(boost::archive::binary_oarchive &ar, unsigned int version);
+		void QuantizedWeights::save(boost::archive::binary_oarchive &archive, unsigned int version) const {
+			archive & _bits;
+			archive & _size;
+			for(int t = 0;t < FEATURE_NUM_TEMPLATES;t++){
+				archive & _scale[t];
+				archive & _template_end[t];
+			}
+			for(int k = 0;k < _size;k++){
+				if(_bits == 8){
+					archive & _codes_8[k];
+				}else{
+					archive & _codes_16[k];
+				}
+			}
+		}
+		void QuantizedWeights::load(boost::archive::binary_iarchive &archive, unsigned int version) {
+			int bits = 0;
+			int size = 0;
+			archive & bits;
+			archive & size;
+			*this = QuantizedWeights(bits, size);
+			for(int t = 0;t < FEATURE_NUM_TEMPLATES;t++){
+				archive & _scale[t];
+				archive & _template_end[t];
+			}
+			for(int k = 0;k < _size;k++){
+				if(_bits == 8){
+					archive & _codes_8[k];
+				}else{
+					archive & _codes_16[k];
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <cassert>
+#include <boost/serialization/serialization.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include "../array.h"
+#include "feature/extractor.h"
+
+namespace npycrf {
+	namespace crf {
+		// 配布用に量子化した重み
+		// 素性IDは素性テンプレートの順に並べ直してあり、テンプレートごとに1つのスケールを持つ
+		// 重みはcode * scaleで復元する
+		class QuantizedWeights {
+		private:
+			friend class boost::serialization::access;
+			template <class Archive>
+			void serialize(Archive &archive, unsigned int version);
+			void save(boost::archive::binary_oarchive &archive, unsigned int version) const;
+			void load(boost::archive::binary_iarchive &archive, unsigned int version);
+		public:
+			int _bits;		// 8または16
+			int _size;
+			array<int8_t> _codes_8;
+			array<int16_t> _codes_16;
+			double _scale[FEATURE_NUM_TEMPLATES];
+			int _template_end[FEATURE_NUM_TEMPLATES];	// テンプレートtの素性IDは[_template_end[t - 1], _template_end[t])
+			QuantizedWeights();
+			QuantizedWeights(int bits, int size);
+			int get_max_code();
+			void set_code(int k, int code);
+			// 素性IDの属するテンプレート
+			// 行の中の素性IDはテンプレートの順に並ぶので、直前のテンプレートtから探せば1行あたり高々FEATURE_NUM_TEMPLATES回で済む
+			int get_template(int k, int t = 0) const {
+				if(t > 0 && k < _template_end[t - 1]){
+					t = 0;
+				}
+				while(k >= _template_end[t]){
+					t++;
+				}
+				return t;
+			}
+			// テンプレートが分かっている場合はスケールを直接引く
+			// ハッシュモードでは全てのテンプレートが同じスケールを持つ
+			double get(int k, int feature_template) const {
+				assert(k < _size);
+				assert(_scale[feature_template] == _scale[get_template(k)]);
+				if(_bits == 8){
+					return _codes_8[k] * _scale[feature_template];
+				}
+				return _codes_16[k] * _scale[feature_template];
+			}
+			double get(int k) const {
+				return get(k, get_template(k));
+			}
+		};
+	}
+}
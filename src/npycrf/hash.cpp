@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <vector>
 #include "hash.h"
 
 namespace npycrf{
@@ -79,4 +81,52 @@ namespace npycrf{
 		wchar_t const* ptr = str.data();
 		return hash_substring_ptr(ptr, start, end);
 	}
+#if __SIZEOF_SIZE_T__ == 8 && __SIZEOF_WCHAR_T__ == 4
+	// hash_bytesは8バイト（2文字）ごとのブロックを混ぜてから連鎖させるので、
+	// ブロックを混ぜた値を文字位置ごとに1度だけ計算しておき、部分文字列ごとには連鎖の部分だけを行う
+	// 連鎖の初期値にバイト長が入るため短い部分文字列の値から伸ばすことはできず、ローリングハッシュにはならない
+	// 部分文字列ごとにlength/2回の連鎖が残るので全体でO(N・L^2)だが、ブロックの読み込みと混合はO(N)回で済む
+	// 単語IDを変えるとモデルの互換性がなくなるのでハッシュ関数自体は変えない
+	void hash_all_substrings(wchar_t const* ptr, int size, int max_length, size_t* hashes, int stride){
+		size_t seed = static_cast<size_t>(0xc70f6907UL);
+		static const size_t mul = (((size_t) 0xc6a4a793UL) << 32UL) + (size_t) 0x5bd1e995UL;
+		const char* const buf = reinterpret_cast<const char*>(ptr);
+		std::vector<size_t> mixed_block(size);	// 位置pから始まる2文字のブロック
+		std::vector<size_t> tail(size);			// 位置pの1文字が端数になる場合
+		for(int p = 0;p < size;p++){
+			if(p + 1 < size){
+				mixed_block[p] = shift_mix(unaligned_load(buf + p * sizeof(wchar_t)) * mul) * mul;
+			}
+			tail[p] = load_bytes(buf + p * sizeof(wchar_t), sizeof(wchar_t));
+		}
+		for(int start = 0;start < size;start++){
+			int limit_length = std::min(max_length, size - start);
+			for(int length = 1;length <= limit_length;length++){
+				size_t len = length * sizeof(wchar_t);
+				size_t hash = seed ^ (len * mul);
+				int num_blocks = length / 2;
+				for(int b = 0;b < num_blocks;b++){
+					hash ^= mixed_block[start + b * 2];
+					hash *= mul;
+				}
+				if(length % 2 == 1){
+					hash ^= tail[start + length - 1];
+					hash *= mul;
+				}
+				hash = shift_mix(hash) * mul;
+				hash = shift_mix(hash);
+				hashes[(start + length - 1) * stride + length] = hash;
+			}
+		}
+	}
+#else
+	void hash_all_substrings(wchar_t const* ptr, int size, int max_length, size_t* hashes, int stride){
+		for(int start = 0;start < size;start++){
+			int limit_length = std::min(max_length, size - start);
+			for(int length = 1;length <= limit_length;length++){
+				hashes[(start + length - 1) * stride + length] = hash_substring_ptr(ptr, start, start + length - 1);
+			}
+		}
+	}
+#endif
 } // namespace npycrf
\ No newline at end of file
@@ -13,4 +13,7 @@ namespace npycrf {
 	size_t hash_wstring(const std::wstring &str);
 	size_t hash_substring_ptr(wchar_t const* ptr, int start, int end);		// endを含む
 	size_t hash_substring(const std::wstring &str, int start, int end);		// endを含む
+	// 長さmax_length以下の全ての部分文字列のハッシュ値をhashes[end * stride + length]に書き込む
+	// 値はhash_substring_ptrと一致する
+	void hash_all_substrings(wchar_t const* ptr, int size, int max_length, size_t* hashes, int stride);
 }
\ No newline at end of file
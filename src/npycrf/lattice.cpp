@@ -1,7 +1,11 @@
 #include <algorithm>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <tuple>
 #include "hash.h"
 #include "sampler.h"
+#include "logsumexp.h"
 #include "lattice.h"
 
 // ＿人人人人人人人人人人人人人人人人人人人人人人人人人人人人＿
@@ -15,13 +19,22 @@ namespace npycrf {
 		_crf = crf;
 		_pure_crf_mode = false;
 		_pure_npylm_mode = false;
+		_log_domain_mode = false;
+		_viterbi_only_mode = false;
+		_viterbi_window = 0;
+		_viterbi_num_columns = 0;
+		_viterbi_num_forced = 0;
+		_mt = NULL;
+		_potentials = new crf::Potentials(0);
+		_potentials_serial = 0;
 		_max_sentence_length = 0;
 		_max_word_length = 0;
 		_word_ids = array<id>(3);
+		_hpylm_parent_pw_cache = array<double>(3);		// 3-gram
 		reserve(npylm->_max_word_length, 1);
 	}
 	Lattice::~Lattice(){
-
+		delete _potentials;
 	}
 	// 必要ならキャッシュの再確保
 	void Lattice::reserve(int max_word_length, int max_sentence_length){
@@ -36,34 +49,575 @@ namespace npycrf {
 		_max_word_length = max_word_length;
 		_max_sentence_length = max_sentence_length;
 		// 必要な配列の初期化
+		// 各テーブルは連続領域なので確保済みの領域に収まれば再確保しない
 		int seq_capacity = max_sentence_length + 1;
 		int word_capacity = max_word_length + 1;
 		// 前向き確率のスケーリング係数
 		_scaling = array<double>(seq_capacity + 1);
 		// ビタビアルゴリズム用
-		_viterbi_backward = mat::tri<int>(seq_capacity, word_capacity, word_capacity);
+		// リングバッファを使う場合は文長によらず一定
+		// 前向き確率はL列前まで、バックポインタは確定した位置まで遡れればよい
+		_viterbi_num_columns = 0;
+		int num_alpha_columns = seq_capacity + 1;
+		if(_viterbi_window > 0){
+			_viterbi_num_columns = std::max(_viterbi_window, 2 * word_capacity + 1);
+			num_alpha_columns = _viterbi_num_columns;
+		}
+		// 2-gramの格子では3-gramの前向き確率とバックポインタを使わない
+		// 3-gramの格子では2-gramの前向き確率とバックポインタを使わない
+		if(get_bigram_mode()){
+			_viterbi_backward = mat::tri<int>();
+			_alpha = mat::tri<double>();
+			_backoff_alpha = mat::bi<double>();
+			_backoff_i = mat::bi<int>();
+			_num_context_i = mat::bi<int>();
+			_context_i = mat::tri<int>();
+			// 位置0から<eos>の位置N+1まで
+			_log_alpha_tk.resize(seq_capacity + 1, word_capacity);
+			_viterbi_backward_tk.resize(seq_capacity + 1, word_capacity);
+		}else{
+			_log_alpha_tk = mat::bi<double>();
+			_viterbi_backward_tk = mat::bi<int>();
+			_viterbi_backward.resize((_viterbi_window > 0) ? _viterbi_num_columns : seq_capacity, word_capacity, word_capacity);
+			// 前向き確率
+			_alpha.resize(num_alpha_columns, word_capacity, word_capacity);
+			// 3-gramの文脈がないiをまとめた前向き確率
+			_backoff_alpha.resize(num_alpha_columns, word_capacity);
+			_backoff_i.resize(num_alpha_columns, word_capacity);
+			_num_context_i.resize(num_alpha_columns, word_capacity);
+			_context_i.resize(num_alpha_columns, word_capacity, word_capacity);
+		}
+		// 部分文字列のIDのキャッシュ
+		_substring_word_id_cache.resize(seq_capacity, word_capacity);
+		// 単語事前分布g0のキャッシュ
+		_g0_tk.resize(seq_capacity, word_capacity);
+		// 純粋なCRFの線形連鎖用のテーブルは使うときに確保する
+		_chain_alpha = mat::bi<double>();
+		_chain_beta = mat::bi<double>();
+		_chain_backward = array<int>();
+		// HPYLMの文脈ノードのキャッシュ
+		// リングバッファを使う場合は文長に比例する領域を持たないように確保せず毎回辿る
+		if(_viterbi_window > 0){
+			_context_node_cache = mat::tri<lm::Node<id>*>();
+		}else{
+			_context_node_cache.resize(seq_capacity, word_capacity, word_capacity);
+		}
+		// ビタビアルゴリズムのみの場合は学習用のテーブルを解放する
+		// 4階のテーブルはO(N・L^3)なので長い文ではこれが大半を占める
+		if(_viterbi_only_mode){
+			_backward_sampling_table = array<double>();
+			_log_sum_buffer = array<double>();
+			_beta = mat::tri<double>();
+			_pc_s = mat::bi<double>();
+			_pz_s = mat::tri<double>();
+			_pw_h_tkji = mat::quad<double>();
+			_p_transition_tkji = mat::quad<double>();
+			_p_conc_tkji = mat::quad<double>();
+			_log_beta_tk = mat::bi<double>();
+			_pw_h_tkj = mat::tri<double>();
+			_log_p_transition_tkj = mat::tri<double>();
+			_p_conc_tkj = mat::tri<double>();
+			return;
+		}
 		// 後ろ向きアルゴリズムでkとjをサンプリングするときの確率表
 		_backward_sampling_table = array<double>(word_capacity * word_capacity);
-		// 前向き確率
-		_alpha = mat::tri<double>(seq_capacity + 1, word_capacity, word_capacity);
-		// 後向き確率
-		_beta = mat::tri<double>(seq_capacity + 1, word_capacity, word_capacity);
+		_log_sum_buffer = array<double>(word_capacity + 1);
 		// 部分文字列が単語になる条件付き確率テーブル
-		_pc_s = mat::bi<double>(seq_capacity, word_capacity);
+		_pc_s.resize(seq_capacity, word_capacity);
 		// Markov-CRFの周辺確率テーブル
-		_pz_s = mat::tri<double>(seq_capacity + 1, 2, 2);
-		// 3-gram確率のキャッシュ
-		_pw_h_tkji = mat::quad<double>(seq_capacity + 1, word_capacity, word_capacity, word_capacity);
-		// 遷移確率のキャッシュ
-		_p_transition_tkji = mat::quad<double>(seq_capacity + 1, word_capacity, word_capacity, word_capacity);
-		// 部分単語3-gramの周辺確率テーブル
-		_p_conc_tkji = mat::quad<double>(seq_capacity + 1, word_capacity, word_capacity, word_capacity);
-		// 部分文字列のIDのキャッシュ
-		_substring_word_id_cache = mat::bi<id>(seq_capacity, word_capacity);
+		_pz_s.resize(seq_capacity + 1, 2, 2);
+		// 2-gramの格子では3-gramの4階のテーブルを使わない
+		if(get_bigram_mode()){
+			_beta = mat::tri<double>();
+			_pw_h_tkji = mat::quad<double>();
+			_p_transition_tkji = mat::quad<double>();
+			_p_conc_tkji = mat::quad<double>();
+			// 2-gramの格子の後向き確率と遷移確率のキャッシュ
+			_log_beta_tk.resize(seq_capacity + 1, word_capacity);
+			_pw_h_tkj.resize(seq_capacity + 1, word_capacity, word_capacity);
+			_log_p_transition_tkj.resize(seq_capacity + 1, word_capacity, word_capacity);
+			_p_conc_tkj.resize(seq_capacity + 1, word_capacity, word_capacity);
+		}else{
+			_log_beta_tk = mat::bi<double>();
+			_pw_h_tkj = mat::tri<double>();
+			_log_p_transition_tkj = mat::tri<double>();
+			_p_conc_tkj = mat::tri<double>();
+			// 後向き確率
+			_beta.resize(seq_capacity + 1, word_capacity, word_capacity);
+			// 3-gram確率のキャッシュ
+			_pw_h_tkji.resize(seq_capacity + 1, word_capacity, word_capacity, word_capacity);
+			// 遷移確率のキャッシュ
+			_p_transition_tkji.resize(seq_capacity + 1, word_capacity, word_capacity, word_capacity);
+			// 部分単語3-gramの周辺確率テーブル
+			_p_conc_tkji.resize(seq_capacity + 1, word_capacity, word_capacity, word_capacity);
+		}
+	}
+	// 純粋なCRFの線形連鎖用のテーブル
+	// 位置1から<eos>の次の位置N+2まで. 確保済みの大きさに収まれば何もしない
+	void Lattice::_reserve_linear_chain_tables(bool backward){
+		int seq_capacity = _max_sentence_length + 3;
+		int word_capacity = _max_word_length + 1;
+		if(_chain_alpha._t_size < seq_capacity || _chain_alpha._k_size != word_capacity){
+			_chain_alpha.resize(seq_capacity, word_capacity);
+			_chain_backward = array<int>(seq_capacity);
+		}
+		if(backward && (_chain_beta._t_size < seq_capacity || _chain_beta._k_size != word_capacity)){
+			_chain_beta.resize(seq_capacity, word_capacity);
+		}
 	}
 	double Lattice::_lambda_0(){
 		return _crf->_parameter->_lambda_0;
 	}
+	double Lattice::_sample_uniform(){
+		if(_mt == NULL){
+			return sampler::uniform(0, 1);
+		}
+		return sampler::uniform(*_mt, 0, 1);
+	}
+	// 文ごとにCRFのパスのコストを列挙しておき、ポテンシャルを定数時間で求める
+	// 表はラティスが1つだけ持ち、同じ文で重みが変わっていなければ計算し直さない
+	void Lattice::_enumerate_path_costs(Sentence* sentence){
+		if(_pure_npylm_mode){
+			return;
+		}
+		if(_potentials_serial == sentence->_serial && _potentials->_version == _crf->_parameter->_version){
+			return;
+		}
+		if(sentence->_features == NULL){
+			// 分割のみの場合は素性IDを展開せずに重みを直接引く
+			_crf->enumerate_path_costs_without_features(sentence, _potentials);
+			_potentials->_version = _crf->_parameter->_version;
+		}else{
+			_crf->enumerate_potentials(sentence, _potentials);
+		}
+		_potentials_serial = sentence->_serial;
+	}
+	// 文ごとに全ての部分文字列のg0を先に求めておく
+	void Lattice::_enumerate_g0(Sentence* sentence){
+		if(_pure_crf_mode){
+			return;
+		}
+		_npylm->enumerate_g0_substrings(sentence->_character_ids, sentence->_characters, sentence->size(), _g0_tk);
+	}
+	double Lattice::_compute_gamma(Sentence* sentence, int s, int t){
+		return _potentials->compute_gamma(s, t);
+	}
+	// 位置sから始まる単語の文脈(w_i, w_j)のHPYLMのノード
+	// w_jは位置sで終わる長さjの部分文字列、w_iはその前の長さiの部分文字列（文頭またはi=0なら<bos>）
+	// 2-gramのNPYLMではw_iは使われないのでi=0を渡す
+	// 次の単語の長さによらないので全てのkで使い回す
+	// 3-gramの文脈がない場合は2-gram以下のノードが入る
+	// ビタビアルゴリズムのみの場合はキャッシュを確保しないので毎回辿る
+	lm::Node<id>* Lattice::_find_context_node(Sentence* sentence, int s, int j, int i){
+		if(_viterbi_window == 0){
+			lm::Node<id>* node = _context_node_cache(s, j, i);
+			if(node != NULL){
+				return node;
+			}
+		}
+		_word_ids[0] = (i == 0) ? SPECIAL_CHARACTER_BEGIN : get_substring_word_id_at_t_k(sentence, s - j, i);
+		_word_ids[1] = get_substring_word_id_at_t_k(sentence, s, j);
+		lm::Node<id>* node = _npylm->find_node_by_tracing_back_context_from_time_t(_word_ids, 3, 2, false, true);
+		assert(node != NULL);
+		if(_viterbi_window == 0){
+			_context_node_cache(s, j, i) = node;
+		}
+		return node;
+	}
+	// 文脈(w_i, w_j)の後にword_idが続く確率
+	double Lattice::_compute_p_w_given_h(Sentence* sentence, int s, int j, int i, id word_id, int substr_char_t_start, int substr_char_t_end){
+		lm::Node<id>* context_node = _find_context_node(sentence, s, j, i);
+		return _npylm->compute_p_w_given_h(context_node, sentence->_character_ids, sentence->_characters, sentence->size(), word_id, substr_char_t_start, substr_char_t_end, _g0_tk);
+	}
+	// 位置sで終わる長さjの単語の文脈(w_i, w_j)を、3-gramのノードがHPYLMにあるiとないiに分ける
+	// ないiはalpha(s, j, i)をまとめておき、次の単語の長さkによらず使い回す
+	// alpha(s, j, ・)が確定してから呼ぶ. ビタビアルゴリズムでは最大値とそのiを持つ
+	void Lattice::_enumerate_backoff_contexts(Sentence* sentence, int s, mat::tri<double> &alpha, bool viterbi){
+		int column = (viterbi) ? _viterbi_column(s) : s;
+		for(int j = 1;j <= std::min(s - 1, _max_word_length);j++){
+			int limit_i = std::min(s - j, _max_word_length);
+			double* alpha_i = alpha.row(column, j);
+			int* context_i = _context_i.row(column, j);
+			int num_contexts = 0;
+			int backoff_i = 0;
+			double backoff_alpha = 0;
+			for(int i = 1;i <= limit_i;i++){
+				// 純粋なCRFでは遷移確率がiによらない
+				if(_pure_crf_mode == false && _find_context_node(sentence, s, j, i)->_depth >= 2){
+					context_i[num_contexts] = i;
+					num_contexts++;
+					continue;
+				}
+				if(backoff_i == 0){
+					backoff_i = i;
+					backoff_alpha = alpha_i[i];
+					continue;
+				}
+				if(viterbi){
+					if(alpha_i[i] > backoff_alpha){
+						backoff_i = i;
+						backoff_alpha = alpha_i[i];
+					}
+				}else if(_log_domain_mode){
+					backoff_alpha = logaddexp(backoff_alpha, alpha_i[i]);
+				}else{
+					backoff_alpha += alpha_i[i];
+				}
+			}
+			_num_context_i(column, j) = num_contexts;
+			_backoff_i(column, j) = backoff_i;
+			_backoff_alpha(column, j) = backoff_alpha;
+		}
+	}
+	// 前向き確率の計算では3-gramの文脈がないiの遷移確率を代表のiにしか書き込まないので、
+	// 全てのiの遷移確率を使う後向き確率や周辺確率の前に残りのiに複製する
+	void Lattice::_fill_backoff_transitions(Sentence* sentence, mat::quad<double> &pw_h_tkji, mat::quad<double> &p_transition_tkji){
+		if(_pure_crf_mode){
+			return;
+		}
+		for(int t = 1;t <= sentence->size();t++){
+			for(int k = 1;k <= std::min(t, _max_word_length);k++){
+				int s = t - k;
+				for(int j = 1;j <= std::min(s - 1, _max_word_length);j++){
+					int backoff_i = _backoff_i(s, j);
+					if(backoff_i == 0){
+						continue;
+					}
+					double pw_h = pw_h_tkji(t, k, j, backoff_i);
+					double p_transition = p_transition_tkji(t, k, j, backoff_i);
+					int* context_i = _context_i.row(s, j);
+					int num_contexts = _num_context_i(s, j);
+					int n = 0;
+					for(int i = 1;i <= std::min(s - j, _max_word_length);i++){
+						if(n < num_contexts && context_i[n] == i){
+							n++;
+							continue;
+						}
+						pw_h_tkji(t, k, j, i) = pw_h;
+						p_transition_tkji(t, k, j, i) = p_transition;
+					}
+				}
+			}
+		}
+	}
+	// 前向き確率の計算後に遷移確率のキャッシュを引く
+	// 3-gramの文脈がないiは代表のiの値を返す
+	double Lattice::_get_p_transition(Sentence* sentence, mat::quad<double> &p_transition_tkji, int t, int k, int j, int i){
+		if(i > 0 && t <= sentence->size() && _find_context_node(sentence, t - k, j, i)->_depth < 2){
+			i = _backoff_i(t - k, j);
+		}
+		return p_transition_tkji(t, k, j, i);
+	}
+	// 純粋なCRFでは遷移確率がCRFのポテンシャルのみになるため、単語3-gramの格子を使わず
+	// ラベル列y_1, ..., y_{N+2}上の線形連鎖として前向き・後向き確率をO(N・L)で求める
+	// y_1 = 1（<bos>の直後は単語の先頭）、y_{N+1} = y_{N+2} = 1（<eos>）で固定
+	// 格子と同じく単語長をL以下に制限するため、状態rは位置iで終わる単語の途中までの長さにする
+	// r = 1ならy_i = 1、r >= 2ならy_i = 0で、rはr - 1からのみ遷移できる
+	// _chain_alpha(i, r)は位置iの状態がrになる確率、値は対数で持つ
+	void Lattice::_enumerate_linear_chain_forward_variables(Sentence* sentence){
+		_reserve_linear_chain_tables(false);
+		int size = sentence->size();
+		for(int r = 1;r <= _max_word_length;r++){
+			_chain_alpha(1, r) = -std::numeric_limits<double>::infinity();
+		}
+		_chain_alpha(1, 1) = 0;
+		for(int i = 2;i <= size + 2;i++){
+			// 単語の先頭にはどの状態からも遷移できる
+			double log_alpha = _chain_alpha(i - 1, 1) + _potentials->_path_cost(i, 1, 1);
+			if(_max_word_length >= 2){
+				double log_alpha_0 = logsumexp(&_chain_alpha(i - 1, 0), 2, _max_word_length);
+				log_alpha = logaddexp(log_alpha, log_alpha_0 + _potentials->_path_cost(i, 0, 1));
+			}
+			_chain_alpha(i, 1) = log_alpha;
+			for(int r = 2;r <= _max_word_length;r++){
+				if(i > size){	// </s>以降はy_i = 1のみ
+					_chain_alpha(i, r) = -std::numeric_limits<double>::infinity();
+					continue;
+				}
+				int y_i_1 = (r - 1 == 1) ? 1 : 0;
+				_chain_alpha(i, r) = _chain_alpha(i - 1, r - 1) + _potentials->_path_cost(i, y_i_1, 0);
+			}
+		}
+	}
+	// _chain_beta(i, r)は位置iの状態rから文末までの確率
+	void Lattice::_enumerate_linear_chain_backward_variables(Sentence* sentence){
+		_check_training_tables();
+		_reserve_linear_chain_tables(true);
+		int size = sentence->size();
+		for(int r = 1;r <= _max_word_length;r++){
+			_chain_beta(size + 2, r) = -std::numeric_limits<double>::infinity();
+		}
+		_chain_beta(size + 2, 1) = 0;
+		for(int i = size + 2;i >= 2;i--){
+			for(int r = 1;r <= _max_word_length;r++){
+				int y_i_1 = (r == 1) ? 1 : 0;
+				double log_beta = _potentials->_path_cost(i, y_i_1, 1) + _chain_beta(i, 1);
+				if(i <= size && r < _max_word_length){
+					log_beta = logaddexp(log_beta, _potentials->_path_cost(i, y_i_1, 0) + _chain_beta(i, r + 1));
+				}
+				_chain_beta(i - 1, r) = log_beta;
+			}
+		}
+	}
+	double Lattice::_compute_linear_chain_log_normalizing_constant(Sentence* sentence){
+		_enumerate_linear_chain_forward_variables(sentence);
+		return _chain_alpha(sentence->size() + 2, 1);
+	}
+	// pz_s(i - 1, y_{i-1}, y_i)は位置iのパスを通る確率
+	// y_{i-1} = 0はr = 2, ..., Lをまとめたもの
+	void Lattice::_enumerate_marginal_p_z_given_sentence_linear_chain(Sentence* sentence, mat::tri<double> &pz_s){
+		int size = sentence->size();
+		_enumerate_linear_chain_forward_variables(sentence);
+		_enumerate_linear_chain_backward_variables(sentence);
+		double log_Zs = _chain_alpha(size + 2, 1);
+		#ifdef __DEBUG__
+			assert(std::abs(log_Zs - _chain_beta(1, 1)) < 1e-8);
+		#endif
+		pz_s(0, 0, 0) = 0;
+		pz_s(0, 0, 1) = 0;
+		pz_s(0, 1, 0) = 0;
+		pz_s(0, 1, 1) = 1;
+		for(int i = 2;i <= size + 2;i++){
+			double const* alpha = &_chain_alpha(i - 1, 0);
+			// 単語の先頭へ
+			pz_s(i - 1, 1, 1) = exp(alpha[1] + _potentials->_path_cost(i, 1, 1) + _chain_beta(i, 1) - log_Zs);
+			pz_s(i - 1, 0, 1) = 0;
+			if(_max_word_length >= 2){
+				double log_alpha_0 = logsumexp(alpha, 2, _max_word_length);
+				pz_s(i - 1, 0, 1) = exp(log_alpha_0 + _potentials->_path_cost(i, 0, 1) + _chain_beta(i, 1) - log_Zs);
+			}
+			// 単語の途中へ
+			pz_s(i - 1, 1, 0) = 0;
+			pz_s(i - 1, 0, 0) = 0;
+			if(i > size || _max_word_length < 2){
+				continue;
+			}
+			pz_s(i - 1, 1, 0) = exp(alpha[1] + _potentials->_path_cost(i, 1, 0) + _chain_beta(i, 2) - log_Zs);
+			if(_max_word_length >= 3){
+				// r -> r + 1 (r = 2, ..., L - 1)
+				double log_p_0_0 = logsumexp(alpha, &_chain_beta(i, 1), 2, _max_word_length - 1);
+				pz_s(i - 1, 0, 0) = exp(log_p_0_0 + _potentials->_path_cost(i, 0, 0) - log_Zs);
+			}
+		}
+	}
+	// 線形連鎖のビタビアルゴリズム
+	// r >= 2の状態は直前の状態が決まっているので、単語の先頭r = 1へのバックポインタのみ持つ
+	// _chain_backward[i]は位置iの直前で終わる単語の長さ
+	void Lattice::_viterbi_decode_linear_chain(Sentence* sentence, std::vector<int> &segments){
+		_reserve_linear_chain_tables(false);
+		int size = sentence->size();
+		for(int r = 1;r <= _max_word_length;r++){
+			_chain_alpha(1, r) = -std::numeric_limits<double>::infinity();
+		}
+		_chain_alpha(1, 1) = 0;
+		for(int i = 2;i <= size + 1;i++){
+			double max_score = _chain_alpha(i - 1, 1) + _potentials->_path_cost(i, 1, 1);
+			int argmax_r = 1;
+			double path_cost_0_1 = _potentials->_path_cost(i, 0, 1);
+			for(int r = 2;r <= _max_word_length;r++){
+				double score = _chain_alpha(i - 1, r) + path_cost_0_1;
+				if(score > max_score){
+					max_score = score;
+					argmax_r = r;
+				}
+			}
+			_chain_alpha(i, 1) = max_score;
+			_chain_backward[i] = argmax_r;
+			for(int r = 2;r <= _max_word_length;r++){
+				if(i > size){
+					_chain_alpha(i, r) = -std::numeric_limits<double>::infinity();
+					continue;
+				}
+				int y_i_1 = (r - 1 == 1) ? 1 : 0;
+				_chain_alpha(i, r) = _chain_alpha(i - 1, r - 1) + _potentials->_path_cost(i, y_i_1, 0);
+			}
+		}
+		// y_{N+1} = 1から遡る
+		segments.clear();
+		int i = size + 1;
+		while(i > 1){
+			int word_length = _chain_backward[i];
+			assert(1 <= word_length && word_length <= _max_word_length);
+			segments.push_back(word_length);
+			i -= word_length;
+		}
+		assert(i == 1);
+		reverse(segments.begin(), segments.end());
+	}
+	// 2-gramの遷移確率の対数 lambda_0 * log p(w_k|w_j) + potential
+	// w_kは位置tで終わる長さkの単語（t = N + 1なら<eos>）、w_jは位置t-kで終わる長さjの単語
+	double Lattice::_compute_log_p_transition_bigram(Sentence* sentence, int t, int k, int j, double crf_potential, double &pw_h){
+		if(_pure_crf_mode){
+			pw_h = 1;
+			return crf_potential;
+		}
+		if(t == sentence->size() + 1){
+			assert(k == 1);
+			pw_h = _compute_p_w_given_h(sentence, t - k, j, 0, SPECIAL_CHARACTER_END, -1, -1);
+		}else{
+			id word_k_id = get_substring_word_id_at_t_k(sentence, t, k);
+			pw_h = _compute_p_w_given_h(sentence, t - k, j, 0, word_k_id, t - k, t - 1);
+		}
+		assert(pw_h > 0);
+		return (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + crf_potential;
+	}
+	// 2-gramの前向き確率
+	// log_alpha(t, k)は位置tで長さkの単語が終わる確率の対数. <eos>はt = N + 1, k = 1
+	// 全ての遷移を後向き確率とサンプリングのためにキャッシュする
+	void Lattice::_enumerate_forward_variables_bigram(Sentence* sentence, mat::tri<double> &pw_h_tkj){
+		assert(sentence->size() <= _max_sentence_length);
+		_check_training_tables();
+		_log_alpha_tk(0, 0) = 0;
+		for(int t = 1;t <= sentence->size() + 1;t++){
+			int limit_k = (t == sentence->size() + 1) ? 1 : std::min(t, _max_word_length);
+			for(int k = 1;k <= limit_k;k++){
+				// CRFのポテンシャルはtとkのみで決まる
+				double crf_potential = 0;
+				if(_pure_npylm_mode == false){
+					crf_potential = _compute_gamma(sentence, t - k + 1, t + 1);
+				}
+				int start_j = (t - k == 0) ? 0 : 1;
+				int limit_j = std::min(t - k, _max_word_length);
+				double* log_p_transition_j = _log_p_transition_tkj.row(t, k);
+				for(int j = start_j;j <= limit_j;j++){
+					double pw_h = 0;
+					log_p_transition_j[j] = _compute_log_p_transition_bigram(sentence, t, k, j, crf_potential, pw_h);
+					pw_h_tkj(t, k, j) = pw_h;
+				}
+				_log_alpha_tk(t, k) = logsumexp(log_p_transition_j, _log_alpha_tk.row(t - k), start_j, limit_j);
+			}
+		}
+	}
+	// 2-gramの後向き確率
+	// log_beta(t, k)は位置tで終わる長さkの単語から<eos>までの確率の対数
+	// 遷移確率は前向き確率の計算時にキャッシュされている
+	void Lattice::_enumerate_backward_variables_bigram(Sentence* sentence){
+		assert(sentence->size() <= _max_sentence_length);
+		int size = sentence->size();
+		_log_beta_tk(size + 1, 1) = 0;
+		for(int k = 1;k <= std::min(size, _max_word_length);k++){
+			_log_beta_tk(size, k) = _log_p_transition_tkj(size + 1, 1, k);
+		}
+		for(int t = size - 1;t >= 0;t--){
+			int limit_n = std::min(size - t, _max_word_length);
+			for(int k = (t == 0) ? 0 : 1;k <= std::min(t, _max_word_length);k++){
+				for(int n = 1;n <= limit_n;n++){
+					_log_sum_buffer[n] = _log_p_transition_tkj(t + n, n, k) + _log_beta_tk(t + n, n);
+				}
+				_log_beta_tk(t, k) = logsumexp(&_log_sum_buffer[0], 1, limit_n);
+			}
+		}
+	}
+	double Lattice::_compute_log_normalizing_constant_bigram(Sentence* sentence){
+		_enumerate_forward_variables_bigram(sentence, _pw_h_tkj);
+		return _log_alpha_tk(sentence->size() + 1, 1);
+	}
+	// <eos>から1つ前の単語の長さを順にサンプリング
+	void Lattice::_backward_sampling_bigram(Sentence* sentence, std::vector<int> &segments){
+		segments.clear();
+		int t = sentence->size() + 1;
+		int k = 1;	// <eos>
+		while(t - k > 0){
+			int limit_j = std::min(t - k, _max_word_length);
+			double max_value = -std::numeric_limits<double>::infinity();
+			for(int j = 1;j <= limit_j;j++){
+				_backward_sampling_table[j] = _log_p_transition_tkj(t, k, j) + _log_alpha_tk(t - k, j);
+				max_value = std::max(max_value, _backward_sampling_table[j]);
+			}
+			double sum_p = 0;
+			for(int j = 1;j <= limit_j;j++){
+				_backward_sampling_table[j] = exp(_backward_sampling_table[j] - max_value);
+				sum_p += _backward_sampling_table[j];
+			}
+			double r = _sample_uniform() * sum_p;
+			double stack = 0;
+			int sampled_j = limit_j;
+			for(int j = 1;j <= limit_j;j++){
+				stack += _backward_sampling_table[j];
+				if(r <= stack){
+					sampled_j = j;
+					break;
+				}
+			}
+			segments.push_back(sampled_j);
+			t -= k;
+			k = sampled_j;
+		}
+		reverse(segments.begin(), segments.end());
+	}
+	// 2-gramのビタビアルゴリズム
+	// 遷移確率は文ごとにキャッシュせず、その場で計算する
+	void Lattice::_viterbi_decode_bigram(Sentence* sentence, std::vector<int> &segments){
+		assert(sentence->size() <= _max_sentence_length);
+		_log_alpha_tk(0, 0) = 0;
+		for(int t = 1;t <= sentence->size() + 1;t++){
+			int limit_k = (t == sentence->size() + 1) ? 1 : std::min(t, _max_word_length);
+			for(int k = 1;k <= limit_k;k++){
+				double crf_potential = 0;
+				if(_pure_npylm_mode == false){
+					crf_potential = _compute_gamma(sentence, t - k + 1, t + 1);
+				}
+				double max_log_p = -std::numeric_limits<double>::infinity();
+				int argmax_j = -1;
+				for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, _max_word_length);j++){
+					double pw_h = 0;
+					double log_p = _compute_log_p_transition_bigram(sentence, t, k, j, crf_potential, pw_h) + _log_alpha_tk(t - k, j);
+					if(argmax_j == -1 || log_p > max_log_p){
+						max_log_p = log_p;
+						argmax_j = j;
+					}
+				}
+				assert(argmax_j != -1);
+				_log_alpha_tk(t, k) = max_log_p;
+				_viterbi_backward_tk(t, k) = argmax_j;
+			}
+		}
+		// <eos>から遡る
+		segments.clear();
+		int t = sentence->size() + 1;
+		int k = 1;
+		while(t - k > 0){
+			int j = _viterbi_backward_tk(t, k);
+			assert(1 <= j && j <= _max_word_length);
+			segments.push_back(j);
+			t -= k;
+			k = j;
+		}
+		reverse(segments.begin(), segments.end());
+	}
+	// 部分文字列が単語になる確率
+	void Lattice::_enumerate_marginal_p_substring_given_sentence_bigram(mat::bi<double> &pc_s, int sentence_length, double log_Zs){
+		assert(sentence_length <= _max_sentence_length);
+		for(int t = 1;t <= sentence_length;t++){
+			for(int k = 1;k <= std::min(t, _max_word_length);k++){
+				double sum_probability = exp(_log_alpha_tk(t, k) + _log_beta_tk(t, k) - log_Zs);
+				if(sum_probability > 1){	// 多少の誤差は丸める
+					assert(sum_probability - 1 < 1e-12);
+					sum_probability = 1;
+				}
+				assert(0 < sum_probability && sum_probability <= 1);
+				pc_s(t, k) = sum_probability;
+			}
+		}
+	}
+	// Pconc(c^{t-k}_{t-k-j+1}, c^t_{t-k+1}|x)の計算
+	// t = N + 1は<eos>
+	void Lattice::_enumerate_marginal_p_bigram_given_sentence(Sentence* sentence, mat::tri<double> &p_conc_tkj, double log_Zs){
+		for(int t = 1;t <= sentence->size() + 1;t++){
+			int limit_k = (t == sentence->size() + 1) ? 1 : std::min(t, _max_word_length);
+			for(int k = 1;k <= limit_k;k++){
+				double log_beta_t_k = _log_beta_tk(t, k) - log_Zs;
+				for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, _max_word_length);j++){
+					double marginal_p = exp(_log_alpha_tk(t - k, j) + _log_p_transition_tkj(t, k, j) + log_beta_t_k);
+					if(marginal_p > 1){		// 多少の誤差は丸める
+						assert(marginal_p - 1 < 1e-12);
+						marginal_p = 1;
+					}
+					p_conc_tkj(t, k, j) = marginal_p;
+				}
+			}
+		}
+	}
 	void Lattice::set_pure_crf_mode(bool enabled){
 		_pure_crf_mode = enabled;
 		_pure_npylm_mode = false;
@@ -79,6 +633,51 @@ namespace npycrf {
 	bool Lattice::get_pure_crf_mode(){
 		return _pure_crf_mode;
 	}
+	// 複数のスレッドで同時にサンプリングする場合はLatticeごとに乱数生成器を渡す
+	// NULLに戻すとsampler::mtを使う
+	void Lattice::set_random_generator(std::mt19937* mt){
+		_mt = mt;
+	}
+	// NPYLMが単語2-gramなら2-gramの格子を使う
+	bool Lattice::get_bigram_mode(){
+		return _npylm->_ngram == 2;
+	}
+	// 対数モードでは前向き・後向き確率とp_transition_tkjiを対数で持つ
+	// スケーリング係数は使わない
+	void Lattice::set_log_domain_mode(bool enabled){
+		_log_domain_mode = enabled;
+	}
+	bool Lattice::get_log_domain_mode(){
+		return _log_domain_mode;
+	}
+	// 分割のみを行う場合はtrueにする
+	// 切り替えた時点で確保済みのテーブルを作り直す
+	void Lattice::set_viterbi_only_mode(bool enabled){
+		if(_viterbi_only_mode == enabled){
+			return;
+		}
+		_viterbi_only_mode = enabled;
+		if(enabled == false){
+			_viterbi_window = 0;	// リングバッファでは前向き確率の全体が残らない
+		}
+		_allocate_capacity(_max_word_length, _max_sentence_length);
+	}
+	// 0より大きい値を指定するとビタビアルゴリズムを逐次的に行う
+	// 前向き確率とバックポインタはnum_columns列（最低でも2L+3列）のリングバッファに置き、
+	// 全ての経路が合流した位置までの単語を順次確定させる
+	// ビタビアルゴリズム専用になる
+	void Lattice::set_viterbi_window(int num_columns){
+		assert(num_columns >= 0);
+		_viterbi_window = num_columns;
+		_viterbi_only_mode = (num_columns > 0) ? true : _viterbi_only_mode;
+		_allocate_capacity(_max_word_length, _max_sentence_length);
+	}
+	int Lattice::get_viterbi_window(){
+		return _viterbi_window;
+	}
+	bool Lattice::get_viterbi_only_mode(){
+		return _viterbi_only_mode;
+	}
 	id Lattice::get_substring_word_id_at_t_k(Sentence* sentence, int t, int k){
 		assert(t <= sentence->size());
 		assert(k < _max_sentence_length + 1);
@@ -86,6 +685,10 @@ namespace npycrf {
 		if(t == 0){
 			return SPECIAL_CHARACTER_BEGIN;
 		}
+		// 文が部分文字列のIDを持っていればそれを使う
+		if(0 < k && k <= sentence->_substr_word_ids_max_length){
+			return sentence->_substr_word_ids(t - 1, k);
+		}
 		id word_id = _substring_word_id_cache(t, k);
 		if(word_id == 0){
 			word_id = sentence->get_substr_word_id(t - k, t - 1);	// 引数はインデックスなので注意
@@ -99,9 +702,6 @@ namespace npycrf {
 	// 				このキャッシュは後向き確率の計算時に使う
 	void Lattice::_sum_alpha_t_k_j(Sentence* sentence, int t, int k, int j, mat::tri<double> &alpha, mat::quad<double> &pw_h_tkji, mat::quad<double> &p_transition_tkji, double prod_scaling, double crf_potential){
 		id word_k_id = get_substring_word_id_at_t_k(sentence, t, k);
-		wchar_t const* characters = sentence->_characters;
-		array<int> &character_ids = sentence->_character_ids;
-		int character_ids_length = sentence->size();
 		assert(t <= _max_sentence_length + 1);
 		assert(k <= _max_word_length);
 		assert(j <= _max_word_length);
@@ -112,10 +712,7 @@ namespace npycrf {
 			if(_pure_crf_mode){
 				p_transition = exp(crf_potential);
 			}else{
-				_word_ids[0] = SPECIAL_CHARACTER_BEGIN;
-				_word_ids[1] = SPECIAL_CHARACTER_BEGIN;
-				_word_ids[2] = word_k_id;
-				double pw_h = _npylm->compute_p_w_given_h(character_ids, characters, character_ids_length, _word_ids, 3, 2, t - k, t - 1);
+				double pw_h = _compute_p_w_given_h(sentence, 0, 0, 0, word_k_id, t - k, t - 1);
 				assert(pw_h > 0);
 				p_transition = (_pure_npylm_mode) ? pw_h : exp(_lambda_0() * log(pw_h) + crf_potential);
 				pw_h_tkji(t, k, 0, 0) = pw_h;
@@ -131,10 +728,7 @@ namespace npycrf {
 			if(_pure_crf_mode){
 				p_transition = exp(crf_potential);
 			}else{
-				_word_ids[0] = SPECIAL_CHARACTER_BEGIN;
-				_word_ids[1] = get_substring_word_id_at_t_k(sentence, t - k, j);
-				_word_ids[2] = word_k_id;
-				double pw_h = _npylm->compute_p_w_given_h(character_ids, characters, character_ids_length, _word_ids, 3, 2, t - k, t - 1);
+				double pw_h = _compute_p_w_given_h(sentence, t - k, j, 0, word_k_id, t - k, t - 1);
 				assert(pw_h > 0);
 				assert(alpha(t - k, j, 0) > 0);
 				p_transition = (_pure_npylm_mode) ? pw_h : exp(_lambda_0() * log(pw_h) + crf_potential);
@@ -147,44 +741,59 @@ namespace npycrf {
 			return;
 		}
 		// それ以外の場合は周辺化
+		// 文脈(w_i, w_j)のノードがHPYLMにない場合はw_iによらず同じ確率になるので、
+		// ノードがあるiのみ個別に計算し、ないiはまとめたalphaに1度だけ遷移確率を掛ける
+		int s = t - k;
 		double sum = 0;
-		for(int i = 1;i <= std::min(t - k - j, _max_word_length);i++){
+		int* context_i = _context_i.row(s, j);
+		for(int n = 0;n < _num_context_i(s, j);n++){
+			int i = context_i[n];
+			assert(i <= _max_word_length);
+			assert(alpha(s, j, i) > 0);
+			double pw_h = _compute_p_w_given_h(sentence, s, j, i, word_k_id, s, t - 1);
+			assert(pw_h > 0);
+			double p_transition = (_pure_npylm_mode) ? pw_h : exp(_lambda_0() * log(pw_h) + crf_potential);
+			pw_h_tkji(t, k, j, i) = pw_h;
+			p_transition_tkji(t, k, j, i) = p_transition;
+			double value = p_transition * alpha(s, j, i);
+			assert(value > 0);
+			sum += value;
+		}
+		int backoff_i = _backoff_i(s, j);
+		if(backoff_i > 0){
 			double p_transition = 0;
 			if(_pure_crf_mode){
 				p_transition = exp(crf_potential);
 			}else{
-				_word_ids[0] = get_substring_word_id_at_t_k(sentence, t - k - j, i);
-				_word_ids[1] = get_substring_word_id_at_t_k(sentence, t - k, j);
-				_word_ids[2] = word_k_id;
-				double pw_h = _npylm->compute_p_w_given_h(character_ids, characters, character_ids_length, _word_ids, 3, 2, t - k, t - 1);
+				double pw_h = _compute_p_w_given_h(sentence, s, j, backoff_i, word_k_id, s, t - 1);
 				assert(pw_h > 0);
-				assert(i <= _max_word_length);
-				assert(alpha(t - k, j, i) > 0);
 				p_transition = (_pure_npylm_mode) ? pw_h : exp(_lambda_0() * log(pw_h) + crf_potential);
-				pw_h_tkji(t, k, j, i) = pw_h;
-				p_transition_tkji(t, k, j, i) = p_transition;
+				pw_h_tkji(t, k, j, backoff_i) = pw_h;
+				p_transition_tkji(t, k, j, backoff_i) = p_transition;
 			}
 			assert(p_transition > 0);
-			double value = p_transition * alpha(t - k, j, i);
-
-			#ifdef __DEBUG__
-				if(value == 0){
-					// std::cout << pw_h << std::endl;
-					std::cout << alpha(t - k, j, i) << std::endl;
-					std::cout << t << ", " << k << ", " << j << ", " << i << std::endl;
-				}
-			#endif
-
-			assert(value > 0);
-			sum += value;
+			assert(_backoff_alpha(s, j) > 0);
+			sum += p_transition * _backoff_alpha(s, j);
 		}
 		assert(sum > 0);
 		alpha(t, k, j) = sum * prod_scaling;
 	}
 	void Lattice::forward_filtering(Sentence* sentence, bool use_scaling){
+		if(get_bigram_mode()){
+			_enumerate_forward_variables_bigram(sentence, _pw_h_tkj);
+			return;
+		}
+		if(_log_domain_mode){
+			_enumerate_forward_variables_log(sentence, _alpha, _pw_h_tkji, _p_transition_tkji);
+			return;
+		}
 		_enumerate_forward_variables(sentence, _alpha, _pw_h_tkji, _p_transition_tkji, _scaling, use_scaling);
 	}
 	void Lattice::backward_sampling(Sentence* sentence, std::vector<int> &segments){
+		if(get_bigram_mode()){
+			_backward_sampling_bigram(sentence, segments);
+			return;
+		}
 		_backward_sampling(sentence, _alpha, _p_transition_tkji, segments);
 	}
 	// 求めた前向き確率テーブルをもとに後ろから分割をサンプリング
@@ -241,14 +850,11 @@ namespace npycrf {
 		assert(0 < next_word_length && next_word_length <= _max_word_length);
 		assert(_pure_crf_mode == false);
 		int table_index = 0;
-		wchar_t const* characters = sentence->_characters;
-		array<int> &character_ids = sentence->_character_ids;
-		int character_ids_length = sentence->size();
 		double sum_p = 0;
 		int limit_k = std::min(t, _max_word_length);
 		for(int k = 1;k <= limit_k;k++){
 			for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, _max_word_length);j++){
-				double p_transition = p_transition_tkji(t + next_word_length, next_word_length, k, j);
+				double p_transition = _get_p_transition(sentence, p_transition_tkji, t + next_word_length, next_word_length, k, j);	// 対数モードでは対数
 				#ifdef __DEBUG__
 					id word_j_id = get_substring_word_id_at_t_k(sentence, t - k, j);
 					id word_k_id = get_substring_word_id_at_t_k(sentence, t, k);
@@ -262,21 +868,40 @@ namespace npycrf {
 					_word_ids[0] = word_j_id;
 					_word_ids[1] = word_k_id;
 					_word_ids[2] = word_t_id;
-					double potential = _crf->compute_gamma(sentence, t + 1, t + next_word_length + 1);
-					double pw_h = _npylm->compute_p_w_given_h(character_ids, characters, character_ids_length, _word_ids, 3, 2, t, t + next_word_length - 1);
-					double _p_transition = exp(_lambda_0() * log(pw_h) + potential);
+					double potential = _compute_gamma(sentence, t + 1, t + next_word_length + 1);
+					double pw_h = _npylm->compute_p_w_given_h(sentence->_character_ids, sentence->_characters, sentence->size(), _word_ids, 3, 2, t, t + next_word_length - 1, _hpylm_parent_pw_cache, _g0_tk);
+					double _p_transition = _lambda_0() * log(pw_h) + potential;
+					if(_log_domain_mode == false){
+						_p_transition = exp(_p_transition);
+					}
 					assert(p_transition == _p_transition);
 				#endif
-				assert(alpha(t, k, j) > 0);
-				sum_p += p_transition * alpha(t, k, j);
-				_backward_sampling_table[table_index] = p_transition * alpha(t, k, j);
+				if(_log_domain_mode){
+					_backward_sampling_table[table_index] = p_transition + alpha(t, k, j);
+				}else{
+					assert(alpha(t, k, j) > 0);
+					_backward_sampling_table[table_index] = p_transition * alpha(t, k, j);
+				}
 				table_index++;
 			}
 		}
 		assert(table_index > 0);
 		assert(table_index <= _max_word_length * _max_word_length);
+		// 対数の場合は最大値を引いてから確率に戻す
+		if(_log_domain_mode){
+			double max_value = _backward_sampling_table[0];
+			for(int n = 1;n < table_index;n++){
+				max_value = std::max(max_value, _backward_sampling_table[n]);
+			}
+			for(int n = 0;n < table_index;n++){
+				_backward_sampling_table[n] = exp(_backward_sampling_table[n] - max_value);
+			}
+		}
+		for(int n = 0;n < table_index;n++){
+			sum_p += _backward_sampling_table[n];
+		}
 		double normalizer = 1.0 / sum_p;
-		double r = sampler::uniform(0, 1);
+		double r = _sample_uniform();
 		int i = 0;
 		double stack = 0;
 		for(int k = 1;k <= limit_k;k++){
@@ -303,7 +928,7 @@ namespace npycrf {
 		#ifdef __DEBUG__
 			for(int t = 0;t < size;t++){
 				_scaling[t] = 0;
-				for(int k = 0;k < _max_word_length + 1;k++){
+				for(int k = 0;k < _max_word_length + 1 && get_bigram_mode() == false;k++){
 					for(int j = 0;j < _max_word_length + 1;j++){
 						_alpha(t, k, j) = -1;
 					}
@@ -316,101 +941,115 @@ namespace npycrf {
 			}
 		#endif
 
-		_alpha(0, 0, 0) = 1;
 		_scaling[0] = 1;
 		_clear_word_id_cache(sentence->size());
-		_clear_p_tkji(sentence->size());
+		_enumerate_path_costs(sentence);
+		_enumerate_g0(sentence);
+		// 2-gramの格子は3-gramのテーブルを持たない
+		if(get_bigram_mode() == false){
+			_alpha(0, 0, 0) = 1;
+			_clear_p_tkji(sentence->size());
+		}
 		forward_filtering(sentence, use_scaling);
 		backward_sampling(sentence, segments);
 	}
+	// ビタビアルゴリズムの前向き確率とバックポインタの列
+	int Lattice::_viterbi_column(int t){
+		if(_viterbi_num_columns == 0){
+			return t;
+		}
+		return t % _viterbi_num_columns;
+	}
 	// ビタビアルゴリズム用
 	void Lattice::viterbi_argmax_alpha_t_k_j(Sentence* sentence, int t, int k, int j){
 		id word_k_id = get_substring_word_id_at_t_k(sentence, t, k);
-		wchar_t const* characters = sentence->_characters;
-		array<int> &character_ids = sentence->_character_ids;
-		int character_ids_length = sentence->size();
-		assert(t <= character_ids_length + 1);
+		assert(t <= sentence->size() + 1);
 		assert(k <= _max_word_length);
 		assert(j <= _max_word_length);
 		assert(t - k >= 0);
 		// <bos>から生成されている場合
 		if(j == 0){
-			_word_ids[0] = SPECIAL_CHARACTER_BEGIN;
-			_word_ids[1] = SPECIAL_CHARACTER_BEGIN;
-			_word_ids[2] = word_k_id;
 			double log_p_transition = 0;
 			double potential = 0;
 			if(_pure_crf_mode){
-				potential = _crf->compute_gamma(sentence, t - k + 1, t + 1);
+				potential = _compute_gamma(sentence, t - k + 1, t + 1);
 				log_p_transition = potential;
 			}else{
 				if(_pure_npylm_mode == false){
-					potential = _crf->compute_gamma(sentence, t - k + 1, t + 1);
+					potential = _compute_gamma(sentence, t - k + 1, t + 1);
 				}
-				double pw_h = _npylm->compute_p_w_given_h(character_ids, characters, character_ids_length, _word_ids, 3, 2, t - k, t - 1);
+				double pw_h = _compute_p_w_given_h(sentence, 0, 0, 0, word_k_id, t - k, t - 1);
 				assert(pw_h > 0);
 				log_p_transition = (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + potential;
 			}
-			_alpha(t, k, 0) = log_p_transition;
-			_viterbi_backward(t, k, 0) = 0;
+			_alpha(_viterbi_column(t), k, 0) = log_p_transition;
+			_viterbi_backward(_viterbi_column(t), k, 0) = 0;
 			return;
 		}
 		// i=0に相当
 		if(t - k - j == 0){
-			_word_ids[0] = SPECIAL_CHARACTER_BEGIN;
-			_word_ids[1] = get_substring_word_id_at_t_k(sentence, t - k, j);
-			_word_ids[2] = word_k_id;
 			double log_p_transition = 0;
 			double potential = 0;
 			if(_pure_crf_mode){
-				potential = _crf->compute_gamma(sentence, t - k + 1, t + 1);
+				potential = _compute_gamma(sentence, t - k + 1, t + 1);
 				log_p_transition = potential;
 			}else{
 				if(_pure_npylm_mode == false){
-					potential = _crf->compute_gamma(sentence, t - k + 1, t + 1);
+					potential = _compute_gamma(sentence, t - k + 1, t + 1);
 				}
-				double pw_h = _npylm->compute_p_w_given_h(character_ids, characters, character_ids_length, _word_ids, 3, 2, t - k, t - 1);
+				double pw_h = _compute_p_w_given_h(sentence, t - k, j, 0, word_k_id, t - k, t - 1);
 				assert(pw_h > 0);
 				log_p_transition = (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + potential;
 			}
-			assert(_alpha(t - k, j, 0) != 0);
-			_alpha(t, k, j) = log_p_transition + _alpha(t - k, j, 0);
-			assert(_alpha(t, k, j) != 0);
-			_viterbi_backward(t, k, j) = 0;
+			assert(_alpha(_viterbi_column(t - k), j, 0) != 0);
+			_alpha(_viterbi_column(t), k, j) = log_p_transition + _alpha(_viterbi_column(t - k), j, 0);
+			assert(_alpha(_viterbi_column(t), k, j) != 0);
+			_viterbi_backward(_viterbi_column(t), k, j) = 0;
 			return;
 		}
 		// それ以外の場合は周辺化
+		// 文脈(w_i, w_j)のノードがない場合の確率は1度だけ計算し、まとめたalphaの最大値に足す
+		// 値が等しい場合はiが小さい方を選ぶ
+		int s = t - k;
+		int column_s = _viterbi_column(s);
+		double potential = 0;
+		if(_pure_npylm_mode == false){
+			potential = _compute_gamma(sentence, s + 1, t + 1);
+		}
 		double max_log_p = 0;
 		int argmax = 0;
-		for(int i = 1;i <= std::min(t - k - j, _max_word_length);i++){
-			_word_ids[0] = get_substring_word_id_at_t_k(sentence, t - k - j, i);
-			_word_ids[1] = get_substring_word_id_at_t_k(sentence, t - k, j);
-			_word_ids[2] = word_k_id;
-			double log_p_transition = 0;
-			double potential = 0;
-			if(_pure_crf_mode){
-				potential = _crf->compute_gamma(sentence, t - k + 1, t + 1);
-				log_p_transition = potential;
-			}else{
-				if(_pure_npylm_mode == false){
-					potential = _crf->compute_gamma(sentence, t - k + 1, t + 1);
-				}
-				double pw_h = _npylm->compute_p_w_given_h(character_ids, characters, character_ids_length, _word_ids, 3, 2, t - k, t - 1);
-				assert(pw_h > 0);
-				log_p_transition = (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + potential;
-			}
+		int* context_i = _context_i.row(column_s, j);
+		for(int n = 0;n < _num_context_i(column_s, j);n++){
+			int i = context_i[n];
 			assert(i <= _max_word_length);
-			assert(_alpha(t - k, j, i) != 0);
-			double value = log_p_transition + _alpha(t - k, j, i);
+			double pw_h = _compute_p_w_given_h(sentence, s, j, i, word_k_id, s, t - 1);
+			assert(pw_h > 0);
+			double log_p_transition = (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + potential;
+			assert(_alpha(column_s, j, i) != 0);
+			double value = log_p_transition + _alpha(column_s, j, i);
 			assert(value != 0);
 			if(argmax == 0 || value > max_log_p){
 				argmax = i;
 				max_log_p = value;
 			}
 		}
+		int backoff_i = _backoff_i(column_s, j);
+		if(backoff_i > 0){
+			double log_p_transition = potential;
+			if(_pure_crf_mode == false){
+				double pw_h = _compute_p_w_given_h(sentence, s, j, backoff_i, word_k_id, s, t - 1);
+				assert(pw_h > 0);
+				log_p_transition = (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + potential;
+			}
+			double value = log_p_transition + _backoff_alpha(column_s, j);
+			if(argmax == 0 || value > max_log_p || (value == max_log_p && backoff_i < argmax)){
+				argmax = backoff_i;
+				max_log_p = value;
+			}
+		}
 		assert(argmax > 0);
-		_alpha(t, k, j) = max_log_p;
-		_viterbi_backward(t, k, j) = argmax;
+		_alpha(_viterbi_column(t), k, j) = max_log_p;
+		_viterbi_backward(_viterbi_column(t), k, j) = argmax;
 	}
 	void Lattice::viterbi_forward(Sentence* sentence){
 		for(int t = 1;t <= sentence->size();t++){
@@ -422,14 +1061,12 @@ namespace npycrf {
 					viterbi_argmax_alpha_t_k_j(sentence, t, k, j);
 				}
 			}
+			_enumerate_backoff_contexts(sentence, t, _alpha, true);
 		}
 	}
 	// <eos>に繋がる確率でargmax
 	void Lattice::viterbi_argmax_backward_k_and_j_to_eos(Sentence* sentence, int t, int &argmax_k, int &argmax_j){
 		assert(t == sentence->size());
-		wchar_t const* characters = sentence->_characters;
-		array<int> &character_ids = sentence->_character_ids;
-		int character_ids_length = sentence->size();
 		double max_log_p = 0;
 		argmax_k = 0;
 		argmax_j = 0;
@@ -438,21 +1075,18 @@ namespace npycrf {
 			for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, _max_word_length);j++){
 				double log_p_transition = 0;
 				if(_pure_crf_mode){
-					log_p_transition = _crf->compute_gamma(sentence, t + 1, t + 2);;	// expしない
+					log_p_transition = _compute_gamma(sentence, t + 1, t + 2);;	// expしない
 				}else{
 					double potential = 0;
 					if(_pure_npylm_mode == false){
-						potential = _crf->compute_gamma(sentence, t + 1, t + 2);
+						potential = _compute_gamma(sentence, t + 1, t + 2);
 					}
-					_word_ids[0] = get_substring_word_id_at_t_k(sentence, t - k, j);
-					_word_ids[1] = get_substring_word_id_at_t_k(sentence, t, k);
-					_word_ids[2] = SPECIAL_CHARACTER_END;
-					double pw_h = _npylm->compute_p_w_given_h(character_ids, characters, character_ids_length, _word_ids, 3, 2, t, t);
+					double pw_h = _compute_p_w_given_h(sentence, t, k, j, SPECIAL_CHARACTER_END, t, t);
 					assert(pw_h > 0);
 					log_p_transition = (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + potential;	// expしない
 				}
-				assert(_alpha(t, k, j) != 0);
-				double value = log_p_transition + _alpha(t, k, j);
+				assert(_alpha(_viterbi_column(t), k, j) != 0);
+				double value = log_p_transition + _alpha(_viterbi_column(t), k, j);
 				assert(value != 0);
 				if(argmax_k == 0 || value > max_log_p){
 					max_log_p = value;
@@ -479,7 +1113,7 @@ namespace npycrf {
 		assert(k > 0 && j > 0);
 		assert(j <= _max_word_length);
 		segments.push_back(j);
-		int i = _viterbi_backward(t, k, j);
+		int i = _viterbi_backward(_viterbi_column(t), k, j);
 		assert(i >= 0);
 		assert(i <= _max_word_length);
 		t -= k;
@@ -487,13 +1121,14 @@ namespace npycrf {
 		sum += i;
 		k = j;
 		j = i;
-		if(i == 0){
+		if(i == 0){	// 2単語の場合
 			assert(sum == sentence->size());
+			reverse(segments.begin(), segments.end());
 			return;
 		}
 		segments.push_back(i);
 		while(t > 0){
-			i = _viterbi_backward(t, k, j);
+			i = _viterbi_backward(_viterbi_column(t), k, j);
 			assert(i >= 0);
 			assert(i <= _max_word_length);
 			if(i != 0){
@@ -510,10 +1145,179 @@ namespace npycrf {
 		assert(segments.size() > 0);
 		reverse(segments.begin(), segments.end());
 	}
+	// 状態(t, k, j)は位置tで終わる長さkの単語と、その直前の長さjの単語を表す
+	// バックポインタを1つ辿る
+	void Lattice::_viterbi_previous_state(int &t, int &k, int &j){
+		int i = _viterbi_backward(_viterbi_column(t), k, j);
+		assert(0 <= i && i <= _max_word_length);
+		t -= k;
+		k = j;
+		j = i;
+	}
+	// 位置tまで前向き確率を求めた時点で、今後どのように分割されても必ず通る状態を探す
+	// 次の単語の長さは高々Lなので、今後の経路はt-L+1からtの間のいずれかの状態を通る
+	// それらの状態からバックポインタを辿り、全てが1つに合流すればそこまでの分割は確定する
+	bool Lattice::_viterbi_find_convergence_point(int t, int fixed_t, int &converged_t, int &converged_k, int &converged_j){
+		assert(t - _max_word_length + 1 > fixed_t);
+		std::vector<std::tuple<int, int, int>> states;
+		for(int u = t - _max_word_length + 1;u <= t;u++){
+			for(int k = 1;k <= std::min(u, _max_word_length);k++){
+				for(int j = (u - k == 0) ? 0 : 1;j <= std::min(u - k, _max_word_length);j++){
+					// 確定した分割と矛盾する状態は除外されている
+					if(_alpha(_viterbi_column(u), k, j) == -std::numeric_limits<double>::infinity()){
+						continue;
+					}
+					states.emplace_back(u, k, j);
+				}
+			}
+		}
+		assert(states.size() > 0);
+		// 最も後ろにある状態から順に1つ前へ戻し、重複を除く
+		while(states.size() > 1){
+			std::sort(states.begin(), states.end());
+			states.erase(std::unique(states.begin(), states.end()), states.end());
+			if(states.size() == 1){
+				break;
+			}
+			int max_t = std::get<0>(states.back());
+			if(max_t <= fixed_t){
+				return false;
+			}
+			for(auto &state: states){
+				if(std::get<0>(state) == max_t){
+					_viterbi_previous_state(std::get<0>(state), std::get<1>(state), std::get<2>(state));
+				}
+			}
+		}
+		std::tie(converged_t, converged_k, converged_j) = states[0];
+		return converged_t > fixed_t;
+	}
+	// リングバッファが一杯になっても合流しない場合
+	// 位置tで最も確率の高い状態からの経路上で、t-L以前にある最後の状態を確定させる
+	// それ以降の状態のうち確定した状態を通らないものは確率を0にする（近似）
+	void Lattice::_viterbi_force_convergence_point(Sentence* sentence, int t, int fixed_t, int &converged_t, int &converged_k, int &converged_j){
+		double max_log_p = 0;
+		int argmax_k = 0;
+		int argmax_j = 0;
+		for(int k = 1;k <= std::min(t, _max_word_length);k++){
+			for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, _max_word_length);j++){
+				double value = _alpha(_viterbi_column(t), k, j);
+				if(argmax_k == 0 || value > max_log_p){
+					max_log_p = value;
+					argmax_k = k;
+					argmax_j = j;
+				}
+			}
+		}
+		assert(argmax_k > 0);
+		converged_t = t;
+		converged_k = argmax_k;
+		converged_j = argmax_j;
+		while(converged_t > t - _max_word_length){
+			_viterbi_previous_state(converged_t, converged_k, converged_j);
+		}
+		assert(converged_t > fixed_t);
+		for(int u = t - _max_word_length + 1;u <= t;u++){
+			for(int k = 1;k <= std::min(u, _max_word_length);k++){
+				for(int j = (u - k == 0) ? 0 : 1;j <= std::min(u - k, _max_word_length);j++){
+					int state_t = u;
+					int state_k = k;
+					int state_j = j;
+					while(state_t > converged_t){
+						_viterbi_previous_state(state_t, state_k, state_j);
+					}
+					if(state_t != converged_t || state_k != converged_k || state_j != converged_j){
+						_alpha(_viterbi_column(u), k, j) = -std::numeric_limits<double>::infinity();
+					}
+				}
+			}
+			// 切り捨てた状態を3-gramの文脈がないiのまとめにも反映する
+			_enumerate_backoff_contexts(sentence, u, _alpha, true);
+		}
+	}
+	// 状態(t, k, j)から確定済みの位置fixed_tまで戻り、その間の単語をsegmentsに追加
+	void Lattice::_viterbi_append_segments(int t, int k, int j, int fixed_t, std::vector<int> &segments){
+		int num_segments = segments.size();
+		while(t > fixed_t){
+			segments.push_back(k);
+			_viterbi_previous_state(t, k, j);
+		}
+		assert(t == fixed_t);
+		reverse(segments.begin() + num_segments, segments.end());
+	}
+	// リングバッファを使うビタビアルゴリズム
+	// 前向き確率とバックポインタのメモリは文長によらずO(L^3)
+	void Lattice::_viterbi_decode_streaming(Sentence* sentence, std::vector<int> &segments){
+		assert(_viterbi_num_columns > 2 * _max_word_length + 2);
+		segments.clear();
+		_viterbi_num_forced = 0;
+		int fixed_t = 0;	// ここまでの分割は確定済み
+		int last_checked_t = 0;
+		int converged_t = 0;
+		int converged_k = 0;
+		int converged_j = 0;
+		for(int t = 1;t <= sentence->size();t++){
+			for(int k = 1;k <= std::min(t, _max_word_length);k++){
+				if(t - k == 0){
+					viterbi_argmax_alpha_t_k_j(sentence, t, k, 0);
+				}
+				for(int j = 1;j <= std::min(t - k, _max_word_length);j++){
+					viterbi_argmax_alpha_t_k_j(sentence, t, k, j);
+				}
+			}
+			_enumerate_backoff_contexts(sentence, t, _alpha, true);
+			if(t == sentence->size()){
+				break;
+			}
+			// 次の列を書き込むとt+1-R列目が消えるので、それより後ろまで確定させておく必要がある
+			bool ring_is_full = (t + 1 - _viterbi_num_columns >= fixed_t);
+			// 合流点はL文字ごとに探す
+			if(ring_is_full || (t - fixed_t >= _max_word_length && t - last_checked_t >= _max_word_length)){
+				last_checked_t = t;
+				if(_viterbi_find_convergence_point(t, fixed_t, converged_t, converged_k, converged_j)){
+					_viterbi_append_segments(converged_t, converged_k, converged_j, fixed_t, segments);
+					fixed_t = converged_t;
+				}
+				if(t + 1 - _viterbi_num_columns >= fixed_t){
+					_viterbi_force_convergence_point(sentence, t, fixed_t, converged_t, converged_k, converged_j);
+					_viterbi_num_forced += 1;
+					_viterbi_append_segments(converged_t, converged_k, converged_j, fixed_t, segments);
+					fixed_t = converged_t;
+				}
+			}
+		}
+		// <eos>から確定済みの位置まで戻る
+		int t = sentence->size();
+		int k = 0;
+		int j = 0;
+		viterbi_argmax_backward_k_and_j_to_eos(sentence, t, k, j);
+		_viterbi_append_segments(t, k, j, fixed_t, segments);
+	}
 	// ビタビアルゴリズムによる分割
 	// 決定的に分割が決まる
 	void Lattice::viterbi_decode(Sentence* sentence, std::vector<int> &segments){
 		assert(sentence->size() <= _max_sentence_length);
+		_viterbi_num_forced = 0;
+		if(_pure_crf_mode){
+			_enumerate_path_costs(sentence);
+			_viterbi_decode_linear_chain(sentence, segments);
+			return;
+		}
+		// 2-gramの格子はO(N・L)なのでリングバッファは使わない
+		if(get_bigram_mode()){
+			_clear_word_id_cache(sentence->size());
+			_enumerate_path_costs(sentence);
+			_enumerate_g0(sentence);
+			_viterbi_decode_bigram(sentence, segments);
+			return;
+		}
+		if(_viterbi_num_columns > 0){
+			_clear_word_id_cache(sentence->size());
+			_enumerate_path_costs(sentence);
+			_enumerate_g0(sentence);
+			_viterbi_decode_streaming(sentence, segments);
+			return;
+		}
 		int size = sentence->size() + 1;
 
 		#ifdef __DEBUG__
@@ -534,7 +1338,8 @@ namespace npycrf {
 		_alpha(0, 0, 0) = 0;
 		_scaling[0] = 1;
 		_clear_word_id_cache(sentence->size());
-		_clear_p_tkji(sentence->size());
+		_enumerate_path_costs(sentence);
+		_enumerate_g0(sentence);
 		viterbi_forward(sentence);
 		viterbi_backward(sentence, segments);
 	}
@@ -542,7 +1347,12 @@ namespace npycrf {
 	// use_scaling=trueならアンダーフローを防ぐ
 	double Lattice::compute_normalizing_constant(Sentence* sentence, bool use_scaling){
 		assert(sentence->size() <= _max_sentence_length);
+		if(_log_domain_mode || _pure_crf_mode || get_bigram_mode()){
+			return exp(compute_log_normalizing_constant(sentence, use_scaling));
+		}
 		_clear_word_id_cache(sentence->size());
+		_enumerate_path_costs(sentence);
+		_enumerate_g0(sentence);
 		_clear_p_tkji(sentence->size());
 		// 前向き確率を求める
 		_enumerate_forward_variables(sentence, _alpha, _pw_h_tkji, _p_transition_tkji, _scaling, use_scaling);
@@ -568,6 +1378,14 @@ namespace npycrf {
 	double Lattice::_compute_normalizing_constant_backward(Sentence* sentence, mat::tri<double> &beta, mat::quad<double> &p_transition_tkji){
 		assert(sentence->size() <= _max_sentence_length);
 		_clear_word_id_cache(sentence->size());
+		_enumerate_path_costs(sentence);
+		_enumerate_g0(sentence);
+		if(get_bigram_mode()){
+			// 遷移確率のキャッシュは前向き確率の計算時に作られる
+			_enumerate_forward_variables_bigram(sentence, _pw_h_tkj);
+			_enumerate_backward_variables_bigram(sentence);
+			return exp(_log_beta_tk(0, 0));
+		}
 		// 後向き確率を求める
 		_enumerate_backward_variables(sentence, beta, p_transition_tkji, _scaling, false);
 		double px = _beta(0, 1, 1);
@@ -577,8 +1395,24 @@ namespace npycrf {
 	// 文の可能な分割全てを考慮した文の確率（<eos>への接続を含む）
 	// use_scaling=trueならアンダーフローを防ぐ
 	double Lattice::compute_log_normalizing_constant(Sentence* sentence, bool use_scaling){
+		if(_pure_crf_mode){
+			_enumerate_path_costs(sentence);
+			return _compute_linear_chain_log_normalizing_constant(sentence);
+		}
+		if(get_bigram_mode()){
+			_clear_word_id_cache(sentence->size());
+			_enumerate_path_costs(sentence);
+			_enumerate_g0(sentence);
+			return _compute_log_normalizing_constant_bigram(sentence);
+		}
 		_clear_word_id_cache(sentence->size());
+		_enumerate_path_costs(sentence);
+		_enumerate_g0(sentence);
 		_clear_p_tkji(sentence->size());
+		if(_log_domain_mode){
+			_enumerate_forward_variables_log(sentence, _alpha, _pw_h_tkji, _p_transition_tkji);
+			return _compute_log_normalizing_constant_from_log_alpha(sentence, _alpha);
+		}
 		// 前向き確率を求める
 		_enumerate_forward_variables(sentence, _alpha, _pw_h_tkji, _p_transition_tkji, _scaling, use_scaling);
 		// <eos>へ到達する確率を全部足す
@@ -628,7 +1462,7 @@ namespace npycrf {
 				// CRFのポテンシャルはtとkのみで決まるため先に計算しておく
 				double crf_potential = 0;
 				if(_pure_npylm_mode == false){
-					crf_potential = _crf->compute_gamma(sentence, t - k + 1, t + 1);
+					crf_potential = _compute_gamma(sentence, t - k + 1, t + 1);
 				}
 				for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, _max_word_length);j++){
 					_sum_alpha_t_k_j(sentence, t, k, j, alpha, pw_h_tkji, p_transition_tkji, prod_scaling, crf_potential);
@@ -651,15 +1485,13 @@ namespace npycrf {
 					}
 				}
 			}
+			_enumerate_backoff_contexts(sentence, t, alpha, false);
 		}
 		// <eos>への接続を考える
 		double alpha_eos = 0;
 		int t = sentence->size() + 1; // <eos>を指す
 		int k = 1;	// ここでは<eos>の長さを1と考える
-		wchar_t const* characters = sentence->_characters;
-		array<int> &character_ids = sentence->_character_ids;
-		int character_ids_length = sentence->size();
-		double potential = (_pure_npylm_mode == true) ? 0 : _crf->compute_gamma(sentence, t, t + 1);
+		double potential = (_pure_npylm_mode == true) ? 0 : _compute_gamma(sentence, t, t + 1);
 		// double potential = 0;
 		for(int j = 1;j <= std::min(t - k, _max_word_length);j++){
 			double sum_prob = 0;
@@ -668,10 +1500,7 @@ namespace npycrf {
 				if(_pure_crf_mode){
 					p_transition = exp(potential);
 				}else{
-					_word_ids[0] = get_substring_word_id_at_t_k(sentence, t - k - j, i);
-					_word_ids[1] = get_substring_word_id_at_t_k(sentence, t - k, j);
-					_word_ids[2] = SPECIAL_CHARACTER_END;
-					double pw_h = _npylm->compute_p_w_given_h(character_ids, characters, character_ids_length, _word_ids, 3, 2);
+					double pw_h = _compute_p_w_given_h(sentence, t - k, j, i, SPECIAL_CHARACTER_END, -1, -1);
 					assert(pw_h > 0);
 					p_transition = (_pure_npylm_mode) ? pw_h : exp(_lambda_0() * log(pw_h) + potential);
 					pw_h_tkji(t, k, j, i) = pw_h;
@@ -704,13 +1533,9 @@ namespace npycrf {
 		// }
 		// <eos>への接続を考える
 		int t = sentence->size();
-		wchar_t const* characters = sentence->_characters;
-		array<int> &character_ids = sentence->_character_ids;
-		int character_ids_length = sentence->size();
-		double potential = (_pure_npylm_mode == true) ? 0 : _crf->compute_gamma(sentence, t + 1, t + 2);
+		double potential = (_pure_npylm_mode == true) ? 0 : _compute_gamma(sentence, t + 1, t + 2);
 		// double potential = 0;
 		for(int k = 1;k <= std::min(t, _max_word_length);k++){
-			id word_k_id = get_substring_word_id_at_t_k(sentence, t, k);
 			for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, _max_word_length);j++){
 				double p_transition = 0;
 				if(_pure_crf_mode){
@@ -720,18 +1545,15 @@ namespace npycrf {
 						p_transition = p_transition_tkji(t + 1, 1, k, j);
 						#ifdef __DEBUG__
 							_word_ids[0] = get_substring_word_id_at_t_k(sentence, t - k, j);
-							_word_ids[1] = word_k_id;
+							_word_ids[1] = get_substring_word_id_at_t_k(sentence, t, k);
 							_word_ids[2] = SPECIAL_CHARACTER_END;
-							double _pw_h = _npylm->compute_p_w_given_h(character_ids, characters, character_ids_length, _word_ids, 3, 2);
+							double _pw_h = _npylm->compute_p_w_given_h(sentence->_character_ids, sentence->_characters, sentence->size(), _word_ids, 3, 2, -1, -1, _hpylm_parent_pw_cache, _g0_tk);
 							assert(_pw_h > 0);
 							double _p_transition = exp(_lambda_0() * log(_pw_h) + potential);
 							assert(p_transition == _p_transition);
 						#endif 
 					}else{
-						_word_ids[0] = get_substring_word_id_at_t_k(sentence, t - k, j);
-						_word_ids[1] = word_k_id;
-						_word_ids[2] = SPECIAL_CHARACTER_END;
-						double pw_h = _npylm->compute_p_w_given_h(character_ids, characters, character_ids_length, _word_ids, 3, 2);
+						double pw_h = _compute_p_w_given_h(sentence, t, k, j, SPECIAL_CHARACTER_END, -1, -1);
 						assert(pw_h > 0);
 						p_transition = (_pure_npylm_mode) ? pw_h : exp(_lambda_0() * log(pw_h) + potential);
 					}
@@ -765,16 +1587,13 @@ namespace npycrf {
 			double p_transition = 0;
 			double potential = 0;
 			if(_pure_crf_mode){
-				potential = _crf->compute_gamma(sentence, 1, i + 1);
+				potential = _compute_gamma(sentence, 1, i + 1);
 				p_transition = exp(potential);
 			}else{
 				if(_pure_npylm_mode == false){
-					potential = _crf->compute_gamma(sentence, 1, i + 1);
+					potential = _compute_gamma(sentence, 1, i + 1);
 				}
-				_word_ids[0] = SPECIAL_CHARACTER_BEGIN;
-				_word_ids[1] = SPECIAL_CHARACTER_BEGIN;
-				_word_ids[2] = get_substring_word_id_at_t_k(sentence, i, i);
-				double pw_h = _npylm->compute_p_w_given_h(character_ids, characters, character_ids_length, _word_ids, 3, 2, 0, i - 1);
+				double pw_h = _compute_p_w_given_h(sentence, 0, 0, 0, get_substring_word_id_at_t_k(sentence, i, i), 0, i - 1);
 				assert(pw_h > 0);
 				p_transition = (_pure_npylm_mode) ? pw_h : exp(_lambda_0() * log(pw_h) + potential);
 			}
@@ -788,10 +1607,7 @@ namespace npycrf {
 	// pw_h_tkjiは前向き確率計算時にキャッシュされている（-1が入っている場合再計算する）
 	void Lattice::_sum_beta_t_k_j(Sentence* sentence, int t, int k, int j, mat::tri<double> &beta, mat::quad<double> &p_transition_tkji, array<double> &scaling, bool use_scaling){
 		id word_k_id = get_substring_word_id_at_t_k(sentence, t, k);
-		wchar_t const* characters = sentence->_characters;
-		array<int> &character_ids = sentence->_character_ids;
-		int character_ids_length = sentence->size();
-		assert(1 <= t && t <= character_ids_length);
+		assert(1 <= t && t <= sentence->size());
 		assert(1 <= k && k <= _max_word_length);
 		assert(0 <= j && j <= _max_word_length);
 		assert(t - k >= 0);
@@ -811,16 +1627,16 @@ namespace npycrf {
 			double p_transition = 0;
 			double potential = 0;
 			if(_pure_crf_mode){
-				potential = _crf->compute_gamma(sentence, t + 1, t + i + 1);
+				potential = _compute_gamma(sentence, t + 1, t + i + 1);
 				p_transition = exp(potential);
 			}else{
 				if(_pure_npylm_mode == false){
-					potential = _crf->compute_gamma(sentence, t + 1, t + i + 1);
+					potential = _compute_gamma(sentence, t + 1, t + i + 1);
 				}
 				if(p_transition_tkji(t + i, i, k, j) > 0){
 					p_transition = p_transition_tkji(t + i, i, k, j);
 				}else{
-					double pw_h = _npylm->compute_p_w_given_h(character_ids, characters, character_ids_length, _word_ids, 3, 2, t, t + i - 1);
+					double pw_h = _compute_p_w_given_h(sentence, t, k, j, word_i_id, t, t + i - 1);
 					assert(pw_h > 0);
 					p_transition = (_pure_npylm_mode) ? pw_h : exp(_lambda_0() * log(pw_h) + potential);
 				}
@@ -833,7 +1649,7 @@ namespace npycrf {
 			#ifdef __DEBUG__
 				if(_pure_crf_mode == false){
 					if(p_transition_tkji(t + i, i, k, j) > 0){
-						double pw_h = _npylm->compute_p_w_given_h(character_ids, characters, character_ids_length, _word_ids, 3, 2, t, t + i - 1);
+						double pw_h = _npylm->compute_p_w_given_h(sentence->_character_ids, sentence->_characters, sentence->size(), _word_ids, 3, 2, t, t + i - 1, _hpylm_parent_pw_cache, _g0_tk);
 						assert(pw_h > 0);
 						double p_transition = exp(_lambda_0() * log(pw_h) + potential);
 						assert(p_transition == p_transition_tkji(t + i, i, k, j));
@@ -856,6 +1672,243 @@ namespace npycrf {
 		beta(t, k, j) = sum;
 		return;
 	}
+	// 対数領域での前向き確率
+	// alpha(t, k, j)の代わりにlog(alpha(t, k, j))を求める
+	// スケーリングせずにアンダーフローを防げる
+	void Lattice::_sum_log_alpha_t_k_j(Sentence* sentence, int t, int k, int j, mat::tri<double> &log_alpha, mat::quad<double> &pw_h_tkji, mat::quad<double> &log_p_transition_tkji, double crf_potential){
+		id word_k_id = get_substring_word_id_at_t_k(sentence, t, k);
+		assert(t <= _max_sentence_length + 1);
+		assert(k <= _max_word_length);
+		assert(j <= _max_word_length);
+		assert(t - k >= 0);
+		// <bos>から生成されている場合
+		if(j == 0){
+			double log_p_transition = crf_potential;
+			if(_pure_crf_mode == false){
+				double pw_h = _compute_p_w_given_h(sentence, 0, 0, 0, word_k_id, t - k, t - 1);
+				assert(pw_h > 0);
+				log_p_transition = (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + crf_potential;
+				pw_h_tkji(t, k, 0, 0) = pw_h;
+				log_p_transition_tkji(t, k, 0, 0) = log_p_transition;
+			}
+			log_alpha(t, k, 0) = log_p_transition;
+			return;
+		}
+		// i=0に相当
+		if(t - k - j == 0){
+			double log_p_transition = crf_potential;
+			if(_pure_crf_mode == false){
+				double pw_h = _compute_p_w_given_h(sentence, t - k, j, 0, word_k_id, t - k, t - 1);
+				assert(pw_h > 0);
+				log_p_transition = (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + crf_potential;
+				pw_h_tkji(t, k, j, 0) = pw_h;
+				log_p_transition_tkji(t, k, j, 0) = log_p_transition;
+			}
+			log_alpha(t, k, j) = log_p_transition + log_alpha(t - k, j, 0);
+			return;
+		}
+		// それ以外の場合は周辺化
+		// 文脈(w_i, w_j)のノードがない場合の確率は1度だけ計算し、まとめたalphaに足す
+		// 各項をバッファに書き込んでからまとめてlogsumexp
+		int s = t - k;
+		double* log_p_transition_i = log_p_transition_tkji.row(t, k, j);
+		int num_terms = 0;
+		int* context_i = _context_i.row(s, j);
+		for(int n = 0;n < _num_context_i(s, j);n++){
+			int i = context_i[n];
+			double pw_h = _compute_p_w_given_h(sentence, s, j, i, word_k_id, s, t - 1);
+			assert(pw_h > 0);
+			pw_h_tkji(t, k, j, i) = pw_h;
+			log_p_transition_i[i] = (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + crf_potential;
+			_log_sum_buffer[num_terms] = log_p_transition_i[i] + log_alpha(s, j, i);
+			num_terms++;
+		}
+		int backoff_i = _backoff_i(s, j);
+		if(backoff_i > 0){
+			if(_pure_crf_mode){
+				log_p_transition_i[backoff_i] = crf_potential;
+			}else{
+				double pw_h = _compute_p_w_given_h(sentence, s, j, backoff_i, word_k_id, s, t - 1);
+				assert(pw_h > 0);
+				pw_h_tkji(t, k, j, backoff_i) = pw_h;
+				log_p_transition_i[backoff_i] = (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + crf_potential;
+			}
+			_log_sum_buffer[num_terms] = log_p_transition_i[backoff_i] + _backoff_alpha(s, j);
+			num_terms++;
+		}
+		log_alpha(t, k, j) = logsumexp(&_log_sum_buffer[0], 0, num_terms - 1);
+	}
+	void Lattice::_enumerate_forward_variables_log(Sentence* sentence, mat::tri<double> &log_alpha, mat::quad<double> &pw_h_tkji, mat::quad<double> &log_p_transition_tkji){
+		assert(sentence->size() <= _max_sentence_length);
+		log_alpha(0, 0, 0) = 0;
+		for(int t = 1;t <= sentence->size();t++){
+			for(int k = 1;k <= std::min(t, _max_word_length);k++){
+				// CRFのポテンシャルはtとkのみで決まるため先に計算しておく
+				double crf_potential = 0;
+				if(_pure_npylm_mode == false){
+					crf_potential = _compute_gamma(sentence, t - k + 1, t + 1);
+				}
+				for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, _max_word_length);j++){
+					_sum_log_alpha_t_k_j(sentence, t, k, j, log_alpha, pw_h_tkji, log_p_transition_tkji, crf_potential);
+				}
+			}
+			_enumerate_backoff_contexts(sentence, t, log_alpha, false);
+		}
+		// <eos>への接続を考える
+		int t = sentence->size() + 1; // <eos>を指す
+		int k = 1;	// ここでは<eos>の長さを1と考える
+		double potential = (_pure_npylm_mode == true) ? 0 : _compute_gamma(sentence, t, t + 1);
+		for(int j = 1;j <= std::min(t - k, _max_word_length);j++){
+			int start_i = (t - k - j == 0) ? 0 : 1;
+			int limit_i = std::min(t - k - j, _max_word_length);
+			double* log_p_transition_i = log_p_transition_tkji.row(t, k, j);
+			for(int i = start_i;i <= limit_i;i++){
+				if(_pure_crf_mode){
+					log_p_transition_i[i] = potential;
+					continue;
+				}
+				double pw_h = _compute_p_w_given_h(sentence, t - k, j, i, SPECIAL_CHARACTER_END, -1, -1);
+				assert(pw_h > 0);
+				pw_h_tkji(t, k, j, i) = pw_h;
+				log_p_transition_i[i] = (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + potential;
+			}
+			log_alpha(t, k, j) = logsumexp(log_p_transition_i, log_alpha.row(t - k, j), start_i, limit_i);
+		}
+	}
+	// <eos>へ到達する確率を全部足す
+	double Lattice::_compute_log_normalizing_constant_from_log_alpha(Sentence* sentence, mat::tri<double> &log_alpha){
+		int t = sentence->size() + 1;	// <eos>
+		int k = 1;	// <eos>の長さは1
+		return logsumexp(log_alpha.row(t, k), 1, std::min(t - k, _max_word_length));
+	}
+	// 対数領域での後向き確率
+	// pw_h_tkjiが正なら前向き計算時にlog_p_transition_tkjiがキャッシュされている
+	void Lattice::_enumerate_backward_variables_log(Sentence* sentence, mat::tri<double> &log_beta, mat::quad<double> &pw_h_tkji, mat::quad<double> &log_p_transition_tkji){
+		assert(sentence->size() <= _max_sentence_length);
+		// <eos>への接続を考える
+		int t = sentence->size();
+		double potential = (_pure_npylm_mode == true) ? 0 : _compute_gamma(sentence, t + 1, t + 2);
+		for(int k = 1;k <= std::min(t, _max_word_length);k++){
+			for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, _max_word_length);j++){
+				double log_p_transition = potential;
+				if(_pure_crf_mode == false){
+					if(pw_h_tkji(t + 1, 1, k, j) > 0){
+						log_p_transition = log_p_transition_tkji(t + 1, 1, k, j);
+					}else{
+						double pw_h = _compute_p_w_given_h(sentence, t, k, j, SPECIAL_CHARACTER_END, -1, -1);
+						assert(pw_h > 0);
+						log_p_transition = (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + potential;
+					}
+				}
+				log_beta(t, k, j) = log_p_transition;
+			}
+		}
+		// それ以外の場合
+		for(int t = sentence->size() - 1;t >= 1;t--){
+			for(int k = 1;k <= std::min(t, _max_word_length);k++){
+				for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, _max_word_length);j++){
+					_sum_log_beta_t_k_j(sentence, t, k, j, log_beta, pw_h_tkji, log_p_transition_tkji);
+				}
+			}
+		}
+		// t=0, k=1, j=1
+		// <bos>2つが文脈になる
+		int limit_i = std::min(sentence->size(), _max_word_length);
+		for(int i = 1;i <= limit_i;i++){
+			double log_p_transition = 0;
+			double potential = 0;
+			if(_pure_npylm_mode == false){
+				potential = _compute_gamma(sentence, 1, i + 1);
+			}
+			if(_pure_crf_mode){
+				log_p_transition = potential;
+			}else{
+				double pw_h = _compute_p_w_given_h(sentence, 0, 0, 0, get_substring_word_id_at_t_k(sentence, i, i), 0, i - 1);
+				assert(pw_h > 0);
+				log_p_transition = (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + potential;
+			}
+			_log_sum_buffer[i] = log_p_transition + log_beta(i, i, 0);
+		}
+		log_beta(0, 1, 1) = logsumexp(&_log_sum_buffer[0], 1, limit_i);
+	}
+	void Lattice::_sum_log_beta_t_k_j(Sentence* sentence, int t, int k, int j, mat::tri<double> &log_beta, mat::quad<double> &pw_h_tkji, mat::quad<double> &log_p_transition_tkji){
+		assert(1 <= t && t <= sentence->size());
+		assert(1 <= k && k <= _max_word_length);
+		assert(0 <= j && j <= _max_word_length);
+		assert(t - k >= 0);
+		assert(t < sentence->size());
+		int limit_i = std::min(sentence->size() - t, _max_word_length);
+		for(int i = 1;i <= limit_i;i++){
+			double log_p_transition = 0;
+			if(_pure_crf_mode){
+				log_p_transition = _compute_gamma(sentence, t + 1, t + i + 1);
+			}else if(pw_h_tkji(t + i, i, k, j) > 0){
+				log_p_transition = log_p_transition_tkji(t + i, i, k, j);
+			}else{
+				double potential = 0;
+				if(_pure_npylm_mode == false){
+					potential = _compute_gamma(sentence, t + 1, t + i + 1);
+				}
+				double pw_h = _compute_p_w_given_h(sentence, t, k, j, get_substring_word_id_at_t_k(sentence, t + i, i), t, t + i - 1);
+				assert(pw_h > 0);
+				log_p_transition = (_pure_npylm_mode) ? log(pw_h) : _lambda_0() * log(pw_h) + potential;
+			}
+			_log_sum_buffer[i] = log_p_transition + log_beta(t + i, i, k);
+		}
+		log_beta(t, k, j) = logsumexp(&_log_sum_buffer[0], 1, limit_i);
+	}
+	// 文の部分文字列が単語になる確率
+	// 対数の前向き・後向き確率から求める
+	void Lattice::_enumerate_marginal_p_substring_given_sentence_log(mat::bi<double> &pc_s, int sentence_length, mat::tri<double> &log_alpha, mat::tri<double> &log_beta, double log_Zs){
+		assert(sentence_length <= _max_sentence_length);
+		for(int t = 1;t <= sentence_length;t++){
+			for(int k = 1;k <= std::min(t, _max_word_length);k++){
+				// jを網羅する
+				int start_j = (t - k == 0) ? 0 : 1;
+				int limit_j = std::min(t - k, _max_word_length);
+				double sum_probability = exp(logsumexp(log_alpha.row(t, k), log_beta.row(t, k), start_j, limit_j) - log_Zs);
+				if(sum_probability > 1){	// 多少の誤差は丸める
+					assert(sum_probability - 1 < 1e-12);
+					sum_probability = 1;
+				}
+				assert(0 < sum_probability && sum_probability <= 1);
+				pc_s(t, k) = sum_probability;
+			}
+		}
+	}
+	void Lattice::_enumerate_marginal_p_trigram_given_sentence_log(Sentence* sentence, mat::quad<double> &p_conc, mat::tri<double> &log_alpha, mat::tri<double> &log_beta, mat::quad<double> &log_p_transition_tkji, double log_Zs){
+		assert(_pure_crf_mode == false);
+		for(int t = 1;t <= sentence->size();t++){
+			for(int k = 1;k <= std::min(t, _max_word_length);k++){
+				for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, _max_word_length);j++){
+					double log_beta_t_k_j = log_beta(t, k, j) - log_Zs;
+					double const* log_alpha_i = log_alpha.row(t - k, j);
+					double const* log_p_transition_i = log_p_transition_tkji.row(t, k, j);
+					double* p_conc_i = p_conc.row(t, k, j);
+					for(int i = (t - k - j == 0) ? 0 : 1;i <= std::min(t - k - j, _max_word_length);i++){
+						double marginal_p = exp(log_alpha_i[i] + log_p_transition_i[i] + log_beta_t_k_j);
+						if(marginal_p > 1){		// 多少の誤差は丸める
+							assert(marginal_p - 1 < 1e-12);
+							marginal_p = 1;
+						}
+						p_conc_i[i] = marginal_p;
+					}
+				}
+			}
+		}
+		int t = sentence->size() + 1;
+		int k = 1;
+		for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, _max_word_length);j++){
+			for(int i = (t - k - j == 0) ? 0 : 1;i <= std::min(t - k - j, _max_word_length);i++){
+				double marginal_p = exp(log_alpha(t - k, j, i) + log_p_transition_tkji(t, k, j, i) - log_Zs);
+				if(marginal_p > 1){		// 多少の誤差は丸める
+					assert(marginal_p - 1 < 1e-12);
+					marginal_p = 1;
+				}
+				p_conc(t, k, j, i) = marginal_p;
+			}
+		}
+	}
 	// 文の部分文字列が単語になる確率
 	// P_{CONC}(c_{t-k}^t|x)
 	void Lattice::_enumerate_marginal_p_substring_given_sentence(mat::bi<double> &pc_s, int sentence_length, mat::tri<double> &alpha, mat::tri<double> &beta){
@@ -888,13 +1941,25 @@ namespace npycrf {
 	}
 	// Pconc(c^{t-k-j}_{t-k-j-i+1}, c^{t-k}_{t-k-j+1}, c^t_{t-k+1}|x)の計算
 	void Lattice::enumerate_marginal_p_trigram_given_sentence(Sentence* sentence, mat::quad<double> &p_conc_tkji, mat::quad<double> &pw_h_tkji, bool use_scaling){
+		assert(get_bigram_mode() == false);
 		reserve(_max_word_length, sentence->size());
 		_clear_word_id_cache(sentence->size());
+		_enumerate_path_costs(sentence);
+		_enumerate_g0(sentence);
 		_clear_p_tkji(sentence->size());
+		if(_log_domain_mode){
+			_enumerate_forward_variables_log(sentence, _alpha, pw_h_tkji, _p_transition_tkji);
+			_fill_backoff_transitions(sentence, pw_h_tkji, _p_transition_tkji);
+			_enumerate_backward_variables_log(sentence, _beta, pw_h_tkji, _p_transition_tkji);
+			double log_Zs = _compute_log_normalizing_constant_from_log_alpha(sentence, _alpha);
+			_enumerate_marginal_p_trigram_given_sentence_log(sentence, p_conc_tkji, _alpha, _beta, _p_transition_tkji, log_Zs);
+			return;
+		}
 		_enumerate_forward_variables(sentence, _alpha, pw_h_tkji, _p_transition_tkji, _scaling, use_scaling);
+		_fill_backoff_transitions(sentence, pw_h_tkji, _p_transition_tkji);
 		_enumerate_backward_variables(sentence, _beta, _p_transition_tkji, _scaling, use_scaling);
 		_enumerate_marginal_p_trigram_given_sentence(sentence, p_conc_tkji, _alpha, _beta, _p_transition_tkji, _scaling, use_scaling);
-	}	
+	}
 	void Lattice::_enumerate_marginal_p_trigram_given_sentence(Sentence* sentence, mat::quad<double> &p_conc, mat::tri<double> &alpha, mat::tri<double> &beta, mat::quad<double> &p_transition_tkji, array<double> &scaling, bool use_scaling){
 		assert(_pure_crf_mode == false);
 		for(int t = 1;t <= sentence->size();t++){
@@ -944,9 +2009,34 @@ namespace npycrf {
 	// p(z_t, z_{t+1}|s)の計算
 	void Lattice::enumerate_marginal_p_z_given_sentence(Sentence* sentence, mat::tri<double> &pz_s){
 		reserve(_max_word_length, sentence->size());
+		if(_pure_crf_mode){
+			_enumerate_path_costs(sentence);
+			_enumerate_marginal_p_z_given_sentence_linear_chain(sentence, pz_s);
+			return;
+		}
 		_clear_word_id_cache(sentence->size());
+		_enumerate_path_costs(sentence);
+		_enumerate_g0(sentence);
+		if(get_bigram_mode()){
+			_enumerate_forward_variables_bigram(sentence, _pw_h_tkj);
+			_enumerate_backward_variables_bigram(sentence);
+			double log_Zs = _log_alpha_tk(sentence->size() + 1, 1);
+			_enumerate_marginal_p_substring_given_sentence_bigram(_pc_s, sentence->size(), log_Zs);
+			_enumerate_marginal_p_z_given_sentence_using_p_substring(pz_s, sentence->size(), _pc_s);
+			return;
+		}
 		_clear_p_tkji(sentence->size());
+		if(_log_domain_mode){
+			_enumerate_forward_variables_log(sentence, _alpha, _pw_h_tkji, _p_transition_tkji);
+			_fill_backoff_transitions(sentence, _pw_h_tkji, _p_transition_tkji);
+			_enumerate_backward_variables_log(sentence, _beta, _pw_h_tkji, _p_transition_tkji);
+			double log_Zs = _compute_log_normalizing_constant_from_log_alpha(sentence, _alpha);
+			_enumerate_marginal_p_substring_given_sentence_log(_pc_s, sentence->size(), _alpha, _beta, log_Zs);
+			_enumerate_marginal_p_z_given_sentence_using_p_substring(pz_s, sentence->size(), _pc_s);
+			return;
+		}
 		_enumerate_forward_variables(sentence, _alpha, _pw_h_tkji, _p_transition_tkji, _scaling, true);
+		_fill_backoff_transitions(sentence, _pw_h_tkji, _p_transition_tkji);
 		_enumerate_backward_variables(sentence, _beta, _p_transition_tkji, _scaling, true);
 		_enumerate_marginal_p_z_given_sentence(sentence, pz_s, _alpha, _beta);
 	}
@@ -955,15 +2045,47 @@ namespace npycrf {
 		_enumerate_marginal_p_z_given_sentence_using_p_substring(pz_s, sentence->size(), _pc_s);
 	}
 	void Lattice::enumerate_marginal_p_z_and_trigram_given_sentence(Sentence* sentence, mat::quad<double> &p_conc_tkji, mat::quad<double> &pw_h_tkji, mat::tri<double> &pz_s){
+		assert(get_bigram_mode() == false);
 		reserve(_max_word_length, sentence->size());
 		_clear_word_id_cache(sentence->size());
+		_enumerate_path_costs(sentence);
+		_enumerate_g0(sentence);
 		_p_transition_tkji.fill(-1, sentence->size());
 		pw_h_tkji.fill(-1, sentence->size());
+		if(_log_domain_mode){
+			_enumerate_forward_variables_log(sentence, _alpha, pw_h_tkji, _p_transition_tkji);
+			_fill_backoff_transitions(sentence, pw_h_tkji, _p_transition_tkji);
+			_enumerate_backward_variables_log(sentence, _beta, pw_h_tkji, _p_transition_tkji);
+			double log_Zs = _compute_log_normalizing_constant_from_log_alpha(sentence, _alpha);
+			_enumerate_marginal_p_substring_given_sentence_log(_pc_s, sentence->size(), _alpha, _beta, log_Zs);
+			_enumerate_marginal_p_z_given_sentence_using_p_substring(pz_s, sentence->size(), _pc_s);
+			_enumerate_marginal_p_trigram_given_sentence_log(sentence, p_conc_tkji, _alpha, _beta, _p_transition_tkji, log_Zs);
+			return;
+		}
 		_enumerate_forward_variables(sentence, _alpha, pw_h_tkji, _p_transition_tkji, _scaling, true);
+		_fill_backoff_transitions(sentence, pw_h_tkji, _p_transition_tkji);
 		_enumerate_backward_variables(sentence, _beta, _p_transition_tkji, _scaling, true);
 		_enumerate_marginal_p_z_given_sentence(sentence, pz_s, _alpha, _beta);
 		_enumerate_marginal_p_trigram_given_sentence(sentence, p_conc_tkji, _alpha, _beta, _p_transition_tkji, _scaling, true);
 	}
+	// 2-gramのNPYLMの場合のp(z_t, z_{t+1}|s)とPconc(c^{t-k}_{t-k-j+1}, c^t_{t-k+1}|x)
+	// pw_h_tkjには\lambda_0の勾配計算に使うNPYLM単体の遷移確率が入る
+	void Lattice::enumerate_marginal_p_z_and_bigram_given_sentence(Sentence* sentence, mat::tri<double> &p_conc_tkj, mat::tri<double> &pw_h_tkj, mat::tri<double> &pz_s){
+		assert(get_bigram_mode());
+		reserve(_max_word_length, sentence->size());
+		_clear_word_id_cache(sentence->size());
+		_enumerate_path_costs(sentence);
+		_enumerate_g0(sentence);
+		_enumerate_forward_variables_bigram(sentence, pw_h_tkj);
+		_enumerate_backward_variables_bigram(sentence);
+		double log_Zs = _log_alpha_tk(sentence->size() + 1, 1);
+		#ifdef __DEBUG__
+			assert(std::abs(log_Zs - _log_beta_tk(0, 0)) < 1e-8);
+		#endif
+		_enumerate_marginal_p_substring_given_sentence_bigram(_pc_s, sentence->size(), log_Zs);
+		_enumerate_marginal_p_z_given_sentence_using_p_substring(pz_s, sentence->size(), _pc_s);
+		_enumerate_marginal_p_bigram_given_sentence(sentence, p_conc_tkj, log_Zs);
+	}
 	// p(z_t, z_{t+1}|s)の計算
 	// Zsは統合モデル上での文の確率
 	void Lattice::_enumerate_marginal_p_z_given_sentence_using_p_substring(mat::tri<double> &pz_s, int sentence_length, mat::bi<double> &pc_s){
@@ -1059,12 +2181,26 @@ namespace npycrf {
 		}
 		return p_0_0;
 	}
+	// ビタビアルゴリズムのみの場合は学習用のテーブルを解放しているので、それ以外の計算はできない
+	// -DNDEBUGでも範囲外に書き込まないように例外を投げる
+	void Lattice::_check_training_tables(){
+		if(_viterbi_only_mode){
+			throw std::runtime_error("Lattice: the normalizing constant, marginals and sampling are not available in viterbi-only mode. Call set_viterbi_only_mode(false) first.");
+		}
+	}
 	void Lattice::_clear_p_tkji(int N){
+		_check_training_tables();
 		_p_transition_tkji.fill(-1, N + 1);
 		_pw_h_tkji.fill(-1, N + 1);
 	}
 	void Lattice::_clear_word_id_cache(int N){
 		_substring_word_id_cache.fill(0, N + 1);
+		// g0も部分文字列ごとのキャッシュなので文が変わったら消す
+		_g0_tk.fill(-1, N + 1);
+		// 文脈ノードもHPYLMが変わる可能性があるので文ごとに消す
+		if(_viterbi_window == 0){
+			_context_node_cache.fill(NULL, N + 1);
+		}
 	}
 	
 } // namespace npylm
\ No newline at end of file
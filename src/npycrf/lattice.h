@@ -1,5 +1,6 @@
 #pragma once
 #include <vector>
+#include <random>
 #include "common.h"
 #include "array.h"
 #include "array.h"
@@ -11,27 +12,91 @@ namespace npycrf {
 	private:
 		bool _pure_crf_mode;	// NPYLMを無視
 		bool _pure_npylm_mode;	// CRFを無視
+		bool _log_domain_mode;	// 前向き・後向き確率を対数で持つ（アンダーフローしないがスケーリングより速くはない）
+		bool _viterbi_only_mode;	// ビタビアルゴリズムに必要なテーブルのみ確保
+		int _viterbi_window;		// 0以外ならビタビアルゴリズムの前向き確率をこの列数のリングバッファに置く
+		int _viterbi_num_columns;	// 実際に確保した列数
+		std::mt19937* _mt;			// 後ろ向きサンプリングの乱数. NULLならsampler::mtを使う
 		void _allocate_capacity(int max_word_length, int max_sentence_length);
 		void _sum_alpha_t_k_j(Sentence* sentence, int t, int k, int j, mat::tri<double> &alpha, mat::quad<double> &pw_h_tkji, mat::quad<double> &p_transition_tkji, double prod_scaling, double crf_potential);
 		void _sum_beta_t_k_j(Sentence* sentence, int t, int k, int j, mat::tri<double> &beta, mat::quad<double> &p_transition_tkji, npycrf::array<double> &scaling, bool use_scaling);
 		void _backward_sampling(Sentence* sentence, mat::tri<double> &alpha, mat::quad<double> &p_transition_tkji, std::vector<int> &segments);
 		void _sample_backward_k_and_j(Sentence* sentence, mat::tri<double> &alpha, mat::quad<double> &p_transition_tkji, int t, int next_word_length, int &sampled_k, int &sampled_j);
+		void _sum_log_alpha_t_k_j(Sentence* sentence, int t, int k, int j, mat::tri<double> &log_alpha, mat::quad<double> &pw_h_tkji, mat::quad<double> &log_p_transition_tkji, double crf_potential);
+		void _sum_log_beta_t_k_j(Sentence* sentence, int t, int k, int j, mat::tri<double> &log_beta, mat::quad<double> &pw_h_tkji, mat::quad<double> &log_p_transition_tkji);
 		double _lambda_0();
+		double _sample_uniform();
+		int _viterbi_column(int t);
+		void _viterbi_previous_state(int &t, int &k, int &j);
+		bool _viterbi_find_convergence_point(int t, int fixed_t, int &converged_t, int &converged_k, int &converged_j);
+		void _viterbi_force_convergence_point(Sentence* sentence, int t, int fixed_t, int &converged_t, int &converged_k, int &converged_j);
+		void _viterbi_append_segments(int t, int k, int j, int fixed_t, std::vector<int> &segments);
+		void _viterbi_decode_streaming(Sentence* sentence, std::vector<int> &segments);
+		void _enumerate_path_costs(Sentence* sentence);
+		void _enumerate_g0(Sentence* sentence);
+		double _compute_gamma(Sentence* sentence, int s, int t);
+		npylm::lm::Node<id>* _find_context_node(Sentence* sentence, int s, int j, int i);
+		double _compute_p_w_given_h(Sentence* sentence, int s, int j, int i, id word_id, int substr_char_t_start, int substr_char_t_end);
+		void _enumerate_backoff_contexts(Sentence* sentence, int s, mat::tri<double> &alpha, bool viterbi);
+		void _fill_backoff_transitions(Sentence* sentence, mat::quad<double> &pw_h_tkji, mat::quad<double> &p_transition_tkji);
+		double _get_p_transition(Sentence* sentence, mat::quad<double> &p_transition_tkji, int t, int k, int j, int i);
+		void _enumerate_linear_chain_forward_variables(Sentence* sentence);
+		void _enumerate_linear_chain_backward_variables(Sentence* sentence);
+		void _reserve_linear_chain_tables(bool backward);
+		double _compute_linear_chain_log_normalizing_constant(Sentence* sentence);
+		void _enumerate_marginal_p_z_given_sentence_linear_chain(Sentence* sentence, mat::tri<double> &pz_s);
+		void _viterbi_decode_linear_chain(Sentence* sentence, std::vector<int> &segments);
+		double _compute_log_p_transition_bigram(Sentence* sentence, int t, int k, int j, double crf_potential, double &pw_h);
+		void _enumerate_forward_variables_bigram(Sentence* sentence, mat::tri<double> &pw_h_tkj);
+		void _enumerate_backward_variables_bigram(Sentence* sentence);
+		double _compute_log_normalizing_constant_bigram(Sentence* sentence);
+		void _backward_sampling_bigram(Sentence* sentence, std::vector<int> &segments);
+		void _viterbi_decode_bigram(Sentence* sentence, std::vector<int> &segments);
+		void _enumerate_marginal_p_substring_given_sentence_bigram(mat::bi<double> &pc_s, int sentence_length, double log_Zs);
+		void _enumerate_marginal_p_bigram_given_sentence(Sentence* sentence, mat::tri<double> &p_conc_tkj, double log_Zs);
 	public:
 		npylm::NPYLM* _npylm;
 		crf::CRF* _crf;
+		// NPYLMの作業用配列
+		// モデル側には書き込まないため、Latticeごとに別スレッドで使える
 		array<id> _word_ids;			// 3-gram
+		array<double> _hpylm_parent_pw_cache;
+		mat::bi<double> _g0_tk;
 		mat::bi<id> _substring_word_id_cache;
+		mat::tri<npylm::lm::Node<id>*> _context_node_cache;	// 位置sの文脈(w_i, w_j)のHPYLMのノード
+		// 位置sで終わる長さjの単語について、文脈(w_i, w_j)の3-gramのノードがHPYLMにあるiとないiに分けたもの
+		// ないiは遷移確率がiによらないので、alpha(s, j, i)をまとめておけば次の単語の長さkによらず使い回せる
+		// ビタビアルゴリズムのリングバッファでは位置sの代わりに列の番号を使う
+		mat::bi<double> _backoff_alpha;	// ノードがないiについてのalpha(s, j, i)の和. 対数モードではlogsumexp、ビタビアルゴリズムでは最大値
+		mat::bi<int> _backoff_i;		// ノードがないiの代表. 最小のiで、ビタビアルゴリズムでは最大値をとるi. なければ0
+		mat::bi<int> _num_context_i;	// ノードがあるiの数
+		mat::tri<int> _context_i;		// ノードがあるi（昇順）
+		crf::Potentials* _potentials;	// CRFの各位置のパスのコスト. 文ごとに使い回す
+		int _potentials_serial;			// _potentialsを計算した文のSentence::_serial
 		mat::bi<double> _pc_s;			// 文の部分文字列が単語になる条件付き確率
-		mat::tri<double> _alpha;		// 前向き確率
-		mat::tri<double> _beta;			// 後向き確率
+		mat::tri<double> _alpha;		// 前向き確率. 対数モードでは対数が入る
+		mat::tri<double> _beta;			// 後向き確率. 対数モードでは対数が入る
 		mat::tri<double> _pz_s;			// Markov-CRFの周辺確率
 		mat::tri<int> _viterbi_backward;
+		int _viterbi_num_forced;		// 直前のビタビアルゴリズムで合流点を強制した回数. 0なら通常のビタビアルゴリズムと同じ分割になる
+		mat::bi<double> _chain_alpha;	// 純粋なCRFでの線形連鎖の(位置, 単語の途中までの長さ)の前向き確率の対数. ビタビアルゴリズムでは最大値が入る. 線形連鎖を使うまで確保しない
+		mat::bi<double> _chain_beta;	// 純粋なCRFでの線形連鎖の後向き確率の対数
+		array<int> _chain_backward;		// 純粋なCRFでのビタビアルゴリズムのバックポインタ（直前の単語の長さ）
 		mat::quad<double> _pw_h_tkji;	// n-gram確率のキャッシュ
-		mat::quad<double> _p_transition_tkji;	// exp(lamda_0 * p(・) + potential)のキャッシュ
+		mat::quad<double> _p_transition_tkji;	// exp(lamda_0 * p(・) + potential)のキャッシュ. 対数モードではexpしない値が入る
 		mat::quad<double> _p_conc_tkji;
 		array<double> _scaling;			// スケーリング係数
+		// 単語2-gramのNPYLM用の格子
+		// 状態は単語の終わりの位置tと長さkのみで、1つ前の単語の長さjについて周辺化する
+		// 遷移の数がO(N・L^2)なので値は常に対数で持つ
+		mat::bi<double> _log_alpha_tk;
+		mat::bi<double> _log_beta_tk;
+		mat::bi<int> _viterbi_backward_tk;
+		mat::tri<double> _pw_h_tkj;				// 2-gram確率のキャッシュ
+		mat::tri<double> _log_p_transition_tkj;	// lamda_0 * log p(・) + potentialのキャッシュ
+		mat::tri<double> _p_conc_tkj;			// 部分単語2-gramの周辺確率
 		array<double> _backward_sampling_table;
+		array<double> _log_sum_buffer;	// 対数モードでの和の計算用
 		int _max_word_length;
 		int _max_sentence_length;
 		Lattice(npylm::NPYLM* npylm, crf::CRF* crf);
@@ -40,7 +105,15 @@ namespace npycrf {
 		bool get_pure_crf_mode();
 		void set_pure_npylm_mode(bool enabled);
 		bool get_pure_npylm_mode();
+		void set_log_domain_mode(bool enabled);
+		bool get_log_domain_mode();
+		void set_viterbi_only_mode(bool enabled);
+		bool get_viterbi_only_mode();
+		void set_viterbi_window(int num_columns);
+		int get_viterbi_window();
 		void set_npycrf_mode();
+		bool get_bigram_mode();
+		void set_random_generator(std::mt19937* mt);
 		id get_substring_word_id_at_t_k(Sentence* sentence, int t, int k);
 		void reserve(int max_word_length, int max_sentence_length);
 		void forward_filtering(Sentence* sentence, bool use_scaling);
@@ -60,6 +133,7 @@ namespace npycrf {
 		void _enumerate_marginal_p_z_given_sentence(Sentence* sentence, mat::tri<double> &pz_s, mat::tri<double> &alpha, mat::tri<double> &beta);
 		void _enumerate_marginal_p_z_given_sentence_using_p_substring(mat::tri<double> &pz_s, int sentence_length, mat::bi<double> &pc_s);
 		void enumerate_marginal_p_z_and_trigram_given_sentence(Sentence* sentence, mat::quad<double> &p_conc_tkji, mat::quad<double> &pw_h_tkji, mat::tri<double> &pz_s);
+		void enumerate_marginal_p_z_and_bigram_given_sentence(Sentence* sentence, mat::tri<double> &p_conc_tkj, mat::tri<double> &pw_h_tkj, mat::tri<double> &pz_s);
 		double _compute_p_z_case_1_1(int sentence_length, int t, mat::bi<double> &pc_s);
 		double _compute_p_z_case_1_0(int sentence_length, int t, mat::bi<double> &pc_s);
 		double _compute_p_z_case_0_1(int sentence_length, int t, mat::bi<double> &pc_s);
@@ -67,6 +141,12 @@ namespace npycrf {
 		void _enumerate_marginal_p_substring_given_sentence(mat::bi<double> &pc_s, int sentence_length, mat::tri<double> &alpha, mat::tri<double> &beta);
 		void _enumerate_forward_variables(Sentence* sentence, mat::tri<double> &alpha, mat::quad<double> &pw_h_tkji, mat::quad<double> &p_transition_tkji, array<double> &scaling, bool use_scaling = true);
 		void _enumerate_backward_variables(Sentence* sentence, mat::tri<double> &beta, mat::quad<double> &p_transition_tkji, array<double> &scaling, bool use_scaling = true);
+		void _enumerate_forward_variables_log(Sentence* sentence, mat::tri<double> &log_alpha, mat::quad<double> &pw_h_tkji, mat::quad<double> &log_p_transition_tkji);
+		void _enumerate_backward_variables_log(Sentence* sentence, mat::tri<double> &log_beta, mat::quad<double> &pw_h_tkji, mat::quad<double> &log_p_transition_tkji);
+		double _compute_log_normalizing_constant_from_log_alpha(Sentence* sentence, mat::tri<double> &log_alpha);
+		void _enumerate_marginal_p_substring_given_sentence_log(mat::bi<double> &pc_s, int sentence_length, mat::tri<double> &log_alpha, mat::tri<double> &log_beta, double log_Zs);
+		void _enumerate_marginal_p_trigram_given_sentence_log(Sentence* sentence, mat::quad<double> &p_conc, mat::tri<double> &log_alpha, mat::tri<double> &log_beta, mat::quad<double> &log_p_transition_tkji, double log_Zs);
+		void _check_training_tables();
 		void _clear_p_tkji(int N);
 		void _clear_word_id_cache(int N);
 	};
@@ -0,0 +1,114 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <cassert>
+
+// 対数領域での和
+// 最大値を引いてからexpをとるのでオーバーフローしない
+// 行の和ではlibmのexpを呼ばずに多項式で計算し、4つの部分和に分けて足すので-O3 -march=native（AVX2以上）でSIMD命令になる
+
+namespace npycrf {
+	// x <= 0でのexp(x)
+	// 分岐と関数呼び出しがないのでループの中でベクトル化できる. 誤差は数ulp
+	// x < -708は-708に切り詰める. 和には最大値の項exp(0) = 1が含まれるので結果は変わらない
+	inline double exp_nonpositive(double x){
+		// 浮動小数点の比較は-ftrapping-mathのもとでベクトル化されないので、ビット列を整数として比べる
+		// 符号なし整数として見ると、負の数は絶対値が大きいほど大きく、+0は最も小さい
+		uint64_t bits;
+		std::memcpy(&bits, &x, sizeof(double));
+		const uint64_t min_bits = 0xC086200000000000ULL;	// -708.0
+		bits = (bits > min_bits) ? min_bits : bits;
+		std::memcpy(&x, &bits, sizeof(double));
+		// x = n*log2 + r, |r| <= log2/2
+		// 1.5*2^52を足すと仮数部の下位ビットにnが入る
+		const double shifter = 6755399441055744.0;
+		double t = x * 1.4426950408889634 + shifter;
+		double n = t - shifter;
+		double r = x - n * 6.93147180369123816490e-01;	// log2の上位ビット. n*log2_hiは丸められない
+		r = r - n * 1.90821492927058770002e-10;			// log2の下位ビット
+		// exp(r)のテイラー展開を13次まで
+		double p = 1.0 / 6227020800.0;
+		p = p * r + 1.0 / 479001600.0;
+		p = p * r + 1.0 / 39916800.0;
+		p = p * r + 1.0 / 3628800.0;
+		p = p * r + 1.0 / 362880.0;
+		p = p * r + 1.0 / 40320.0;
+		p = p * r + 1.0 / 5040.0;
+		p = p * r + 1.0 / 720.0;
+		p = p * r + 1.0 / 120.0;
+		p = p * r + 1.0 / 24.0;
+		p = p * r + 1.0 / 6.0;
+		p = p * r + 0.5;
+		p = p * r + 1.0;
+		p = p * r + 1.0;
+		// 2^nを指数部に直接書き込む
+		std::memcpy(&bits, &t, sizeof(double));
+		bits = (bits - 0x4338000000000000ULL + 1023) << 52;
+		double scale;
+		std::memcpy(&scale, &bits, sizeof(double));
+		return p * scale;
+	}
+	// log(exp(a) + exp(b))
+	inline double logaddexp(double a, double b){
+		if(a == -std::numeric_limits<double>::infinity()){
+			return b;
+		}
+		if(b == -std::numeric_limits<double>::infinity()){
+			return a;
+		}
+		if(a > b){
+			return a + log1p(exp(b - a));
+		}
+		return b + log1p(exp(a - b));
+	}
+	// log Σ_{i=start}^{end} exp(values[i])
+	// endを含む
+	inline double logsumexp(double const* __restrict__ values, int start, int end){
+		assert(start <= end);
+		double max_value = values[start];
+		for(int i = start + 1;i <= end;i++){
+			max_value = (values[i] > max_value) ? values[i] : max_value;
+		}
+		if(max_value == -std::numeric_limits<double>::infinity()){
+			return max_value;
+		}
+		double sum[4] = {0, 0, 0, 0};
+		int i = start;
+		for(;i + 3 <= end;i += 4){
+			for(int l = 0;l < 4;l++){
+				sum[l] += exp_nonpositive(values[i + l] - max_value);
+			}
+		}
+		for(;i <= end;i++){
+			sum[0] += exp_nonpositive(values[i] - max_value);
+		}
+		return max_value + log((sum[0] + sum[1]) + (sum[2] + sum[3]));
+	}
+	// log Σ_{i=start}^{end} exp(a[i] + b[i])
+	// endを含む
+	// 前向き確率ではa=遷移確率の対数、b=alpha(t-k, j, ・)の行になる
+	inline double logsumexp(double const* __restrict__ a, double const* __restrict__ b, int start, int end){
+		assert(start <= end);
+		double max_value = a[start] + b[start];
+		for(int i = start + 1;i <= end;i++){
+			double value = a[i] + b[i];
+			max_value = (value > max_value) ? value : max_value;
+		}
+		if(max_value == -std::numeric_limits<double>::infinity()){
+			return max_value;
+		}
+		double sum[4] = {0, 0, 0, 0};
+		int i = start;
+		for(;i + 3 <= end;i += 4){
+			for(int l = 0;l < 4;l++){
+				sum[l] += exp_nonpositive(a[i + l] + b[i + l] - max_value);
+			}
+		}
+		for(;i <= end;i++){
+			sum[0] += exp_nonpositive(a[i] + b[i] - max_value);
+		}
+		return max_value + log((sum[0] + sum[1]) + (sum[2] + sum[3]));
+	}
+}
@@ -0,0 +1,106 @@
+#include <cassert>
+#include <mutex>
+#include "g0_cache.h"
+
+namespace npycrf {
+	namespace npylm {
+		G0Cache::G0Cache(size_t capacity){
+			set_capacity(capacity);
+		}
+		G0Cache::Shard &G0Cache::_shard_of(id word_id){
+			// 単語IDは文字列のハッシュ値なので上位ビットで振り分ける
+			return _shards[(word_id >> 40) % G0_CACHE_NUM_SHARDS];
+		}
+		// 呼び出し側でシャードの排他ロックを取ること
+		void G0Cache::_reset_shard(Shard &shard, size_t capacity){
+			shard._capacity = (capacity + G0_CACHE_NUM_SHARDS - 1) / G0_CACHE_NUM_SHARDS;
+			shard._slot_of_word.clear();
+			shard._entries.clear();
+			shard._entries.shrink_to_fit();
+			shard._referenced.reset(new std::atomic<bool>[shard._capacity]());
+			shard._hand = 0;
+		}
+		bool G0Cache::find(id word_id, unsigned long long vpylm_version, double &pw){
+			Shard &shard = _shard_of(word_id);
+			std::shared_lock<std::shared_timed_mutex> lock(shard._mutex);
+			auto itr = shard._slot_of_word.find(word_id);
+			if(itr == shard._slot_of_word.end()){
+				return false;
+			}
+			int slot = itr->second;
+			Entry &entry = shard._entries[slot];
+			if(entry._vpylm_version != vpylm_version){
+				return false;
+			}
+			shard._referenced[slot].store(true, std::memory_order_relaxed);
+			pw = entry._pw;
+			return true;
+		}
+		void G0Cache::insert(id word_id, unsigned long long vpylm_version, double pw){
+			if(_capacity.load() == 0){
+				return;
+			}
+			Shard &shard = _shard_of(word_id);
+			std::lock_guard<std::shared_timed_mutex> lock(shard._mutex);
+			if(shard._capacity == 0){
+				return;
+			}
+			auto itr = shard._slot_of_word.find(word_id);
+			if(itr != shard._slot_of_word.end()){
+				// 古い値を上書き
+				int slot = itr->second;
+				Entry &entry = shard._entries[slot];
+				entry._pw = pw;
+				entry._vpylm_version = vpylm_version;
+				shard._referenced[slot].store(true, std::memory_order_relaxed);
+				return;
+			}
+			int slot = shard._entries.size();
+			if(slot < shard._capacity){
+				shard._entries.emplace_back();
+			}else{
+				// 参照ビットが立っていれば下ろして次へ進み、立っていないものを捨てる
+				while(true){
+					slot = shard._hand;
+					shard._hand = (shard._hand + 1) % shard._capacity;
+					if(shard._referenced[slot].exchange(false, std::memory_order_relaxed) == false){
+						break;
+					}
+				}
+				shard._slot_of_word.erase(shard._entries[slot]._word_id);
+			}
+			Entry &entry = shard._entries[slot];
+			entry._word_id = word_id;
+			entry._pw = pw;
+			entry._vpylm_version = vpylm_version;
+			shard._referenced[slot].store(false, std::memory_order_relaxed);
+			shard._slot_of_word[word_id] = slot;
+			assert(shard._slot_of_word.size() == shard._entries.size());
+		}
+		void G0Cache::clear(){
+			for(Shard &shard: _shards){
+				std::lock_guard<std::shared_timed_mutex> lock(shard._mutex);
+				_reset_shard(shard, _capacity.load());
+			}
+		}
+		// 容量を変えると中身は捨てる
+		void G0Cache::set_capacity(size_t capacity){
+			_capacity.store(capacity);
+			for(Shard &shard: _shards){
+				std::lock_guard<std::shared_timed_mutex> lock(shard._mutex);
+				_reset_shard(shard, capacity);
+			}
+		}
+		size_t G0Cache::get_capacity(){
+			return _capacity.load();
+		}
+		size_t G0Cache::size(){
+			size_t size = 0;
+			for(Shard &shard: _shards){
+				std::shared_lock<std::shared_timed_mutex> lock(shard._mutex);
+				size += shard._slot_of_word.size();
+			}
+			return size;
+		}
+	}
+}
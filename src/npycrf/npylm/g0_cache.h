@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <vector>
+#include "../common.h"
+
+#define G0_CACHE_NUM_SHARDS 64
+
+namespace npycrf {
+	namespace npylm {
+		// 単語IDからVPYLMによる単語の文字列の確率へのキャッシュ
+		// 文をまたいで使うため、計算したときのVPYLMの更新回数を一緒に記録し、違っていれば無効とみなす
+		// 複数スレッドから分割する場合も共有するので、単語IDで振り分けたシャードごとにロックを取る
+		// 容量を超えたらCLOCK法で捨てる
+		// LRUの近似だが意図的に選んでいる（LRUだと参照のたびにリストを繋ぎ変えるので排他ロックが必要になる）
+		// 参照時は参照ビットを立てるだけなので共有ロックで済む
+		class G0Cache {
+		private:
+			struct Entry {
+				id _word_id;
+				double _pw;
+				unsigned long long _vpylm_version;
+			};
+			struct Shard {
+				hashmap<id, int> _slot_of_word;
+				std::vector<Entry> _entries;
+				std::unique_ptr<std::atomic<bool>[]> _referenced;
+				int _capacity;
+				int _hand;		// CLOCKの針
+				std::shared_timed_mutex _mutex;
+			};
+			Shard _shards[G0_CACHE_NUM_SHARDS];
+			std::atomic<size_t> _capacity;
+			Shard &_shard_of(id word_id);
+			void _reset_shard(Shard &shard, size_t capacity);
+		public:
+			G0Cache(size_t capacity = 1 << 18);
+			bool find(id word_id, unsigned long long vpylm_version, double &pw);
+			void insert(id word_id, unsigned long long vpylm_version, double pw);
+			void clear();
+			void set_capacity(size_t capacity);
+			size_t get_capacity();
+			size_t size();
+		};
+	}
+}
@@ -1377,7 +1377,7 @@ private:
         size_t map_size = 0;
         ar & map_size;
         this->clear();
-        for(int i = 0;i < map_size;i++){
+        for(size_t i = 0;i < map_size;i++){
             K key;
             V value;
             ar & key;
@@ -22,6 +22,7 @@ namespace npycrf {
 				_depth = 0;
 				_g0 = g0;
 				_max_depth = max_possible_depth;	// 訓練データ中の最大長の文の文字数が可能な最大深さになる
+				_version = 0;
 				_parent_pw_cache = array<double>(max_possible_depth + 1);
 				_sampling_table = array<double>(max_possible_depth + 1);
 				_path_nodes = array<Node<int>*>(max_possible_depth + 1);
@@ -39,6 +40,7 @@ namespace npycrf {
 				assert(node->_depth == depth_t);
 				int token_t = character_ids[t];
 				int tabke_k;
+				_version++;
 				return node->add_customer(token_t, _parent_pw_cache, _d_m, _theta_m, true, tabke_k);
 			}
 			// parent_pw_cacheがすでにセットされていてpath_nodesを更新する
@@ -59,6 +61,7 @@ namespace npycrf {
 				assert(node->_depth == depth_t);
 				int token_t = character_ids[t];
 				int tabke_k;
+				_version++;
 				return node->add_customer(token_t, parent_pw_cache, _d_m, _theta_m, true, tabke_k);
 			}
 			bool VPYLM::remove_customer_at_time_t(array<int> &character_ids, int t, int depth_t){
@@ -71,6 +74,7 @@ namespace npycrf {
 				assert(node->_depth == depth_t);
 				int token_t = character_ids[t];
 				int table_k;
+				_version++;
 				node->remove_customer(token_t, true, table_k);
 				// 客が一人もいなくなったらノードを削除する
 				if(node->need_to_remove_from_parent()){
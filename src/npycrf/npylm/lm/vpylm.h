@@ -22,11 +22,14 @@ namespace npycrf {
 				double _beta_stop;		// 停止確率q_iのベータ分布の初期パラメータ
 				double _beta_pass;		// 停止確率q_iのベータ分布の初期パラメータ
 				int _max_depth;
+				unsigned long long _version;	// 客の追加・削除やハイパーパラメータの変更のたびに増やす. g0のキャッシュの有効性の判定に使う
 				// 計算高速化用
 				npycrf::array<double> _sampling_table;
 				npycrf::array<double> _parent_pw_cache;
 				npycrf::array<Node<int>*> _path_nodes;
-				VPYLM(){}
+				VPYLM(){
+					_version = 0;
+				}
 				VPYLM(double g0, int max_possible_depth, double beta_stop, double beta_pass);
 				~VPYLM();
 				bool add_customer_at_time_t(npycrf::array<int> &character_ids, int t, int depth_t);
@@ -28,15 +28,19 @@ namespace npycrf {
 		}
 		// lambda_a, lambda_bは単語長のポアソン分布のハイパーパラメータ
 		// 異なる文字種ごとに違うλを使うが、学習時に個別に推定するため事前分布は共通化する
-		NPYLM::NPYLM(int max_word_length, int max_sentence_length, double g0, double initial_lambda_a, double initial_lambda_b, double vpylm_beta_stop, double vpylm_beta_pass){
-			_hpylm = new HPYLM(3);		// 3-gram以外を指定すると動かないので注意
+		// ngramは単語n-gramのnで、2か3のみ. 2ならLatticeも2-gramの格子を使う
+		NPYLM::NPYLM(int max_word_length, int max_sentence_length, double g0, double initial_lambda_a, double initial_lambda_b, double vpylm_beta_stop, double vpylm_beta_pass, int ngram){
+			assert(ngram == 2 || ngram == 3);
+			_ngram = ngram;
+			_hpylm = new HPYLM(ngram);
 			_vpylm = new VPYLM(g0, max_sentence_length, vpylm_beta_stop, vpylm_beta_pass);
 			_lambda_for_type = array<double>(WORDTYPE_NUM_TYPES + 1);	// 文字種ごとの単語長のポアソン分布のハイパーパラメータ
+			_poisson_k_for_type.resize(WORDTYPE_NUM_TYPES + 1, max_word_length + 1);
 			_hpylm_parent_pw_cache = array<double>(3);		// 3-gram
-			set_lambda_prior(initial_lambda_a, initial_lambda_b);
-
 			_max_sentence_length = max_sentence_length;
 			_max_word_length = max_word_length;
+			set_lambda_prior(initial_lambda_a, initial_lambda_b);
+
 			_fix_g0_using_poisson = true;
 			_pk_vpylm = array<double>(max_word_length + 2);		// kが1スタート、かつk > max_word_length用の領域も必要なので+2
 			_pk_vpylm.fill(1.0 / (max_word_length + 2));
@@ -49,8 +53,9 @@ namespace npycrf {
 			delete _hpylm;
 			delete _vpylm;
 		}
+		// 文ごとのキャッシュのみ消す
+		// 文をまたぐ_g0_cacheはVPYLMの更新回数で無効になる
 		void NPYLM::clear_g0_cache(int N){
-			// _g0_cache.clear();
 			_g0_tk.fill(-1, N + 1);
 		}
 		void NPYLM::reserve(int max_sentence_length){
@@ -64,13 +69,14 @@ namespace npycrf {
 		void NPYLM::_allocate_capacity(int max_sentence_length){
 			_max_sentence_length = max_sentence_length;
 			_token_ids = array<int>(max_sentence_length + 1);
-			_g0_tk = mat::bi<double>(max_sentence_length + 1, _max_word_length + 1);
+			_g0_tk.resize(max_sentence_length + 1, _max_word_length + 1);
 		}
 		void NPYLM::_delete_capacity(){
 
 		}
 		void NPYLM::set_vpylm_g0(double g0){
 			_vpylm->set_g0(g0);
+			_vpylm->_version++;
 		}
 		void NPYLM::set_lambda_prior(double a, double b){
 			_lambda_a = a;
@@ -81,6 +87,20 @@ namespace npycrf {
 			for(int type = 1;type <= WORDTYPE_NUM_TYPES;type++){
 				_lambda_for_type[type] = sampler::gamma(_lambda_a, _lambda_b);
 			}
+			update_poisson_table();
+		}
+		void NPYLM::set_lambda_for_type(int type, double lambda){
+			assert(1 <= type && type <= WORDTYPE_NUM_TYPES);
+			_lambda_for_type[type] = lambda;
+			for(int k = 1;k <= _max_word_length;k++){
+				_poisson_k_for_type(type, k) = compute_poisson_k_lambda(k, lambda);
+			}
+		}
+		// g0の補正のたびにpowとfactorialを計算しないよう表にしておく
+		void NPYLM::update_poisson_table(){
+			for(int type = 1;type <= WORDTYPE_NUM_TYPES;type++){
+				set_lambda_for_type(type, _lambda_for_type[type]);
+			}
 		}
 		bool NPYLM::add_customer_at_time_t(Sentence* sentence, int t){
 			assert(t >= 2);
@@ -97,6 +117,7 @@ namespace npycrf {
 			if(num_tables_before < num_tables_after){
 				clear_g0_cache(sentence->size());
 				if(token_t == SPECIAL_CHARACTER_END){
+					_vpylm->_version++;
 					_vpylm->_root->add_customer(token_t, _vpylm->_g0, _vpylm->_d_m, _vpylm->_theta_m, true, added_table_k);
 					return true;
 				}
@@ -140,6 +161,7 @@ namespace npycrf {
 				clear_g0_cache(sentence->size());
 				if(word_t == SPECIAL_CHARACTER_END){
 					// <eos>は文字列に分解できないので常にVPYLMのルートノードに追加されている
+					_vpylm->_version++;
 					_vpylm->_root->remove_customer(word_t, true, removed_from_table_k);
 					return true;
 				}
@@ -180,7 +202,7 @@ namespace npycrf {
 			assert(word_t_index >= 2);
 			assert(word_t_index < word_ids_length);
 			Node<id>* node = _hpylm->_root;
-			for(int depth = 1;depth <= 2;depth++){
+			for(int depth = 1;depth < _ngram;depth++){
 				id context_id = SPECIAL_CHARACTER_BEGIN;
 				if(word_t_index - depth >= 0){
 					context_id = word_ids[word_t_index - depth];
@@ -194,7 +216,7 @@ namespace npycrf {
 				}
 				node = child;
 			}
-			assert(node->_depth == 2);
+			assert(node->_depth == _ngram - 1);
 			return node;
 		}
 		// add_customer用
@@ -213,12 +235,24 @@ namespace npycrf {
 				word_t_index, substr_t_start_index, substr_t_end_index, 
 				parent_pw_cache, generate_node_if_needed, return_middle_node);
 		}
-		// 効率のためノードを探しながら確率も計算する
 		Node<id>* NPYLM::find_node_by_tracing_back_context_from_time_t(
 				array<int> &character_ids, wchar_t const* characters, int character_ids_length, 
 				array<id> &word_ids, int word_ids_length, 
 				int word_t_index, int substr_t_start_index, int substr_t_end_index, 
 				array<double> &parent_pw_cache, bool generate_node_if_needed, bool return_middle_node)
+		{
+			return find_node_by_tracing_back_context_from_time_t(
+				character_ids, characters, character_ids_length, 
+				word_ids, word_ids_length, 
+				word_t_index, substr_t_start_index, substr_t_end_index, 
+				parent_pw_cache, _g0_tk, generate_node_if_needed, return_middle_node);
+		}
+		// 効率のためノードを探しながら確率も計算する
+		Node<id>* NPYLM::find_node_by_tracing_back_context_from_time_t(
+				array<int> &character_ids, wchar_t const* characters, int character_ids_length, 
+				array<id> &word_ids, int word_ids_length, 
+				int word_t_index, int substr_t_start_index, int substr_t_end_index, 
+				array<double> &parent_pw_cache, mat::bi<double> &g0_tk, bool generate_node_if_needed, bool return_middle_node)
 		{
 			assert(word_t_index >= 2);
 			assert(word_t_index < word_ids_length);
@@ -234,7 +268,7 @@ namespace npycrf {
 				if(word_length > _max_word_length){
 					parent_pw = 0;
 				}else{
-					parent_pw = compute_g0_substring_at_time_t(character_ids, characters, character_ids_length, substr_t_start_index, substr_t_end_index, word_t_id);
+					parent_pw = compute_g0_substring_at_time_t(character_ids, characters, character_ids_length, substr_t_start_index, substr_t_end_index, word_t_id, g0_tk);
 				}
 			}
 			if(word_length > _max_word_length){
@@ -243,7 +277,7 @@ namespace npycrf {
 				assert(parent_pw > 0);
 			}
 			parent_pw_cache[0] = parent_pw;
-			for(int depth = 1;depth <= 2;depth++){
+			for(int depth = 1;depth < _ngram;depth++){
 				id context_id = SPECIAL_CHARACTER_BEGIN;
 				if(word_t_index - depth >= 0){
 					context_id = word_ids[word_t_index - depth];
@@ -259,13 +293,20 @@ namespace npycrf {
 				parent_pw = pw;
 				node = child;
 			}
-			assert(node->_depth == 2);
+			assert(node->_depth == _ngram - 1);
 			return node;
 		}
-		// word_idは既知なので再計算を防ぐ
 		double NPYLM::compute_g0_substring_at_time_t(
 				array<int> &character_ids, wchar_t const* characters, int character_ids_length, 
 				int substr_t_start_index, int substr_t_end_index, id word_t_id)
+		{
+			return compute_g0_substring_at_time_t(character_ids, characters, character_ids_length, substr_t_start_index, substr_t_end_index, word_t_id, _g0_tk);
+		}
+		// word_idは既知なので再計算を防ぐ
+		// g0_tkは呼び出し側の文ごとのキャッシュ
+		double NPYLM::compute_g0_substring_at_time_t(
+				array<int> &character_ids, wchar_t const* characters, int character_ids_length, 
+				int substr_t_start_index, int substr_t_end_index, id word_t_id, mat::bi<double> &g0_tk)
 		{
 			if(word_t_id == SPECIAL_CHARACTER_END){
 				return _vpylm->_g0;
@@ -276,7 +317,7 @@ namespace npycrf {
 				assert(a == word_t_id);
 			#endif
 
-			assert(substr_t_end_index < _max_sentence_length);
+			assert(substr_t_end_index < g0_tk._t_size);
 			assert(substr_t_start_index >= 0);
 			assert(substr_t_end_index >= substr_t_start_index);
 			int word_length = substr_t_end_index - substr_t_start_index + 1;
@@ -284,7 +325,7 @@ namespace npycrf {
 			assert(word_length <= _max_word_length);
 
 			// 単語事前分布の計算は重いのでキャッシュする
-			double g0 = _g0_tk(substr_t_end_index, word_length);
+			double g0 = g0_tk(substr_t_end_index, word_length);
 			if(g0 > 0){
 				#ifdef __DEBUG__
 					double _g0 = 0;
@@ -309,12 +350,11 @@ namespace npycrf {
 
 			// g0を計算
 			// g0は単語の文字列としての確率をVPYLMにより計算
-			double pw = std::max(_vpylm->compute_p_w(character_ids, substr_t_start_index, substr_t_end_index), std::numeric_limits<double>::min());
+			double pw = std::max(compute_vpylm_p_w(character_ids, substr_t_start_index, substr_t_end_index, word_t_id), std::numeric_limits<double>::min());
 
 			// 学習の最初のイテレーションでは文が丸ごと1単語になるので補正する意味はない
 			if(_fix_g0_using_poisson == false){
-				// _g0_cache[word_t_id] = pw;
-				_g0_tk(substr_t_end_index, word_length) = pw;
+				g0_tk(substr_t_end_index, word_length) = pw;
 				return pw;
 			}
 
@@ -323,8 +363,8 @@ namespace npycrf {
 			int type = wordtype::detect_word_type_substr(characters, substr_t_start_index, substr_t_end_index);
 			assert(type <= WORDTYPE_NUM_TYPES);
 			assert(type > 0);
-			double lambda = _lambda_for_type[type];
-			double poisson = compute_poisson_k_lambda(word_length, lambda);
+			double poisson = _poisson_k_for_type(type, word_length);
+			assert(poisson == compute_poisson_k_lambda(word_length, _lambda_for_type[type]));
 			assert(poisson > 0);
 			g0 = pw * poisson / p_k_given_vpylm;
 
@@ -345,10 +385,56 @@ namespace npycrf {
 				std::cout << "word_length = " << word_length << std::endl;
 			}
 			assert(0 < g0 && g0 < 1);
-			// _g0_cache[word_t_id] = g0;
-			_g0_tk(substr_t_end_index, word_length) = g0;
+			g0_tk(substr_t_end_index, word_length) = g0;
 			return g0;
 		}
+		// VPYLMによる単語の文字列の確率
+		// VPYLMが更新されていなければ前の文で計算した値を使う
+		double NPYLM::compute_vpylm_p_w(array<int> &character_ids, int substr_t_start_index, int substr_t_end_index, id word_t_id){
+			double pw = 0;
+			if(_g0_cache.find(word_t_id, _vpylm->_version, pw)){
+				return pw;
+			}
+			pw = _vpylm->compute_p_w(character_ids, substr_t_start_index, substr_t_end_index);
+			_g0_cache.insert(word_t_id, _vpylm->_version, pw);
+			return pw;
+		}
+		// 同じ位置から始まる部分文字列は互いに接頭辞なので、VPYLMの文字ごとの確率を掛けていけば全ての長さのg0が求まる
+		// 1回の走査でO(L)になる（部分文字列ごとに計算するとO(L^2)）
+		// 掛ける順序はVPYLM::compute_p_wと同じなので値は一致する
+		// _g0_cacheにある単語はその値から積を続ける
+		void NPYLM::enumerate_g0_substrings(array<int> &character_ids, wchar_t const* characters, int character_ids_length, mat::bi<double> &g0_tk){
+			assert(character_ids_length < g0_tk._t_size);
+			unsigned long long vpylm_version = _vpylm->_version;
+			for(int substr_t_start_index = 0;substr_t_start_index < character_ids_length;substr_t_start_index++){
+				int limit_k = std::min(character_ids_length - substr_t_start_index, _max_word_length);
+				double pw = 0;
+				for(int word_length = 1;word_length <= limit_k;word_length++){
+					int substr_t_end_index = substr_t_start_index + word_length - 1;
+					id word_t_id = hash_substring_ptr(characters, substr_t_start_index, substr_t_end_index);
+					if(_g0_cache.find(word_t_id, vpylm_version, pw) == false){
+						if(word_length == 1){
+							pw = _vpylm->_root->compute_p_w(character_ids[substr_t_start_index], _vpylm->_g0, _vpylm->_d_m, _vpylm->_theta_m);
+						}else{
+							pw *= _vpylm->compute_p_w_given_h(character_ids, substr_t_start_index, substr_t_end_index - 1);
+						}
+						_g0_cache.insert(word_t_id, vpylm_version, pw);
+					}
+					double g0 = std::max(pw, std::numeric_limits<double>::min());
+					if(_fix_g0_using_poisson){
+						// ポアソン分布による単語事前分布の補正
+						double p_k_given_vpylm = compute_p_k_given_vpylm(word_length);
+						int type = wordtype::detect_word_type_substr(characters, substr_t_start_index, substr_t_end_index);
+						assert(type > 0 && type <= WORDTYPE_NUM_TYPES);
+						double poisson = _poisson_k_for_type(type, word_length);
+						assert(poisson > 0);
+						g0 = g0 * poisson / p_k_given_vpylm;
+						assert(0 < g0 && g0 < 1);
+					}
+					g0_tk(substr_t_end_index, word_length) = g0;
+				}
+			}
+		}
 		double NPYLM::compute_poisson_k_lambda(unsigned int k, double lambda){
 			return pow(lambda, k) * exp(-lambda) / factorial(k);
 		}
@@ -359,6 +445,7 @@ namespace npycrf {
 		void NPYLM::sample_hpylm_vpylm_hyperparameters(){
 			_hpylm->sample_hyperparams();
 			_vpylm->sample_hyperparams();
+			_vpylm->_version++;
 		}
 		double NPYLM::compute_log_p_y_given_sentence(Sentence* sentence){
 			double pw = 0;
@@ -393,6 +480,14 @@ namespace npycrf {
 				array<int> &character_ids, wchar_t const* characters, int character_ids_length, 
 				array<id> &word_ids, int word_ids_length, 
 				int word_t_index, int substr_t_start_index, int substr_t_end_index)
+		{
+			return compute_p_w_given_h(character_ids, characters, character_ids_length, word_ids, word_ids_length, word_t_index, substr_t_start_index, substr_t_end_index, _hpylm_parent_pw_cache, _g0_tk);
+		}
+		double NPYLM::compute_p_w_given_h(
+				array<int> &character_ids, wchar_t const* characters, int character_ids_length, 
+				array<id> &word_ids, int word_ids_length, 
+				int word_t_index, int substr_t_start_index, int substr_t_end_index, 
+				array<double> &parent_pw_cache, mat::bi<double> &g0_tk)
 		{
 			assert(0 <= word_t_index && word_t_index < word_ids_length);
 			id word_id = word_ids[word_t_index];
@@ -417,13 +512,42 @@ namespace npycrf {
 					assert(a == word_id);
 				#endif
 			}
-			// ノードを探しながら_hpylm_parent_pw_cacheをセット
-			Node<id>* node = find_node_by_tracing_back_context_from_time_t(character_ids, characters, character_ids_length, word_ids, word_ids_length, word_t_index, substr_t_start_index, substr_t_end_index, _hpylm_parent_pw_cache, false, true);
+			// ノードを探しながらparent_pw_cacheをセット
+			Node<id>* node = find_node_by_tracing_back_context_from_time_t(character_ids, characters, character_ids_length, word_ids, word_ids_length, word_t_index, substr_t_start_index, substr_t_end_index, parent_pw_cache, g0_tk, false, true);
 			assert(node != NULL);
-			double parent_pw = _hpylm_parent_pw_cache[node->_depth];
+			double parent_pw = parent_pw_cache[node->_depth];
 			// 効率のため親の確率のキャッシュから計算
 			return node->compute_p_w_with_parent_p_w(word_id, parent_pw, _hpylm->_d_m, _hpylm->_theta_m);
 		}
+		// 文脈のノードを探す処理を省き、根からcontext_nodeまでの経路で確率を計算する
+		// find_node_by_tracing_back_context_from_time_tと同じ順に計算するので結果は一致する
+		double NPYLM::compute_p_w_given_h(
+				Node<id>* context_node, 
+				array<int> &character_ids, wchar_t const* characters, int character_ids_length, 
+				id word_id, int substr_t_start_index, int substr_t_end_index, mat::bi<double> &g0_tk)
+		{
+			assert(context_node != NULL);
+			assert(context_node->_depth < _ngram);
+			double parent_pw = 0;
+			if(word_id == SPECIAL_CHARACTER_END){
+				parent_pw = _vpylm->_g0;
+			}else{
+				assert(0 <= substr_t_start_index && substr_t_start_index <= substr_t_end_index);
+				assert(0 <= substr_t_end_index && substr_t_end_index < character_ids_length);
+				int word_length = substr_t_end_index - substr_t_start_index + 1;
+				if(word_length <= _max_word_length){
+					parent_pw = compute_g0_substring_at_time_t(character_ids, characters, character_ids_length, substr_t_start_index, substr_t_end_index, word_id, g0_tk);
+				}
+			}
+			Node<id>* path[3];
+			for(Node<id>* node = context_node;node != NULL;node = node->_parent){
+				path[node->_depth] = node;
+			}
+			for(int depth = 0;depth <= context_node->_depth;depth++){
+				parent_pw = path[depth]->compute_p_w_with_parent_p_w(word_id, parent_pw, _hpylm->_d_m, _hpylm->_theta_m);
+			}
+			return parent_pw;
+		}
 		template <class Archive>
 		void NPYLM::serialize(Archive &archive, unsigned int version)
 		{
@@ -432,6 +556,7 @@ namespace npycrf {
 		template void NPYLM::serialize(boost::archive::binary_iarchive &ar, unsigned int version);
 		template void NPYLM::serialize(boost::archive::binary_oarchive &ar, unsigned int version);
 		void NPYLM::save(boost::archive::binary_oarchive &archive, unsigned int version) const {
+			archive & _ngram;
 			archive & _hpylm;
 			archive & _vpylm;
 			archive & _max_word_length;
@@ -447,6 +572,11 @@ namespace npycrf {
 			}
 		}
 		void NPYLM::load(boost::archive::binary_iarchive &archive, unsigned int version) {
+			_ngram = 3;
+			if(version >= 1){
+				archive & _ngram;
+			}
+			assert(_ngram == 2 || _ngram == 3);
 			archive & _hpylm;
 			archive & _vpylm;
 			archive & _max_word_length;
@@ -456,6 +586,7 @@ namespace npycrf {
 
 			_pk_vpylm = array<double>(_max_word_length + 2);
 			_lambda_for_type = array<double>(WORDTYPE_NUM_TYPES + 1);
+			_poisson_k_for_type.resize(WORDTYPE_NUM_TYPES + 1, _max_word_length + 1);
 			_hpylm_parent_pw_cache = array<double>(3);
 			_allocate_capacity(_max_sentence_length);
 
@@ -465,6 +596,9 @@ namespace npycrf {
 			for(int k = 0;k <= _max_word_length + 1;k++){
 				archive & _pk_vpylm[k];
 			}
+			update_poisson_table();
+			// 読み込んだVPYLMの更新回数は以前のものと重なりうるので、前のモデルのg0を使わないよう消す
+			_g0_cache.clear();
 		}
 	}
 }
\ No newline at end of file
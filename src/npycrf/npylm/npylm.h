@@ -1,5 +1,6 @@
 #pragma once
 #include <boost/serialization/serialization.hpp>
+#include <boost/serialization/version.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 #include <vector> 
@@ -8,6 +9,7 @@
 #include "lm/node.h"
 #include "lm/vpylm.h"
 #include "lm/hpylm.h"
+#include "g0_cache.h"
 
 namespace npycrf {
 	namespace npylm {
@@ -26,15 +28,17 @@ namespace npycrf {
 		public:
 			lm::HPYLM* _hpylm;	// 単語n-gram
 			lm::VPYLM* _vpylm;	// 文字n-gram
+			int _ngram;			// 単語n-gramのn. 2か3
 
 			// 単語unigramノードで新たなテーブルが作られた時はVPYLMからその単語が生成されたと判断し、単語の文字列をVPYLMに追加する
 			// その時各文字がVPYLMのどの深さに追加されたかを保存する
 			// 単語unigramノードのテーブルごと、単語IDごとに保存する必要がある
 			hashmap<id, std::vector<std::vector<int>>> _prev_depth_at_table_of_token;
 
-			hashmap<id, double> _g0_cache;
+			G0Cache _g0_cache;	// 文をまたいで使う単語IDごとのVPYLMの確率
 			npycrf::mat::bi<double> _g0_tk;
 			npycrf::array<double> _lambda_for_type;
+			npycrf::mat::bi<double> _poisson_k_for_type;	// 文字種ごとの単語長kのポアソン分布の確率. λを変更したら更新する
 			npycrf::array<double> _pk_vpylm;	// 文字n-gramから長さkの単語が生成される確率
 			npycrf::array<int> _token_ids;
 			int _max_word_length;
@@ -45,6 +49,7 @@ namespace npycrf {
 			npycrf::array<double> _hpylm_parent_pw_cache;
 			bool _fix_g0_using_poisson; // 単語の事前分布をポアソン分布により補正するかどうか
 			NPYLM(){
+				_ngram = 3;
 				_fix_g0_using_poisson = true;
 			}
 			NPYLM(int max_word_length, 
@@ -53,13 +58,16 @@ namespace npycrf {
 				double initial_lambda_a, 
 				double initial_lambda_b, 
 				double vpylm_beta_stop, 
-				double vpylm_beta_pass);
+				double vpylm_beta_pass, 
+				int ngram = 3);
 			~NPYLM();
 			void reserve(int max_sentence_length);
 			void clear_g0_cache(int N);
 			void set_vpylm_g0(double g0);
 			void set_lambda_prior(double a, double b);
 			void sample_lambda_with_initial_params();
+			void set_lambda_for_type(int type, double lambda);
+			void update_poisson_table();
 			bool add_customer_at_time_t(Sentence* sentence, int t);
 			void vpylm_add_customers(array<int> &character_ids, int token_ids_length, std::vector<int> &prev_depths);
 			bool remove_customer_at_time_t(Sentence* sentence, int t);
@@ -71,8 +79,17 @@ namespace npycrf {
 				npycrf::array<id> &word_ids, int word_ids_length, 
 				int word_t_index, int substr_char_t_start, int substr_char_t_end, 
 				npycrf::array<double> &parent_pw_cache, bool generate_node_if_needed, bool return_middle_node);
+			lm::Node<id>* find_node_by_tracing_back_context_from_time_t(
+				array<int> &character_ids, wchar_t const* characters, int character_ids_length, 
+				npycrf::array<id> &word_ids, int word_ids_length, 
+				int word_t_index, int substr_char_t_start, int substr_char_t_end, 
+				npycrf::array<double> &parent_pw_cache, npycrf::mat::bi<double> &g0_tk, bool generate_node_if_needed, bool return_middle_node);
 			// word_idは既知なので再計算を防ぐ
 			double compute_g0_substring_at_time_t(array<int> &character_ids, wchar_t const* characters, int character_ids_length, int substr_char_t_start, int substr_char_t_end, id word_t_id);
+			double compute_g0_substring_at_time_t(array<int> &character_ids, wchar_t const* characters, int character_ids_length, int substr_char_t_start, int substr_char_t_end, id word_t_id, npycrf::mat::bi<double> &g0_tk);
+			double compute_vpylm_p_w(array<int> &character_ids, int substr_char_t_start, int substr_char_t_end, id word_t_id);
+			// 文の全ての部分文字列のg0をまとめて計算
+			void enumerate_g0_substrings(array<int> &character_ids, wchar_t const* characters, int character_ids_length, npycrf::mat::bi<double> &g0_tk);
 			double compute_poisson_k_lambda(unsigned int k, double lambda);
 			double compute_p_k_given_vpylm(int k);
 			void sample_hpylm_vpylm_hyperparameters();
@@ -86,6 +103,21 @@ namespace npycrf {
 				array<int> &character_ids, wchar_t const* characters, int character_ids_length, 
 				npycrf::array<id> &word_ids, int word_ids_length, 
 				int word_t_index, int substr_char_t_start, int substr_char_t_end);
+			// 作業用の配列を呼び出し側が持つ場合
+			// モデルを書き換えないので別々の作業領域を使えば複数スレッドから同時に呼べる
+			double compute_p_w_given_h(
+				array<int> &character_ids, wchar_t const* characters, int character_ids_length, 
+				npycrf::array<id> &word_ids, int word_ids_length, 
+				int word_t_index, int substr_char_t_start, int substr_char_t_end, 
+				npycrf::array<double> &parent_pw_cache, npycrf::mat::bi<double> &g0_tk);
+			// 文脈のノードが既知の場合
+			double compute_p_w_given_h(
+				lm::Node<id>* context_node, 
+				array<int> &character_ids, wchar_t const* characters, int character_ids_length, 
+				id word_id, int substr_char_t_start, int substr_char_t_end, npycrf::mat::bi<double> &g0_tk);
 		};
 	}
-}
\ No newline at end of file
+}
+
+// 2-gramを追加する前に保存したモデルは3-gramとして読み込む
+BOOST_CLASS_VERSION(npycrf::npylm::NPYLM, 1)
\ No newline at end of file
@@ -27,6 +27,10 @@ namespace npycrf {
 			return 1;
 		}
 		double uniform(double min, double max){
+			return uniform(mt, min, max);
+		}
+		// スレッドごとに別の乱数列を使う場合
+		double uniform(std::mt19937 &mt, double min, double max){
 			std::uniform_real_distribution<double> rand(min, max);
 			return rand(mt);
 		}
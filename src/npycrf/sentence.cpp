@@ -1,3 +1,4 @@
+#include <atomic>
 #include <iostream>
 #include "hash.h"
 #include "sentence.h"
@@ -17,6 +18,10 @@ namespace npycrf {
 			return new Sentence(sentence_str, character_ids);
 		}
 	}
+	// 文の番号は全体で数える. コピーにも別の番号が付く
+	// 文は複数のスレッドで作られることがあるのでatomicにする
+	static std::atomic<int> next_serial(1);
+
 	Sentence::Sentence(std::wstring sentence, array<int> &character_ids){
 		_sentence_str = sentence;
 		_characters = _sentence_str.data();
@@ -29,6 +34,8 @@ namespace npycrf {
 		_start = array<int>(size() + 3);
 		_labels = array<int>(size() + 3);
 		_features = NULL;
+		_serial = next_serial.fetch_add(1);
+		_substr_word_ids_max_length = 0;
 		for(int i = 0;i < size() + 3;i++){
 			_word_ids[i] = 0;
 			_segments[i] = 0;
@@ -87,8 +94,28 @@ namespace npycrf {
 		return _word_ids[t];
 	}
 	id Sentence::get_substr_word_id(int start_index, int end_index){
+		int length = end_index - start_index + 1;
+		if(0 < length && length <= _substr_word_ids_max_length){
+			return _substr_word_ids(end_index, length);
+		}
 		return hash_substring_ptr(_characters, start_index, end_index);
 	}
+	// 全ての部分文字列のIDを前計算する
+	// 文は学習中変わらないので、Gibbs samplingやSGDの反復をまたいで使える
+	// メモリはO(N・L)
+	void Sentence::enumerate_substr_word_ids(int max_word_length){
+		if(max_word_length <= _substr_word_ids_max_length){
+			return;
+		}
+		_substr_word_ids.resize(size(), max_word_length + 1);
+		hash_all_substrings(_characters, size(), max_word_length, _substr_word_ids._array, max_word_length + 1);
+		_substr_word_ids_max_length = max_word_length;
+	}
+	// メモリが足りない場合は捨てる
+	void Sentence::clear_substr_word_ids(){
+		_substr_word_ids = mat::bi<id>();
+		_substr_word_ids_max_length = 0;
+	}
 	std::wstring Sentence::get_substr_word_str(int start_index, int end_index){
 		std::wstring str(_sentence_str.begin() + start_index, _sentence_str.begin() + end_index + 1);
 		return str;
@@ -20,7 +20,10 @@ namespace npycrf {
 		npycrf::array<id> _word_ids;		// <bos>2つと<eos>1つを含める
 		npycrf::array<int> _labels;		// CRFのラベル. <bos>が1つ先頭に入り、<eos>が末尾に2つ入る. CRFに合わせて1スタート、[0]は<bos>
 		crf::feature::FeatureIndices* _features;	// CRFの素性ID. 不変なのであらかじめ計算しておく.
+		int _serial;				// 文ごとに異なる番号. ラティスが持つパスのコストの表がどの文のものかを調べるのに使う
 		std::wstring _sentence_str;	// 生の文データ
+		npycrf::mat::bi<id> _substr_word_ids;	// 長さ_substr_word_ids_max_length以下の部分文字列のID. (終端のインデックス, 長さ)
+		int _substr_word_ids_max_length;		// 0なら未計算
 		Sentence(std::wstring sentence, npycrf::array<int> &character_ids);
 		~Sentence();
 		Sentence* copy();
@@ -30,6 +33,8 @@ namespace npycrf {
 		int get_word_length_at(int t);
 		id get_word_id_at(int t);
 		id get_substr_word_id(int start_index, int end_index);				// end_indexを含む
+		void enumerate_substr_word_ids(int max_word_length);
+		void clear_substr_word_ids();
 		int get_crf_label_at(int t);	// tは1から
 		std::wstring get_substr_word_str(int start_index, int end_index);	// endを含む
 		std::wstring get_word_str_at(int t);	// t=0,1の時は<bos>が返る
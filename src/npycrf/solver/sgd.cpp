@@ -1,42 +1,245 @@
 #include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
 #include "sgd.h"
 #include "../ctype.h"
 
 namespace npycrf {
 	namespace solver {
-		SGD::SGD(crf::CRF* crf, double regularization_constant){
+		SGD::SGD(crf::CRF* crf, double regularization_constant, double l1_regularization_constant){
+			// 量子化したモデルは学習できない
+			if(crf->_parameter->_quantized != NULL){
+				throw std::runtime_error("SGD: a quantized CRF model can only be used for segmentation and cannot be trained.");
+			}
 			_crf = crf;
 			_regularization_constant = regularization_constant;
-			_grad_weight = array<double>(crf->_parameter->get_num_features());
+			_l1_regularization_constant = l1_regularization_constant;
+			_cumulative_l1_penalty = 0;
+			int num_features = crf->_parameter->get_num_features();
+			_grad_weight = array<double>(num_features);
+			_active = array<bool>(num_features);
+			_last_step = array<int>(num_features);
+			_l1_penalty_applied = array<double>(num_features);
+			for(int k = 0;k < num_features;k++){
+				_grad_weight[k] = 0;
+				_active[k] = false;
+				_last_step[k] = 0;
+				_l1_penalty_applied[k] = 0;
+			}
+			_log_decay.push_back(0);
 			clear_grads();
 		}
 		SGD::~SGD(){
 			
+		}
+		Gradient::Gradient(){
+			_lambda_0 = 0;
+		}
+		void Gradient::clear(){
+			_feature_ids.clear();
+			_values.clear();
+			_lambda_0 = 0;
 		}
 		void SGD::clear_grads(){
 			_grad_lambda_0 = 0;
-			for(int i = 0;i < _crf->_parameter->get_num_features();i++){
-				_grad_weight[i] = 0;
+			for(int k: _active_feature_ids){
+				_grad_weight[k] = 0;
+				_active[k] = false;
 			}
+			_active_feature_ids.clear();
 		}
+		// 1文ぶんの勾配を足し込む
+		// 文の順に呼べばスレッド数によらず同じ結果になる
+		void SGD::accumulate(Gradient &grad){
+			int num_features = grad._feature_ids.size();
+			for(int n = 0;n < num_features;n++){
+				int k = grad._feature_ids[n];
+				if(_active[k] == false){
+					_active[k] = true;
+					_active_feature_ids.push_back(k);
+				}
+				_grad_weight[k] += grad._values[n];
+			}
+			_grad_lambda_0 += grad._lambda_0;
+		}
+		// 勾配を持つ素性の重みのみ更新し、それ以外の重みの縮小は_log_decayに記録しておく
 		void SGD::update(double learning_rate){
 			crf::Parameter* params = _crf->_parameter;
-			for(int i = 0;i < params->get_num_features();i++){
-				params->_weights[i] += learning_rate * _grad_weight[i] - _regularization_constant * learning_rate * params->_weights[i];
+			double decay = 1.0 - _regularization_constant * learning_rate;
+			// 縮小率が0以下だと_log_decayが-infかNaNになり、遅らせた縮小をかけた重みが全てNaNになる
+			if(decay <= 0){
+				throw std::invalid_argument("SGD: regularization_constant * learning_rate must be less than 1.");
+			}
+			for(int k: _active_feature_ids){
+				_apply_pending_decay(k);
+				params->_weights[k] += learning_rate * _grad_weight[k] - _regularization_constant * learning_rate * params->_weights[k];
+			}
+			_log_decay.push_back(_log_decay.back() + log(decay));
+			_cumulative_l1_penalty += _l1_regularization_constant * learning_rate;
+			int step = _log_decay.size() - 1;
+			for(int k: _active_feature_ids){
+				_apply_l1_penalty(k);
+				_last_step[k] = step;
 			}
 			params->_lambda_0 += learning_rate * _grad_lambda_0 - _regularization_constant * learning_rate * (params->_lambda_0 - 1);
+			params->update_version();	// 文ごとのパスのコストの表を計算し直させる
+		}
+		// 重みkに遅らせていた縮小をかける
+		// 重みが変わればtrueを返す
+		bool SGD::_apply_pending_decay(int k){
+			int step = _log_decay.size() - 1;
+			if(_last_step[k] == step){
+				return false;
+			}
+			_crf->_parameter->_weights[k] *= exp(_log_decay[step] - _log_decay[_last_step[k]]);
+			_apply_l1_penalty(k);
+			_last_step[k] = step;
+			return true;
+		}
+		// まだ受けていないL1ペナルティの分だけ重みkを0に近づける. 0を越えたら0で止める
+		void SGD::_apply_l1_penalty(int k){
+			if(_l1_regularization_constant == 0){
+				return;
+			}
+			double &w = _crf->_parameter->_weights[k];
+			double z = w;
+			if(w > 0){
+				w = std::max(0.0, w - (_cumulative_l1_penalty + _l1_penalty_applied[k]));
+			}else if(w < 0){
+				w = std::min(0.0, w + (_cumulative_l1_penalty - _l1_penalty_applied[k]));
+			}
+			_l1_penalty_applied[k] += w - z;
+		}
+		// 文の素性の重みを最新にする
+		// 前向き・後向き確率を求める前に呼ぶ
+		void SGD::apply_pending_decay(Sentence* sentence){
+			crf::FeatureIndices* features = sentence->_features;
+			assert(features != NULL);
+			bool updated = false;
+			for(int k: features->_ids){
+				updated |= _apply_pending_decay(k);
+			}
+			if(updated){
+				_crf->_parameter->update_version();
+			}
+		}
+		// 全ての重みを最新にする
+		// 学習を終えてモデルを使う前に呼ぶ
+		void SGD::apply_pending_decay(){
+			for(int k = 0;k < _crf->_parameter->get_num_features();k++){
+				_apply_pending_decay(k);
+				_last_step[k] = 0;
+			}
+			_log_decay.clear();
+			_log_decay.push_back(0);
+			_crf->_parameter->update_version();
+		}
+		// 1文の勾配を求める
+		void SGD::backward(Lattice* lattice, Sentence* sentence, bool pure_crf_mode, Gradient &grad){
+			grad.clear();
+			lattice->set_pure_crf_mode(pure_crf_mode);
+			mat::tri<double> &pz_s = lattice->_pz_s;				// ラベルの周辺確率P(z_t, z_{t+1}|x)
+			// 以下は\lambda_0の勾配計算に必要
+			mat::quad<double> &p_conc_tkji = lattice->_p_conc_tkji;	// 単語列の周辺確率P(c_{t-k+1}^t, c_{t-k-j+1}^{t-k}, c_{t-k-j-i+1}^{t-k-j}|x)
+			mat::quad<double> &pw_h_tkji = lattice->_pw_h_tkji;		// NPYLM 単体の遷移確率P(c_{t-k+1}^t|c_{t-k-j+1}^{t-k}, c_{t-k-j-i+1}^{t-k-j})
+
+			if(pure_crf_mode){
+				// CRF単体の学習では\lambda_0を学習する必要はないためラベルの周辺確率だけ求めればよい
+				lattice->enumerate_marginal_p_z_given_sentence(sentence, pz_s);
+				backward_crf(sentence, pz_s, grad);
+			}else if(lattice->get_bigram_mode()){
+				// 2-gramのNPYLMでは単語2-gramの周辺確率を使う
+				lattice->enumerate_marginal_p_z_and_bigram_given_sentence(sentence, lattice->_p_conc_tkj, lattice->_pw_h_tkj, pz_s);
+				backward_crf(sentence, pz_s, grad);
+				backward_lambda_0(sentence, lattice->_p_conc_tkj, lattice->_pw_h_tkj, lattice->_max_word_length, grad);
+			}else{
+				lattice->enumerate_marginal_p_z_and_trigram_given_sentence(sentence, p_conc_tkji, pw_h_tkji, pz_s);
+				backward_crf(sentence, pz_s, grad);
+				backward_lambda_0(sentence, p_conc_tkji, pw_h_tkji, lattice->_max_word_length, grad);
+			}
+		}
+		// ミニバッチの勾配を_grad_weightと_grad_lambda_0に求める
+		// 文ごとの勾配はlatticesの数のスレッドで並列に求め、文の順に足し込むので結果はスレッド数によらない
+		// 各ラティスは文の長さぶん確保しておくこと
+		void SGD::compute_batch_gradient(std::vector<Sentence*> &batch, std::vector<Lattice*> &lattices, bool pure_crf_mode){
+			assert(lattices.size() > 0);
+			int size = batch.size();
+			if((int)_batch_grads.size() < size){
+				_batch_grads.resize(size);
+			}
+			int num_threads = std::min((int)lattices.size(), size);
+			if(num_threads > 1){
+				std::atomic<int> next(0);
+				auto work = [this, &batch, &next, size, pure_crf_mode](Lattice* lattice){
+					while(true){
+						int i = next.fetch_add(1);
+						if(i >= size){
+							break;
+						}
+						backward(lattice, batch[i], pure_crf_mode, _batch_grads[i]);
+					}
+				};
+				std::vector<std::thread> workers;
+				for(int n = 0;n < num_threads;n++){
+					workers.emplace_back(work, lattices[n]);
+				}
+				for(std::thread &worker: workers){
+					worker.join();
+				}
+			}else{
+				for(int i = 0;i < size;i++){
+					backward(lattices[0], batch[i], pure_crf_mode, _batch_grads[i]);
+				}
+			}
+			// 文の順に足し込む
+			clear_grads();
+			for(int i = 0;i < size;i++){
+				accumulate(_batch_grads[i]);
+			}
 		}
 		// CRFの勾配計算について
 		// http://www.ism.ac.jp/editsec/toukei/pdf/64-2-179.pdf
-		void SGD::backward_crf(Sentence* sentence, mat::tri<double> &pz_s){
-			_backward_unigram(sentence, pz_s);
-			_backward_bigram(sentence, pz_s);
-			_backward_identical_1(sentence, pz_s);
-			_backward_unigram_type(sentence, pz_s);
-			_backward_bigram_type(sentence, pz_s);
-			_backward_label(sentence, pz_s);
+		// 素性IDは文のFeatureIndicesに展開済みなので、位置とラベルごとの素性IDの列をたどって
+		// 発火した素性に1を足し、その位置のラベルの周辺確率を引く
+		// FeatureIndicesにはパスのコストの計算に使う全ての素性が入っている
+		void SGD::backward_crf(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad){
+			crf::FeatureIndices* features = sentence->_features;
+			assert(features != NULL);
+			// パスのコストは位置2から計算する
+			for(int i = 2;i <= sentence->size() + 2;i++){
+				// ラベルを取得
+				int y_i_1 = sentence->get_crf_label_at(i - 1);
+				int y_i = sentence->get_crf_label_at(i);
+
+				// 発火
+				for(int const* k = features->begin_u(i, y_i), *end = features->end_u(i, y_i);k != end;k++){
+					grad.add(*k, 1);
+				}
+				for(int const* k = features->begin_b(i, y_i_1, y_i), *end = features->end_b(i, y_i_1, y_i);k != end;k++){
+					grad.add(*k, 1);
+				}
+
+				// 発火の期待値
+				for(int y = 0;y <= 1;y++){
+					double p_y = pz_s(i - 1, 0, y) + pz_s(i - 1, 1, y);
+					for(int const* k = features->begin_u(i, y), *end = features->end_u(i, y);k != end;k++){
+						grad.add(*k, -p_y);
+					}
+				}
+				for(int y_1 = 0;y_1 <= 1;y_1++){
+					for(int y = 0;y <= 1;y++){
+						double p_y_1_y = pz_s(i - 1, y_1, y);
+						for(int const* k = features->begin_b(i, y_1, y), *end = features->end_b(i, y_1, y);k != end;k++){
+							grad.add(*k, -p_y_1_y);
+						}
+					}
+				}
+			}
 		}
-		void SGD::_backward_unigram(Sentence* sentence, mat::tri<double> &pz_s){
+		void SGD::_backward_unigram(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad){
 			array<int> &character_ids = sentence->_character_ids;
 			wchar_t const* characters = sentence->_characters;
 			int character_ids_length = sentence->size();
@@ -53,38 +256,30 @@ namespace npycrf {
 
 					// 発火
 					int k_u = _crf->_extractor->feature_id_unigram_u(y_i, pos, x_i);
-					assert(k_u != -1);
-					_grad_weight[k_u] += 1;
+					grad.add(k_u, 1);
 					int k_b = _crf->_extractor->feature_id_unigram_b(y_i_1, y_i, pos, x_i);
-					assert(k_b != -1);
-					_grad_weight[k_b] += 1;
+					grad.add(k_b, 1);
 
 					// 発火の期待値
 					int k_0 = _crf->_extractor->feature_id_unigram_u(0, pos, x_i);
-					assert(k_0 != -1);
 					int k_1 = _crf->_extractor->feature_id_unigram_u(1, pos, x_i);
-					assert(k_1 != -1);
-					_grad_weight[k_0] -= pz_s(i - 1, 0, 0);
-					_grad_weight[k_0] -= pz_s(i - 1, 1, 0);
-					_grad_weight[k_1] -= pz_s(i - 1, 0, 1);
-					_grad_weight[k_1] -= pz_s(i - 1, 1, 1);
+					grad.add(k_0, -pz_s(i - 1, 0, 0));
+					grad.add(k_0, -pz_s(i - 1, 1, 0));
+					grad.add(k_1, -pz_s(i - 1, 0, 1));
+					grad.add(k_1, -pz_s(i - 1, 1, 1));
 
 					int k_0_0 = _crf->_extractor->feature_id_unigram_b(0, 0, pos, x_i);
-					assert(k_0_0 != -1);
 					int k_0_1 = _crf->_extractor->feature_id_unigram_b(0, 1, pos, x_i);
-					assert(k_0_1 != -1);
 					int k_1_0 = _crf->_extractor->feature_id_unigram_b(1, 0, pos, x_i);
-					assert(k_1_0 != -1);
 					int k_1_1 = _crf->_extractor->feature_id_unigram_b(1, 1, pos, x_i);
-					assert(k_1_1 != -1);
-					_grad_weight[k_0_0] -= pz_s(i - 1, 0, 0);
-					_grad_weight[k_0_1] -= pz_s(i - 1, 0, 1);
-					_grad_weight[k_1_0] -= pz_s(i - 1, 1, 0);
-					_grad_weight[k_1_1] -= pz_s(i - 1, 1, 1);
+					grad.add(k_0_0, -pz_s(i - 1, 0, 0));
+					grad.add(k_0_1, -pz_s(i - 1, 0, 1));
+					grad.add(k_1_0, -pz_s(i - 1, 1, 0));
+					grad.add(k_1_1, -pz_s(i - 1, 1, 1));
 				}
 			}
 		}
-		void SGD::_backward_bigram(Sentence* sentence, mat::tri<double> &pz_s){
+		void SGD::_backward_bigram(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad){
 			array<int> &character_ids = sentence->_character_ids;
 			wchar_t const* characters = sentence->_characters;
 			int character_ids_length = sentence->size();
@@ -96,44 +291,36 @@ namespace npycrf {
 				int r_start = std::max(2, i + _crf->_extractor->_x_bigram_start);
 				int r_end = std::min(character_ids_length + 2, i + _crf->_extractor->_x_bigram_end);
 				for(int r = r_start;r <= r_end;r++){
-					int pos = r - i - _crf->_extractor->_x_unigram_start + 1;	// [1, _x_range_bigram]
+					int pos = r - i - _crf->_extractor->_x_bigram_start + 1;	// [1, _x_range_bigram]
 					int x_i = (r <= character_ids_length) ? character_ids[r - 1] : SPECIAL_CHARACTER_END;
 					int x_i_1 = (r - 1 <= character_ids_length) ? character_ids[r - 2] : SPECIAL_CHARACTER_END;
 
 					// 発火
 					int k_u = _crf->_extractor->feature_id_bigram_u(y_i, pos, x_i_1, x_i);
-					assert(k_u != -1);
-					_grad_weight[k_u] += 1;
+					grad.add(k_u, 1);
 					int k_b = _crf->_extractor->feature_id_bigram_b(y_i_1, y_i, pos, x_i_1, x_i);
-					assert(k_b != -1);
-					_grad_weight[k_b] += 1;
+					grad.add(k_b, 1);
 
 					// 発火の期待値
 					int k_0 = _crf->_extractor->feature_id_bigram_u(0, pos, x_i_1, x_i);
-					assert(k_0 != -1);
 					int k_1 = _crf->_extractor->feature_id_bigram_u(1, pos, x_i_1, x_i);
-					assert(k_1 != -1);
-					_grad_weight[k_0] -= pz_s(i - 1, 0, 0);
-					_grad_weight[k_0] -= pz_s(i - 1, 1, 0);
-					_grad_weight[k_1] -= pz_s(i - 1, 0, 1);
-					_grad_weight[k_1] -= pz_s(i - 1, 1, 1);
+					grad.add(k_0, -pz_s(i - 1, 0, 0));
+					grad.add(k_0, -pz_s(i - 1, 1, 0));
+					grad.add(k_1, -pz_s(i - 1, 0, 1));
+					grad.add(k_1, -pz_s(i - 1, 1, 1));
 
 					int k_0_0 = _crf->_extractor->feature_id_bigram_b(0, 0, pos, x_i_1, x_i);
-					assert(k_0_0 != -1);
 					int k_0_1 = _crf->_extractor->feature_id_bigram_b(0, 1, pos, x_i_1, x_i);
-					assert(k_0_1 != -1);
 					int k_1_0 = _crf->_extractor->feature_id_bigram_b(1, 0, pos, x_i_1, x_i);
-					assert(k_1_0 != -1);
 					int k_1_1 = _crf->_extractor->feature_id_bigram_b(1, 1, pos, x_i_1, x_i);
-					assert(k_1_1 != -1);
-					_grad_weight[k_0_0] -= pz_s(i - 1, 0, 0);
-					_grad_weight[k_0_1] -= pz_s(i - 1, 0, 1);
-					_grad_weight[k_1_0] -= pz_s(i - 1, 1, 0);
-					_grad_weight[k_1_1] -= pz_s(i - 1, 1, 1);
+					grad.add(k_0_0, -pz_s(i - 1, 0, 0));
+					grad.add(k_0_1, -pz_s(i - 1, 0, 1));
+					grad.add(k_1_0, -pz_s(i - 1, 1, 0));
+					grad.add(k_1_1, -pz_s(i - 1, 1, 1));
 				}
 			}
 		}
-		void SGD::_backward_identical_1(Sentence* sentence, mat::tri<double> &pz_s){
+		void SGD::_backward_identical_1(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad){
 			array<int> &character_ids = sentence->_character_ids;
 			wchar_t const* characters = sentence->_characters;
 			int character_ids_length = sentence->size();
@@ -151,39 +338,31 @@ namespace npycrf {
 					if(x_i == x_i_1){
 						// 発火
 						int k_u = _crf->_extractor->feature_id_identical_1_u(y_i, pos);
-						assert(k_u != -1);
-						_grad_weight[k_u] += 1;
+						grad.add(k_u, 1);
 						int k_b = _crf->_extractor->feature_id_identical_1_b(y_i_1, y_i, pos);
-						assert(k_b != -1);
-						_grad_weight[k_b] += 1;
+						grad.add(k_b, 1);
 
 						// 発火の期待値
 						int k_0 = _crf->_extractor->feature_id_identical_1_u(0, pos);
-						assert(k_0 != -1);
 						int k_1 = _crf->_extractor->feature_id_identical_1_u(1, pos);
-						assert(k_1 != -1);
-						_grad_weight[k_0] -= pz_s(i - 1, 0, 0);
-						_grad_weight[k_0] -= pz_s(i - 1, 1, 0);
-						_grad_weight[k_1] -= pz_s(i - 1, 0, 1);
-						_grad_weight[k_1] -= pz_s(i - 1, 1, 1);
+						grad.add(k_0, -pz_s(i - 1, 0, 0));
+						grad.add(k_0, -pz_s(i - 1, 1, 0));
+						grad.add(k_1, -pz_s(i - 1, 0, 1));
+						grad.add(k_1, -pz_s(i - 1, 1, 1));
 
 						int k_0_0 = _crf->_extractor->feature_id_identical_1_b(0, 0, pos);
-						assert(k_0_0 != -1);
 						int k_0_1 = _crf->_extractor->feature_id_identical_1_b(0, 1, pos);
-						assert(k_0_1 != -1);
 						int k_1_0 = _crf->_extractor->feature_id_identical_1_b(1, 0, pos);
-						assert(k_1_0 != -1);
 						int k_1_1 = _crf->_extractor->feature_id_identical_1_b(1, 1, pos);
-						assert(k_1_1 != -1);
-						_grad_weight[k_0_0] -= pz_s(i - 1, 0, 0);
-						_grad_weight[k_0_1] -= pz_s(i - 1, 0, 1);
-						_grad_weight[k_1_0] -= pz_s(i - 1, 1, 0);
-						_grad_weight[k_1_1] -= pz_s(i - 1, 1, 1);
+						grad.add(k_0_0, -pz_s(i - 1, 0, 0));
+						grad.add(k_0_1, -pz_s(i - 1, 0, 1));
+						grad.add(k_1_0, -pz_s(i - 1, 1, 0));
+						grad.add(k_1_1, -pz_s(i - 1, 1, 1));
 					}
 				}
 			}
 		}
-		void SGD::_backward_identical_2(Sentence* sentence, mat::tri<double> &pz_s){
+		void SGD::_backward_identical_2(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad){
 			array<int> &character_ids = sentence->_character_ids;
 			wchar_t const* characters = sentence->_characters;
 			int character_ids_length = sentence->size();
@@ -201,39 +380,31 @@ namespace npycrf {
 					if(x_i == x_i_2){
 						// 発火
 						int k_u = _crf->_extractor->feature_id_identical_2_u(y_i, pos);
-						assert(k_u != -1);
-						_grad_weight[k_u] += 1;
+						grad.add(k_u, 1);
 						int k_b = _crf->_extractor->feature_id_identical_2_b(y_i_1, y_i, pos);
-						assert(k_b != -1);
-						_grad_weight[k_b] += 1;
+						grad.add(k_b, 1);
 
 						// 発火の期待値
 						int k_0 = _crf->_extractor->feature_id_identical_2_u(0, pos);
-						assert(k_0 != -1);
 						int k_1 = _crf->_extractor->feature_id_identical_2_u(1, pos);
-						assert(k_1 != -1);
-						_grad_weight[k_0] -= pz_s(i - 1, 0, 0);
-						_grad_weight[k_0] -= pz_s(i - 1, 1, 0);
-						_grad_weight[k_1] -= pz_s(i - 1, 0, 1);
-						_grad_weight[k_1] -= pz_s(i - 1, 1, 1);
+						grad.add(k_0, -pz_s(i - 1, 0, 0));
+						grad.add(k_0, -pz_s(i - 1, 1, 0));
+						grad.add(k_1, -pz_s(i - 1, 0, 1));
+						grad.add(k_1, -pz_s(i - 1, 1, 1));
 
 						int k_0_0 = _crf->_extractor->feature_id_identical_2_b(0, 0, pos);
-						assert(k_0_0 != -1);
 						int k_0_1 = _crf->_extractor->feature_id_identical_2_b(0, 1, pos);
-						assert(k_0_1 != -1);
 						int k_1_0 = _crf->_extractor->feature_id_identical_2_b(1, 0, pos);
-						assert(k_1_0 != -1);
 						int k_1_1 = _crf->_extractor->feature_id_identical_2_b(1, 1, pos);
-						assert(k_1_1 != -1);
-						_grad_weight[k_0_0] -= pz_s(i - 1, 0, 0);
-						_grad_weight[k_0_1] -= pz_s(i - 1, 0, 1);
-						_grad_weight[k_1_0] -= pz_s(i - 1, 1, 0);
-						_grad_weight[k_1_1] -= pz_s(i - 1, 1, 1);
+						grad.add(k_0_0, -pz_s(i - 1, 0, 0));
+						grad.add(k_0_1, -pz_s(i - 1, 0, 1));
+						grad.add(k_1_0, -pz_s(i - 1, 1, 0));
+						grad.add(k_1_1, -pz_s(i - 1, 1, 1));
 					}
 				}
 			}
 		}
-		void SGD::_backward_unigram_type(Sentence* sentence, mat::tri<double> &pz_s){
+		void SGD::_backward_unigram_type(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad){
 			array<int> &character_ids = sentence->_character_ids;
 			wchar_t const* characters = sentence->_characters;
 			int character_ids_length = sentence->size();
@@ -245,37 +416,29 @@ namespace npycrf {
 
 				// 発火
 				int k_u = _crf->_extractor->feature_id_unigram_type_u(y_i, type_i);
-				assert(k_u != -1);
-				_grad_weight[k_u] += 1;
+				grad.add(k_u, 1);
 				int k_b = _crf->_extractor->feature_id_unigram_type_b(y_i_1, y_i, type_i);
-				assert(k_b != -1);
-				_grad_weight[k_b] += 1;
+				grad.add(k_b, 1);
 
 				// 発火の期待値
 				int k_0 = _crf->_extractor->feature_id_unigram_type_u(0, type_i);
-				assert(k_0 != -1);
 				int k_1 = _crf->_extractor->feature_id_unigram_type_u(1, type_i);
-				assert(k_1 != -1);
-				_grad_weight[k_0] -= pz_s(i - 1, 0, 0);
-				_grad_weight[k_0] -= pz_s(i - 1, 1, 0);
-				_grad_weight[k_1] -= pz_s(i - 1, 0, 1);
-				_grad_weight[k_1] -= pz_s(i - 1, 1, 1);
+				grad.add(k_0, -pz_s(i - 1, 0, 0));
+				grad.add(k_0, -pz_s(i - 1, 1, 0));
+				grad.add(k_1, -pz_s(i - 1, 0, 1));
+				grad.add(k_1, -pz_s(i - 1, 1, 1));
 
 				int k_0_0 = _crf->_extractor->feature_id_unigram_type_b(0, 0, type_i);
-				assert(k_0_0 != -1);
 				int k_0_1 = _crf->_extractor->feature_id_unigram_type_b(0, 1, type_i);
-				assert(k_0_1 != -1);
 				int k_1_0 = _crf->_extractor->feature_id_unigram_type_b(1, 0, type_i);
-				assert(k_1_0 != -1);
 				int k_1_1 = _crf->_extractor->feature_id_unigram_type_b(1, 1, type_i);
-				assert(k_1_1 != -1);
-				_grad_weight[k_0_0] -= pz_s(i - 1, 0, 0);
-				_grad_weight[k_0_1] -= pz_s(i - 1, 0, 1);
-				_grad_weight[k_1_0] -= pz_s(i - 1, 1, 0);
-				_grad_weight[k_1_1] -= pz_s(i - 1, 1, 1);
+				grad.add(k_0_0, -pz_s(i - 1, 0, 0));
+				grad.add(k_0_1, -pz_s(i - 1, 0, 1));
+				grad.add(k_1_0, -pz_s(i - 1, 1, 0));
+				grad.add(k_1_1, -pz_s(i - 1, 1, 1));
 			}
 		}
-		void SGD::_backward_bigram_type(Sentence* sentence, mat::tri<double> &pz_s){
+		void SGD::_backward_bigram_type(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad){
 			array<int> &character_ids = sentence->_character_ids;
 			wchar_t const* characters = sentence->_characters;
 			int character_ids_length = sentence->size();
@@ -288,37 +451,29 @@ namespace npycrf {
 
 				// 発火
 				int k_u = _crf->_extractor->feature_id_bigram_type_u(y_i, type_i_1, type_i);
-				assert(k_u != -1);
-				_grad_weight[k_u] += 1;
+				grad.add(k_u, 1);
 				int k_b = _crf->_extractor->feature_id_bigram_type_b(y_i_1, y_i, type_i_1, type_i);
-				assert(k_b != -1);
-				_grad_weight[k_b] += 1;
+				grad.add(k_b, 1);
 
 				// 発火の期待値
 				int k_0 = _crf->_extractor->feature_id_bigram_type_u(0, type_i_1, type_i);
-				assert(k_0 != -1);
 				int k_1 = _crf->_extractor->feature_id_bigram_type_u(1, type_i_1, type_i);
-				assert(k_1 != -1);
-				_grad_weight[k_0] -= pz_s(i - 1, 0, 0);
-				_grad_weight[k_0] -= pz_s(i - 1, 1, 0);
-				_grad_weight[k_1] -= pz_s(i - 1, 0, 1);
-				_grad_weight[k_1] -= pz_s(i - 1, 1, 1);
+				grad.add(k_0, -pz_s(i - 1, 0, 0));
+				grad.add(k_0, -pz_s(i - 1, 1, 0));
+				grad.add(k_1, -pz_s(i - 1, 0, 1));
+				grad.add(k_1, -pz_s(i - 1, 1, 1));
 
 				int k_0_0 = _crf->_extractor->feature_id_bigram_type_b(0, 0, type_i_1, type_i);
-				assert(k_0_0 != -1);
 				int k_0_1 = _crf->_extractor->feature_id_bigram_type_b(0, 1, type_i_1, type_i);
-				assert(k_0_1 != -1);
 				int k_1_0 = _crf->_extractor->feature_id_bigram_type_b(1, 0, type_i_1, type_i);
-				assert(k_1_0 != -1);
 				int k_1_1 = _crf->_extractor->feature_id_bigram_type_b(1, 1, type_i_1, type_i);
-				assert(k_1_1 != -1);
-				_grad_weight[k_0_0] -= pz_s(i - 1, 0, 0);
-				_grad_weight[k_0_1] -= pz_s(i - 1, 0, 1);
-				_grad_weight[k_1_0] -= pz_s(i - 1, 1, 0);
-				_grad_weight[k_1_1] -= pz_s(i - 1, 1, 1);
+				grad.add(k_0_0, -pz_s(i - 1, 0, 0));
+				grad.add(k_0_1, -pz_s(i - 1, 0, 1));
+				grad.add(k_1_0, -pz_s(i - 1, 1, 0));
+				grad.add(k_1_1, -pz_s(i - 1, 1, 1));
 			}
 		}
-		void SGD::_backward_label(Sentence* sentence, mat::tri<double> &pz_s){
+		void SGD::_backward_label(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad){
 			array<int> &character_ids = sentence->_character_ids;
 			wchar_t const* characters = sentence->_characters;
 			int character_ids_length = sentence->size();
@@ -329,52 +484,44 @@ namespace npycrf {
 
 				// 発火
 				int k_u = _crf->_extractor->feature_id_label_u(y_i);
-				assert(k_u != -1);
-				_grad_weight[k_u] += 1;
+				grad.add(k_u, 1);
 				int k_b = _crf->_extractor->feature_id_label_b(y_i_1, y_i);
-				assert(k_b != -1);
-				_grad_weight[k_b] += 1;
+				grad.add(k_b, 1);
 
 				// 発火の期待値
 				int k_0 = _crf->_extractor->feature_id_label_u(0);
-				assert(k_0 != -1);
 				int k_1 = _crf->_extractor->feature_id_label_u(1);
-				assert(k_1 != -1);
-				_grad_weight[k_0] -= pz_s(i - 1, 0, 0);
-				_grad_weight[k_0] -= pz_s(i - 1, 1, 0);
-				_grad_weight[k_1] -= pz_s(i - 1, 0, 1);
-				_grad_weight[k_1] -= pz_s(i - 1, 1, 1);
+				grad.add(k_0, -pz_s(i - 1, 0, 0));
+				grad.add(k_0, -pz_s(i - 1, 1, 0));
+				grad.add(k_1, -pz_s(i - 1, 0, 1));
+				grad.add(k_1, -pz_s(i - 1, 1, 1));
 
 				int k_0_0 = _crf->_extractor->feature_id_label_b(0, 0);
-				assert(k_0_0 != -1);
 				int k_0_1 = _crf->_extractor->feature_id_label_b(0, 1);
-				assert(k_0_1 != -1);
 				int k_1_0 = _crf->_extractor->feature_id_label_b(1, 0);
-				assert(k_1_0 != -1);
 				int k_1_1 = _crf->_extractor->feature_id_label_b(1, 1);
-				assert(k_1_1 != -1);
-				_grad_weight[k_0_0] -= pz_s(i - 1, 0, 0);
-				_grad_weight[k_0_1] -= pz_s(i - 1, 0, 1);
-				_grad_weight[k_1_0] -= pz_s(i - 1, 1, 0);
-				_grad_weight[k_1_1] -= pz_s(i - 1, 1, 1);
+				grad.add(k_0_0, -pz_s(i - 1, 0, 0));
+				grad.add(k_0_1, -pz_s(i - 1, 0, 1));
+				grad.add(k_1_0, -pz_s(i - 1, 1, 0));
+				grad.add(k_1_1, -pz_s(i - 1, 1, 1));
 			}
 		}
-		void SGD::backward_lambda_0(Sentence* sentence, mat::quad<double> &p_conc_tkji, mat::quad<double> &pw_h_tkji, int max_word_length){
+		void SGD::backward_lambda_0(Sentence* sentence, mat::quad<double> &p_conc_tkji, mat::quad<double> &pw_h_tkji, int max_word_length, Gradient &grad){
 			// 素性の発火
-			int t, k, j, i;
-			for(int n = 2;n < sentence->get_num_segments() - 1;n++){	// <eos>を除く
-				k = sentence->_segments[n];
-				t = sentence->_start[n] + k;
-				j = (t - k == 0) ? 0 : sentence->_segments[n - 1];
-				i = (t - k - j == 0) ? 0 : sentence->_segments[n - 2];
-				_grad_lambda_0 += log(pw_h_tkji(t, k, j, i));
+			int num_segments = sentence->get_num_segments();
+			for(int n = 2;n < num_segments - 1;n++){	// <eos>を除く
+				int k = sentence->_segments[n];
+				int t = sentence->_start[n] + k;
+				int j = (t - k == 0) ? 0 : sentence->_segments[n - 1];
+				int i = (t - k - j == 0) ? 0 : sentence->_segments[n - 2];
+				grad._lambda_0 += log(pw_h_tkji(t, k, j, i));
 			}
-			// <eos>
-			t += 1;
-			i = j;
-			j = k;
-			k = 1;
-			_grad_lambda_0 +=log(pw_h_tkji(t, k, j, i));
+			// <eos>の文脈は最後の2単語
+			int t = sentence->size() + 1;
+			int k = 1;
+			int j = sentence->_segments[num_segments - 2];
+			int i = (t - k - j == 0) ? 0 : sentence->_segments[num_segments - 3];
+			grad._lambda_0 += log(pw_h_tkji(t, k, j, i));
 
 			// 発火の期待値を引く
 			for(int t = 1;t <= sentence->size();t++){
@@ -384,7 +531,7 @@ namespace npycrf {
 							double p_conc = p_conc_tkji(t, k, j, i);
 							assert(pw_h_tkji(t, k, j, i) > 0);
 							assert(p_conc > 0);
-							_grad_lambda_0 -= p_conc * log(pw_h_tkji(t, k, j, i));
+							grad._lambda_0 -= p_conc * log(pw_h_tkji(t, k, j, i));
 						}
 					}
 				}
@@ -400,7 +547,33 @@ namespace npycrf {
 					double p_conc = p_conc_tkji(t, k, j, i);
 					assert(pw_h_tkji(t, k, j, i) > 0);
 					assert(p_conc > 0);
-					_grad_lambda_0 -= p_conc * log(pw_h_tkji(t, k, j, i));
+					grad._lambda_0 -= p_conc * log(pw_h_tkji(t, k, j, i));
+				}
+			}
+		}
+		// 2-gramのNPYLMの場合
+		void SGD::backward_lambda_0(Sentence* sentence, mat::tri<double> &p_conc_tkj, mat::tri<double> &pw_h_tkj, int max_word_length, Gradient &grad){
+			// 素性の発火
+			int num_segments = sentence->get_num_segments();
+			for(int n = 2;n < num_segments - 1;n++){	// <eos>を除く
+				int k = sentence->_segments[n];
+				int t = sentence->_start[n] + k;
+				int j = (t - k == 0) ? 0 : sentence->_segments[n - 1];
+				grad._lambda_0 += log(pw_h_tkj(t, k, j));
+			}
+			// <eos>の文脈は最後の単語
+			grad._lambda_0 += log(pw_h_tkj(sentence->size() + 1, 1, sentence->_segments[num_segments - 2]));
+
+			// 発火の期待値を引く
+			for(int t = 1;t <= sentence->size() + 1;t++){
+				int limit_k = (t == sentence->size() + 1) ? 1 : std::min(t, max_word_length);	// <eos>の長さは1
+				for(int k = 1;k <= limit_k;k++){
+					for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, max_word_length);j++){
+						double p_conc = p_conc_tkj(t, k, j);
+						assert(pw_h_tkj(t, k, j) > 0);
+						assert(p_conc > 0);
+						grad._lambda_0 -= p_conc * log(pw_h_tkj(t, k, j));
+					}
 				}
 			}
 		}
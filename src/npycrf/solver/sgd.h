@@ -1,4 +1,5 @@
 #pragma once
+#include <vector>
 #include "../common.h"
 #include "../sentence.h"
 #include "../crf/crf.h"
@@ -6,26 +7,64 @@
 
 namespace npycrf {
 	namespace solver {
+		// 1文ぶんの勾配
+		// 複数のスレッドで別々の文の勾配を求められるよう、素性IDと値の組を足す順に記録しておく
+		// 1文で発火する素性は全体のごく一部なので、全素性の配列をスレッドごとに持つより軽い
+		class Gradient {
+		public:
+			std::vector<int> _feature_ids;
+			std::vector<double> _values;
+			double _lambda_0;
+			Gradient();
+			void clear();
+			void add(int k, double value){
+				_feature_ids.push_back(k);
+				_values.push_back(value);
+			}
+		};
 		class SGD {
 		public:
 			crf::CRF* _crf;
-			double _regularization_constant;
+			double _regularization_constant;		// L2正則化
+			double _l1_regularization_constant;		// L1正則化. L2と併用するとelastic net
 			double _grad_bias;
 			npycrf::array<double> _grad_weight;
 			double _grad_lambda_0;
-			SGD(crf::CRF* crf, double regularization_constant);
+			// 勾配が0でない素性のみ更新する
+			std::vector<int> _active_feature_ids;		// ミニバッチ内で勾配を持つ素性
+			npycrf::array<bool> _active;
+			// L2正則化による重みの縮小は、その重みが次に使われるまで遅らせる
+			// _log_decay[s]はステップsまでの縮小率の対数の累積で、重みkはステップ_last_step[k]までの縮小が反映されている
+			std::vector<double> _log_decay;
+			npycrf::array<int> _last_step;
+			// L1正則化は累積ペナルティで切り詰める
+			// Tsuruoka et al., Stochastic Gradient Descent Training for L1-regularized Log-linear Models with Cumulative Penalty
+			// _cumulative_l1_penaltyはこれまでに各重みが受けるべきペナルティの合計、_l1_penalty_applied[k]は重みkが実際に受けたペナルティ
+			double _cumulative_l1_penalty;
+			npycrf::array<double> _l1_penalty_applied;
+			std::vector<Gradient> _batch_grads;		// ミニバッチ内の文ごとの勾配. バッチをまたいで使い回す
+			SGD(crf::CRF* crf, double regularization_constant, double l1_regularization_constant = 0);
 			~SGD();
 			void clear_grads();
+			void accumulate(Gradient &grad);
 			void update(double learning_rate);
-			void backward_crf(Sentence* sentence, mat::tri<double> &pz_s);
-			void backward_lambda_0(Sentence* sentence, mat::quad<double> &p_conc_tkji, mat::quad<double> &pw_h_tkji, int max_word_length);
-			void _backward_unigram(Sentence* sentence, mat::tri<double> &pz_s);
-			void _backward_bigram(Sentence* sentence, mat::tri<double> &pz_s);
-			void _backward_identical_1(Sentence* sentence, mat::tri<double> &pz_s);
-			void _backward_identical_2(Sentence* sentence, mat::tri<double> &pz_s);
-			void _backward_unigram_type(Sentence* sentence, mat::tri<double> &pz_s);
-			void _backward_bigram_type(Sentence* sentence, mat::tri<double> &pz_s);
-			void _backward_label(Sentence* sentence, mat::tri<double> &pz_s);
+			void apply_pending_decay(Sentence* sentence);
+			void apply_pending_decay();
+			bool _apply_pending_decay(int k);
+			void _apply_l1_penalty(int k);
+			void backward(Lattice* lattice, Sentence* sentence, bool pure_crf_mode, Gradient &grad);
+			void compute_batch_gradient(std::vector<Sentence*> &batch, std::vector<Lattice*> &lattices, bool pure_crf_mode);
+			void backward_crf(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad);
+			void backward_lambda_0(Sentence* sentence, mat::quad<double> &p_conc_tkji, mat::quad<double> &pw_h_tkji, int max_word_length, Gradient &grad);
+			void backward_lambda_0(Sentence* sentence, mat::tri<double> &p_conc_tkj, mat::tri<double> &pw_h_tkj, int max_word_length, Gradient &grad);
+			// 素性関数ごとに勾配を求める. テストでの確認用
+			void _backward_unigram(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad);
+			void _backward_bigram(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad);
+			void _backward_identical_1(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad);
+			void _backward_identical_2(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad);
+			void _backward_unigram_type(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad);
+			void _backward_bigram_type(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad);
+			void _backward_label(Sentence* sentence, mat::tri<double> &pz_s, Gradient &grad);
 		};
 	}
 }
\ No newline at end of file
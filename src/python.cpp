@@ -23,8 +23,11 @@ BOOST_PYTHON_MODULE(npycrf){
 	.def("get_size_train", &Dataset::get_size_train)
 	.def("get_size_dev", &Dataset::get_size_dev);
 
-	boost::python::class_<Trainer>("trainer", boost::python::init<Dataset*, Dataset*, Dictionary*, NPYCRF*, double>((args("dataset_labeled", "dataset_unlabeled", "dictionary", "npycrf", "crf_regularization_constant"))))
+	boost::python::class_<Trainer>("trainer", boost::python::init<Dataset*, Dataset*, Dictionary*, NPYCRF*, double, boost::python::optional<double>>((args("dataset_labeled", "dataset_unlabeled", "dictionary", "npycrf", "crf_regularization_constant", "crf_l1_regularization_constant"))))
 	.def("detect_hash_collision", &Trainer::detect_hash_collision)
+	.def("set_substring_word_id_precomputation", &Trainer::set_substring_word_id_precomputation)
+	.def("set_gibbs_batchsize", &Trainer::set_gibbs_batchsize)
+	.def("set_num_threads", &Trainer::set_num_threads)
 	.def("print_segmentation_labeled_train", &Trainer::print_segmentation_labeled_train)
 	.def("print_segmentation_unlabeled_train", &Trainer::print_segmentation_unlabeled_train)
 	.def("print_segmentation_labeled_dev", &Trainer::print_segmentation_labeled_dev)
@@ -45,10 +48,22 @@ BOOST_PYTHON_MODULE(npycrf){
 	.def("gibbs", &Trainer::gibbs, (arg("include_labeled_data")=false));
 
 	boost::python::class_<NPYCRF>("npycrf", boost::python::init<model::NPYLM*, model::CRF*>((args("npylm", "crf"))))
-	.def("parse", &NPYCRF::python_parse);
+	.def("parse", &NPYCRF::python_parse)
+	.def("parse_batch", &NPYCRF::python_parse_batch)
+	.def("set_log_domain_mode", &NPYCRF::set_log_domain_mode,
+		"Run the forward-backward passes in log space instead of with per-position scaling. "
+		"Use it when scaled mode underflows on long sentences; it is not faster than scaled mode (see test/running_tests/log_domain.cpp).")
+	.def("set_viterbi_only_mode", &NPYCRF::set_viterbi_only_mode)
+	.def("set_viterbi_window", &NPYCRF::set_viterbi_window,
+		"Decode on a ring buffer of num_columns lattice columns (0 disables it). "
+		"If the buffer fills before all paths converge, a convergence point is forced and the segmentation is only approximately Viterbi; "
+		"check get_viterbi_num_forced() after parsing.")
+	.def("get_viterbi_num_forced", &NPYCRF::get_viterbi_num_forced,
+		"Number of convergence points forced by the last parse or parse_batch call. 0 means the result equals exact Viterbi decoding.")
+	.def("set_g0_cache_capacity", &NPYCRF::set_g0_cache_capacity);
 
 	boost::python::class_<model::CRF>("crf", 
-		boost::python::init<Dataset*, int, int, int, int, int, int, int, int, int, double, double>(
+		boost::python::init<Dataset*, int, int, int, int, int, int, int, int, int, double, double, boost::python::optional<int, boost::python::dict>>(
 			(args("dataset_labeled",
 					"num_character_ids", 
 					"feature_x_unigram_start", 
@@ -60,16 +75,21 @@ BOOST_PYTHON_MODULE(npycrf){
 					"feature_x_identical_2_start", 
 					"feature_x_identical_2_end", 
 					"initial_lambda_0", 
-					"sigma"))
+					"sigma",
+					"feature_hash_bits",
+					"feature_min_count"))
 		)
 	)
 	.def(boost::python::init<std::string>())
 	.def("get_num_features", &model::CRF::get_num_features)
+	.def("get_num_zero_weights", &model::CRF::get_num_zero_weights)
 	.def("get_lambda_0", &model::CRF::get_lambda_0)
 	.def("save", &model::CRF::save)
+	.def("save_quantized", &model::CRF::save_quantized, (arg("filename"), arg("bits")=8, arg("threshold")=0.0))
 	.def("load", &model::CRF::load);
 
 	boost::python::class_<model::NPYLM>("npylm", boost::python::init<int, double, double, double, double, double>((args("max_word_length", "g0", "initial_lambda_a", "initial_lambda_b", "vpylm_beta_stop", "vpylm_beta_pass"))))
+	.def(boost::python::init<int, double, double, double, double, double, int>((args("max_word_length", "g0", "initial_lambda_a", "initial_lambda_b", "vpylm_beta_stop", "vpylm_beta_pass", "ngram"))))
 	.def(boost::python::init<std::string>())
 	.def("parse", &model::NPYLM::python_parse)
 	.def("save", &model::NPYLM::save)
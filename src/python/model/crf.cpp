@@ -1,5 +1,7 @@
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 #include "crf.h"
 #include "../../npycrf/common.h"
 #include "../../npycrf/ctype.h"
@@ -20,9 +22,45 @@ namespace npycrf {
 					 int feature_x_identical_2_start,
 					 int feature_x_identical_2_end,
 					 double initial_lambda_0,
-					 double sigma)
+					 double sigma,
+					 int feature_hash_bits,
+					 boost::python::dict feature_min_count)
 			{
-				FeatureExtractor* extractor = new FeatureExtractor(num_character_ids, 
+				// 素性IDはintなので2^30個まで
+				if(feature_hash_bits < 0 || feature_hash_bits > 30){
+					throw std::invalid_argument("feature_hash_bits must be between 0 and 30.");
+				}
+				// 素性テンプレートごとの出現回数の閾値
+				// 綴りを間違えたキーで刈り込みが黙って無効にならないよう、知らないキーは受け付けない
+				int min_count[FEATURE_NUM_TEMPLATES];
+				bool prune = false;
+				const char* template_names[FEATURE_NUM_TEMPLATES] = {"label", "unigram", "bigram", "identical", "type"};
+				boost::python::list keys = feature_min_count.keys();
+				for(int n = 0;n < boost::python::len(keys);n++){
+					boost::python::extract<std::string> key(keys[n]);
+					bool found = false;
+					if(key.check()){
+						for(int feature_template = 0;feature_template < FEATURE_NUM_TEMPLATES;feature_template++){
+							if(key() == template_names[feature_template]){
+								found = true;
+								break;
+							}
+						}
+					}
+					if(found == false){
+						throw std::invalid_argument("feature_min_count keys must be one of label, unigram, bigram, identical and type.");
+					}
+				}
+				for(int feature_template = 0;feature_template < FEATURE_NUM_TEMPLATES;feature_template++){
+					min_count[feature_template] = boost::python::extract<int>(feature_min_count.get(template_names[feature_template], 1));
+					if(min_count[feature_template] < 1){
+						throw std::invalid_argument("feature_min_count values must be at least 1.");
+					}
+					if(min_count[feature_template] > 1){
+						prune = true;
+					}
+				}
+				FeatureExtractor* extractor = new FeatureExtractor(num_character_ids,
 																	CTYPE_NUM_TYPES,
 																	feature_x_unigram_start,
 																	feature_x_unigram_end,
@@ -31,17 +69,39 @@ namespace npycrf {
 																	feature_x_identical_1_start,
 																	feature_x_identical_1_end,
 																	feature_x_identical_2_start,
-																	feature_x_identical_2_end);
+																	feature_x_identical_2_end,
+																	feature_hash_bits);
 
-				for(Sentence* sentence: dataset_labeled->_sentences_train){
-					assert(sentence->_features == NULL);
-					sentence->_features = extractor->extract(sentence, true);
+				if(prune && feature_hash_bits > 0){
+					std::cout << "feature_min_count is ignored in hashing mode." << std::endl;
+					prune = false;
 				}
-				for(Sentence* sentence: dataset_labeled->_sentences_dev){
+
+				std::vector<Sentence*> sentences;
+				sentences.insert(sentences.end(), dataset_labeled->_sentences_train.begin(), dataset_labeled->_sentences_train.end());
+				sentences.insert(sentences.end(), dataset_labeled->_sentences_dev.begin(), dataset_labeled->_sentences_dev.end());
+				if(prune){
+					// 1周目で出現回数を数え、2周目で閾値以上の素性関数にだけ素性IDを割り当てる
+					hashmap<int64_t, int> counts;
+					for(Sentence* sentence: sentences){
+						extractor->count_function_ids(sentence, counts);
+					}
+					for(Sentence* sentence: sentences){
+						extractor->register_frequent_function_ids(sentence, counts, min_count);
+					}
+					int num_seen[FEATURE_NUM_TEMPLATES];
+					int num_kept[FEATURE_NUM_TEMPLATES];
+					extractor->count_features_per_template(counts, num_seen, num_kept);
+					std::cout << "template\tmin_count\tkept\tdropped" << std::endl;
+					for(int feature_template = 0;feature_template < FEATURE_NUM_TEMPLATES;feature_template++){
+						std::cout << template_names[feature_template] << "\t" << min_count[feature_template] << "\t" << num_kept[feature_template] << "\t" << (num_seen[feature_template] - num_kept[feature_template]) << std::endl;
+					}
+				}
+				for(Sentence* sentence: sentences){
 					assert(sentence->_features == NULL);
-					sentence->_features = extractor->extract(sentence, true);
+					sentence->_features = extractor->extract(sentence, prune == false);
 				}
-				int weight_size = extractor->_function_id_to_feature_id.size();
+				int weight_size = extractor->get_num_features();
 				std::cout << "weight_size = " << weight_size << std::endl;
 				crf::Parameter* parameter = new crf::Parameter(weight_size, initial_lambda_0, sigma);
 				_crf = new crf::CRF(extractor, parameter);
@@ -59,6 +119,9 @@ namespace npycrf {
 			int CRF::get_num_features(){
 				return _crf->_parameter->get_num_features();
 			}
+			int CRF::get_num_zero_weights(){
+				return _crf->_parameter->get_num_zero_weights();
+			}
 			double CRF::get_lambda_0(){
 				return _crf->_parameter->_lambda_0;
 			}
@@ -78,7 +141,31 @@ namespace npycrf {
 				std::ofstream ofs(filename);
 				if(ofs.good()){
 					boost::archive::binary_oarchive oarchive(ofs);
-					oarchive << *_crf;
+					if(_crf->_parameter->_quantized != NULL){
+						oarchive << *_crf;
+					}else{
+						crf::CRF* compact_crf = _crf->copy_without_zero_weights();	// 重みが0の素性は保存しない
+						oarchive << *compact_crf;
+						delete compact_crf;
+					}
+					success = true;
+				}
+				ofs.close();
+				return success;
+			}
+			// 重みをbitsビットの整数に量子化して保存する. 読み込んだモデルは分割にのみ使える
+			bool CRF::save_quantized(std::string filename, int bits, double threshold){
+				// 空のファイルを作らないように書き込む前に確認する
+				if(bits != 8 && bits != 16){
+					throw std::invalid_argument("bits must be 8 or 16.");
+				}
+				bool success = false;
+				std::ofstream ofs(filename);
+				if(ofs.good()){
+					boost::archive::binary_oarchive oarchive(ofs);
+					crf::CRF* quantized_crf = _crf->copy_quantized(bits, threshold);
+					oarchive << *quantized_crf;
+					delete quantized_crf;
 					success = true;
 				}
 				ofs.close();
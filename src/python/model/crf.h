@@ -21,13 +21,17 @@ namespace npycrf {
 					int feature_x_identical_2_start,
 					int feature_x_identical_2_end,
 					double initial_lambda_0,
-					double sigma);
+					double sigma,
+					int feature_hash_bits = 0,		// 0でなければ素性を2^feature_hash_bits個の重みにハッシュする
+					boost::python::dict feature_min_count = boost::python::dict());	// 素性テンプレート名から出現回数の閾値. 未満の素性は作らない
 				CRF(std::string filename);
 				~CRF();
 				int get_num_features();
+				int get_num_zero_weights();
 				double get_lambda_0();
 				bool load(std::string filename);
 				bool save(std::string filename);
+				bool save_quantized(std::string filename, int bits, double threshold);
 			};
 		}
 	}
@@ -1,5 +1,6 @@
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
 #include "../../npycrf/common.h"
 #include "npylm.h"
 
@@ -14,8 +15,17 @@ namespace npycrf {
 						 double vpylm_beta_pass)	// VPYLMのハイパーパラメータ
 			{
 				_npylm = new npylm::NPYLM(max_word_length, 100, g0, initial_lambda_a, initial_lambda_b, vpylm_beta_stop, vpylm_beta_pass);
-				_lattice = new Lattice(_npylm, NULL);
-				_lattice->set_pure_npylm_mode(true);
+				_context = new InferenceContext(_npylm, NULL);
+			}
+			// ngram=2なら単語2-gramのNPYLMになる
+			// 分割の計算量がO(N・L^3)からO(N・L^2)に減る
+			NPYLM::NPYLM(int max_word_length, double g0, double initial_lambda_a, double initial_lambda_b, double vpylm_beta_stop, double vpylm_beta_pass, int ngram){
+				// HPYLMの深さとキャッシュは3-gramまでしか確保しない
+				if(ngram != 2 && ngram != 3){
+					throw std::invalid_argument("ngram must be 2 or 3.");
+				}
+				_npylm = new npylm::NPYLM(max_word_length, 100, g0, initial_lambda_a, initial_lambda_b, vpylm_beta_stop, vpylm_beta_pass, ngram);
+				_context = new InferenceContext(_npylm, NULL);
 			}
 			NPYLM::NPYLM(std::string filename){
 				_npylm = new npylm::NPYLM();
@@ -23,10 +33,10 @@ namespace npycrf {
 					std::cout << filename << " not found." << std::endl;
 					exit(0);
 				}
-				_lattice = new Lattice(_npylm, NULL);
-				_lattice->set_pure_npylm_mode(true);
+				_context = new InferenceContext(_npylm, NULL);
 			}
 			NPYLM::~NPYLM(){
+				delete _context;
 				delete _npylm;
 			}
 			bool NPYLM::load(std::string filename){
@@ -52,18 +62,9 @@ namespace npycrf {
 				return success;
 			}
 			void NPYLM::parse(Sentence* sentence){
-				// キャッシュの再確保
-				_lattice->reserve(_npylm->_max_word_length, sentence->size());
-				_npylm->reserve(sentence->size());
-				std::vector<int> segments;		// 分割の一時保存用
-				_lattice->viterbi_decode(sentence, segments);
-				sentence->split(segments);
+				_context->parse(sentence);
 			}
 			boost::python::list NPYLM::python_parse(std::wstring sentence_str, Dictionary* dictionary){
-				// キャッシュの再確保
-				_lattice->reserve(_npylm->_max_word_length, sentence_str.size());
-				_npylm->reserve(sentence_str.size());
-				std::vector<int> segments;		// 分割の一時保存用
 				// 構成文字を文字IDに変換
 				array<int> character_ids = array<int>(sentence_str.size());
 				for(int i = 0;i < sentence_str.size();i++){
@@ -72,8 +73,7 @@ namespace npycrf {
 					character_ids[i] = character_id;
 				}
 				Sentence* sentence = new Sentence(sentence_str, character_ids);
-				_lattice->viterbi_decode(sentence, segments);
-				sentence->split(segments);
+				_context->parse(sentence);
 				boost::python::list words;
 				for(int n = 0;n < sentence->get_num_segments_without_special_tokens();n++){
 					std::wstring word = sentence->get_word_str_at(n + 2);
@@ -2,6 +2,7 @@
 #include <boost/python.hpp>
 #include "../../npycrf/npylm/npylm.h"
 #include "../../npycrf/lattice.h"
+#include "../../npycrf/context.h"
 #include "../dictionary.h"
 
 namespace npycrf {
@@ -10,13 +11,20 @@ namespace npycrf {
 			class NPYLM{
 			public:
 				npylm::NPYLM* _npylm;
-				Lattice* _lattice;
+				InferenceContext* _context;
 				NPYLM(int max_word_length, 
 					  double g0, 
 					  double initial_lambda_a, 
 					  double initial_lambda_b, 
 					  double vpylm_beta_stop, 
 					  double vpylm_beta_pass);
+				NPYLM(int max_word_length, 
+					  double g0, 
+					  double initial_lambda_a, 
+					  double initial_lambda_b, 
+					  double vpylm_beta_stop, 
+					  double vpylm_beta_pass, 
+					  int ngram);
 				NPYLM(std::string filename);
 				~NPYLM();
 				void parse(Sentence* sentence);
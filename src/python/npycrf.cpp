@@ -1,4 +1,8 @@
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
 #include "../npycrf/common.h"
 #include "../npycrf/array.h"
 #include "npycrf.h"
@@ -9,14 +13,31 @@ using namespace npycrf::crf::feature;
 
 namespace npycrf {
 	namespace python {
+		// スコープを抜けるときに例外が飛んでいても必ずGILを取り直す
+		class ScopedGILRelease{
+		private:
+			PyThreadState* _thread_state;
+		public:
+			ScopedGILRelease(){
+				_thread_state = PyEval_SaveThread();
+			}
+			~ScopedGILRelease(){
+				PyEval_RestoreThread(_thread_state);
+			}
+			ScopedGILRelease(const ScopedGILRelease &) = delete;
+			ScopedGILRelease &operator=(const ScopedGILRelease &) = delete;
+		};
 		NPYCRF::NPYCRF(model::NPYLM* py_npylm, model::CRF* py_crf){
 			_set_locale();
 			_npylm = py_npylm->_npylm;
 			_crf = py_crf->_crf;
-			_lattice = new Lattice(_npylm, _crf);
+			// 分割に必要なテーブルのみ確保する. 学習時はTrainerがset_viterbi_only_mode(false)にする
+			_context = new InferenceContext(_npylm, _crf);
+			_lattice = _context->_lattice;
+			_viterbi_num_forced = 0;
 		}
 		NPYCRF::~NPYCRF(){
-			delete _lattice;
+			delete _context;
 		}
 		// 日本語周り
 		void NPYCRF::_set_locale(){
@@ -41,9 +62,11 @@ namespace npycrf {
 		}
 		void NPYCRF::set_vpylm_beta_stop(double stop){
 			_npylm->_vpylm->_beta_stop = stop;
+			_npylm->_vpylm->_version++;
 		}
 		void NPYCRF::set_vpylm_beta_pass(double pass){
 			_npylm->_vpylm->_beta_pass = pass;
+			_npylm->_vpylm->_version++;
 		}
 		double NPYCRF::get_lambda_0(){
 			return _crf->_parameter->_lambda_0;
@@ -51,6 +74,28 @@ namespace npycrf {
 		void NPYCRF::set_lambda_0(double lambda_0){
 			_crf->_parameter->_lambda_0 = lambda_0;
 		}
+		// 分割しかしない場合は学習用のテーブルを確保しない
+		void NPYCRF::set_viterbi_only_mode(bool enabled){
+			_lattice->set_viterbi_only_mode(enabled);
+		}
+		// 長い文書を分割する場合はビタビアルゴリズムをリングバッファ上で行う
+		// 列数が少ないと全ての経路が合流する前にバッファが一杯になり、合流点を強制するので分割は近似になる
+		void NPYCRF::set_viterbi_window(int num_columns){
+			_lattice->set_viterbi_window(num_columns);
+		}
+		// 0なら直前の分割は通常のビタビアルゴリズムと同じ
+		int NPYCRF::get_viterbi_num_forced(){
+			return _viterbi_num_forced;
+		}
+		// 文をまたぐg0のキャッシュの最大単語数. 0なら使わない
+		void NPYCRF::set_g0_cache_capacity(int capacity){
+			assert(capacity >= 0);
+			_npylm->_g0_cache.set_capacity(capacity);
+		}
+		// 長い文でスケーリングが不安定な場合は対数領域で計算する
+		void NPYCRF::set_log_domain_mode(bool enabled){
+			_lattice->set_log_domain_mode(enabled);
+		}
 		// 分配関数の計算
 		double NPYCRF::compute_normalizing_constant(Sentence* sentence){
 			if(with(sentence)){
@@ -108,29 +153,119 @@ namespace npycrf {
 			_npylm->clear_g0_cache(sentence->size());
 			return true;
 		}
+		// 分割時はモデルのキャッシュを使わない
 		void NPYCRF::parse(Sentence* sentence){
-			if(with(sentence)){
-				sentence->_features = _crf->extract_features(sentence, false);		// CRFの素性IDを展開
-				std::vector<int> segments;		// 分割の一時保存用
-				_lattice->viterbi_decode(sentence, segments);
-				sentence->split(segments);
-			}
+			_context->parse(sentence);
+			_viterbi_num_forced = _lattice->_viterbi_num_forced;
 		}
 		boost::python::list NPYCRF::python_parse(std::wstring sentence_str, Dictionary* dictionary){
 			Sentence* sentence = sentence::from_wstring(sentence_str, dictionary);
 			boost::python::list words;		// 単語をpythonのリストに入れる
-			std::vector<int> segments;		// 分割の一時保存用
-			if(with(sentence)){
-				sentence->_features = _crf->extract_features(sentence, false);		// CRFの素性IDを展開
-				_lattice->viterbi_decode(sentence, segments);
-				sentence->split(segments);
-				for(int n = 0;n < sentence->get_num_segments_without_special_tokens();n++){
-					std::wstring word = sentence->get_word_str_at(n + 2);
-					words.append(word);
-				}
+			parse(sentence);
+			for(int n = 0;n < sentence->get_num_segments_without_special_tokens();n++){
+				std::wstring word = sentence->get_word_str_at(n + 2);
+				words.append(word);
 			}
 			delete sentence;
 			return words;
 		}
+		// 複数の文をまとめて分割
+		// スレッドごとにInferenceContextを作り、モデルは共有する
+		void NPYCRF::parse_batch(std::vector<Sentence*> &sentences, int num_threads){
+			int num_sentences = sentences.size();
+			if(num_threads <= 0){
+				num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+			}
+			num_threads = std::min(num_threads, num_sentences);
+			_viterbi_num_forced = 0;
+			// 呼び出し側はGILを解放しているので、1スレッドでも共有の_contextは使わない
+			if(num_threads <= 1){
+				InferenceContext context(_npylm, _crf);
+				context._lattice->set_viterbi_window(_lattice->get_viterbi_window());
+				for(Sentence* sentence: sentences){
+					context.parse(sentence);
+					_viterbi_num_forced += context._lattice->_viterbi_num_forced;
+				}
+				return;
+			}
+			// 長い文から順に取り出すことで最後に長い文が残らないようにする
+			std::vector<int> order(num_sentences);
+			for(int i = 0;i < num_sentences;i++){
+				order[i] = i;
+			}
+			std::stable_sort(order.begin(), order.end(), [&sentences](int a, int b){
+				return sentences[a]->size() > sentences[b]->size();
+			});
+			std::atomic<int> next(0);
+			// ワーカーで投げられた例外はjoinの後に呼び出し元のスレッドで投げ直す
+			std::vector<std::exception_ptr> errors(num_threads);
+			std::vector<int> num_forced(num_threads, 0);	// スレッドごとの合流点を強制した回数
+			std::vector<std::thread> workers;
+			for(int n = 0;n < num_threads;n++){
+				workers.emplace_back([this, &sentences, &order, &next, &errors, &num_forced, num_sentences, n](){
+					try{
+						InferenceContext context(_npylm, _crf);
+						context._lattice->set_viterbi_window(_lattice->get_viterbi_window());
+						context.reserve(sentences[order[0]]->size());
+						while(true){
+							int i = next.fetch_add(1);
+							if(i >= num_sentences){
+								break;
+							}
+							context.parse(sentences[order[i]]);
+							num_forced[n] += context._lattice->_viterbi_num_forced;
+						}
+					}catch(...){
+						errors[n] = std::current_exception();
+						next.store(num_sentences);	// 他のワーカーも止める
+					}
+				});
+			}
+			for(std::thread &worker: workers){
+				worker.join();
+			}
+			for(int n = 0;n < num_threads;n++){
+				_viterbi_num_forced += num_forced[n];
+			}
+			for(std::exception_ptr &error: errors){
+				if(error){
+					std::rethrow_exception(error);
+				}
+			}
+		}
+		boost::python::list NPYCRF::python_parse_batch(boost::python::list py_sentences, Dictionary* dictionary, int num_threads){
+			int num_sentences = boost::python::len(py_sentences);
+			std::vector<Sentence*> sentences;
+			sentences.reserve(num_sentences);
+			boost::python::list result;
+			try{
+				for(int i = 0;i < num_sentences;i++){
+					std::wstring sentence_str = boost::python::extract<std::wstring>(py_sentences[i]);
+					sentences.push_back(sentence::from_wstring(sentence_str, dictionary));
+				}
+				{
+					// 分割中はPythonのオブジェクトに触らないのでGILを解放する
+					ScopedGILRelease release;
+					parse_batch(sentences, num_threads);
+				}
+				for(Sentence* sentence: sentences){
+					boost::python::list words;
+					for(int n = 0;n < sentence->get_num_segments_without_special_tokens();n++){
+						std::wstring word = sentence->get_word_str_at(n + 2);
+						words.append(word);
+					}
+					result.append(words);
+				}
+			}catch(...){
+				for(Sentence* sentence: sentences){
+					delete sentence;
+				}
+				throw;
+			}
+			for(Sentence* sentence: sentences){
+				delete sentence;
+			}
+			return result;
+		}
 	}
 }
\ No newline at end of file
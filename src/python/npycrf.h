@@ -2,6 +2,7 @@
 #include <boost/python.hpp>
 #include "../npycrf/npylm/npylm.h"
 #include "../npycrf/lattice.h"
+#include "../npycrf/context.h"
 #include "dataset.h"
 #include "dictionary.h"
 #include "model/npylm.h"
@@ -15,7 +16,9 @@ namespace npycrf {
 		public:
 			npylm::NPYLM* _npylm;
 			crf::CRF* _crf;
-			Lattice* _lattice;			// forward filtering-backward sampling
+			InferenceContext* _context;	// 分割用の作業領域
+			Lattice* _lattice;			// forward filtering-backward sampling. _contextのものを共有する
+			int _viterbi_num_forced;	// 直前のparseかparse_batchでリングバッファの合流点を強制した回数の合計
 			NPYCRF(model::NPYLM* py_npylm, model::CRF* py_crf);
 			~NPYCRF();
 			int get_max_word_length();
@@ -25,6 +28,11 @@ namespace npycrf {
 			void set_vpylm_beta_pass(double pass);
 			double get_lambda_0();
 			void set_lambda_0(double lambda_0);
+			void set_log_domain_mode(bool enabled);
+			void set_viterbi_only_mode(bool enabled);
+			void set_viterbi_window(int num_columns);
+			int get_viterbi_num_forced();
+			void set_g0_cache_capacity(int capacity);
 			double compute_log_proportional_p_y_given_sentence(Sentence* sentence);
 			double compute_normalizing_constant(Sentence* sentence);
 			double compute_log_normalizing_constant(Sentence* sentence);
@@ -32,6 +40,8 @@ namespace npycrf {
 			bool with(Sentence* sentence);
 			void parse(Sentence* sentence);
 			boost::python::list python_parse(std::wstring sentence_str, Dictionary* dictionary);
+			void parse_batch(std::vector<Sentence*> &sentences, int num_threads);
+			boost::python::list python_parse_batch(boost::python::list py_sentences, Dictionary* dictionary, int num_threads);
 		};
 	}
 }
\ No newline at end of file
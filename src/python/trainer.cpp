@@ -4,6 +4,8 @@
 #include <iomanip>
 #include <cmath>
 #include <iostream>
+#include <atomic>
+#include <thread>
 #include "../npycrf/sampler.h"
 #include "../npycrf/wordtype.h"
 #include "../npycrf/hash.h"
@@ -11,14 +13,16 @@
 
 namespace npycrf {
 	namespace python {
-		Trainer::Trainer(Dataset* dataset_l, Dataset* dataset_u, Dictionary* dict, NPYCRF* npycrf, double crf_regularization_constant){
+		Trainer::Trainer(Dataset* dataset_l, Dataset* dataset_u, Dictionary* dict, NPYCRF* npycrf, double crf_regularization_constant, double crf_l1_regularization_constant){
 			_dataset_l = dataset_l;
 			_dataset_u = dataset_u;
 			_dict = dict;
 			_npycrf = npycrf;
-			_sgd = new solver::SGD(npycrf->_crf, crf_regularization_constant);
+			_sgd = new solver::SGD(npycrf->_crf, crf_regularization_constant, crf_l1_regularization_constant);
 			_vpylm_sampling_probability_table = array<double>(_dict->get_num_characters() + 1);	// </s>を含む
 			_total_gibbs_iterations = 0;
+			_gibbs_batchsize = 1;
+			_num_threads = 0;
 
 			// 教師なしデータ
 			int num_data = dataset_u->get_size_train();
@@ -83,8 +87,44 @@ namespace npycrf {
 			int max_word_length = npycrf->_npylm->_max_word_length;
 			int max_sentence_length = std::max(dataset_l->get_max_sentence_length(), dataset_u->get_max_sentence_length());
 			npycrf->_npylm->reserve(max_sentence_length);
+			npycrf->_lattice->set_viterbi_only_mode(false);	// 学習には全てのテーブルが必要
 			npycrf->_lattice->reserve(max_word_length, max_sentence_length);
 		}
+		Trainer::~Trainer(){
+			for(InferenceContext* context: _gibbs_contexts){
+				delete context;
+			}
+			for(InferenceContext* context: _sgd_contexts){
+				delete context;
+			}
+		}
+		// 全ての文の部分文字列のIDを前計算して反復をまたいで使う
+		// 文ごとに文字数×(L+1)のIDを持ち続けるので標準では無効. falseにすると捨てて毎回ハッシュを計算する
+		void Trainer::set_substring_word_id_precomputation(bool enabled){
+			int max_word_length = _npycrf->_npylm->_max_word_length;
+			auto apply = [enabled, max_word_length](std::vector<Sentence*> &sentences){
+				for(Sentence* sentence: sentences){
+					if(enabled){
+						sentence->enumerate_substr_word_ids(max_word_length);
+					}else{
+						sentence->clear_substr_word_ids();
+					}
+				}
+			};
+			apply(_dataset_l->_sentences_train);
+			apply(_dataset_l->_sentences_dev);
+			apply(_dataset_u->_sentences_train);
+			apply(_dataset_u->_sentences_dev);
+		}
+		// 1ならこれまで通り1文ずつサンプリングしてはモデルを更新する
+		void Trainer::set_gibbs_batchsize(int batchsize){
+			assert(batchsize > 0);
+			_gibbs_batchsize = batchsize;
+		}
+		void Trainer::set_num_threads(int num_threads){
+			assert(num_threads >= 0);
+			_num_threads = num_threads;
+		}
 		// HPYLM,VPYLMのdとthetaをサンプリング
 		void Trainer::sample_hpylm_vpylm_hyperparameters(){
 			_npycrf->_npylm->sample_hpylm_vpylm_hyperparameters();
@@ -124,7 +164,7 @@ namespace npycrf {
 			enumerate_words(_dataset_u->_sentences_train);
 			for(int type = 1;type <= WORDTYPE_NUM_TYPES;type++){
 				double lambda = sampler::gamma(a_for_type[type], b_for_type[type]);
-				npylm->_lambda_for_type[type] = lambda;
+				npylm->set_lambda_for_type(type, lambda);
 			}
 		}
 		// VPYLMに文脈を渡し次の文字を生成
@@ -260,6 +300,16 @@ namespace npycrf {
 			// 教師なしデータでモデルパラメータを更新
 			std::vector<int> segments;		// 分割の一時保存用
 			shuffle(_rand_indices_train_u.begin(), _rand_indices_train_u.end(), sampler::mt);		// データをシャッフル
+			if(_gibbs_batchsize > 1){
+				if(_gibbs_unlabeled_batch() == false){	// ctrl+cで中断された
+					return;
+				}
+				if(include_labeled_data){
+					_gibbs_labeled();
+				}
+				_total_gibbs_iterations += 1;
+				return;
+			}
 			auto start_time = std::chrono::system_clock::now();
 			for(int i = 0;i < _rand_indices_train_u.size();i++){
 				if (PyErr_CheckSignals() != 0) {	// ctrl+cが押されたかチェック
@@ -338,6 +388,110 @@ namespace npycrf {
 
 			_total_gibbs_iterations += 1;
 		}
+		// 教師なしデータをミニバッチごとに並列にサンプリング
+		// バッチ内の文の古い分割を全て取り除いたモデルを固定し、各スレッドはそのモデルから分割をサンプリングするだけにする
+		// 新しい分割のモデルへの追加はバッチの順に1スレッドで行う
+		// 乱数のシードは文ごとにsampler::mtから引くので、結果はスレッド数によらない
+		// ctrl+cで中断された場合はfalseを返す
+		bool Trainer::_gibbs_unlabeled_batch(){
+			npylm::NPYLM* npylm = _npycrf->_npylm;
+			int num_data = _rand_indices_train_u.size();
+			int num_threads = _num_threads;
+			if(num_threads <= 0){
+				num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+			}
+			num_threads = std::min(num_threads, _gibbs_batchsize);
+			int max_sentence_length = _dataset_u->get_max_sentence_length();
+			// 作業領域はスレッドごとに持ち、反復をまたいで使い回す
+			while((int)_gibbs_contexts.size() < num_threads){
+				InferenceContext* context = new InferenceContext(npylm, _npycrf->_crf, false);
+				context->reserve(max_sentence_length);
+				_gibbs_contexts.push_back(context);
+			}
+			std::vector<InferenceContext*> &contexts = _gibbs_contexts;
+			for(int n = 0;n < num_threads;n++){
+				contexts[n]->_lattice->set_log_domain_mode(_npycrf->_lattice->get_log_domain_mode());
+			}
+			bool interrupted = false;
+			std::vector<Sentence*> batch;
+			std::vector<std::vector<int>> segments_of_batch(_gibbs_batchsize);
+			std::vector<unsigned int> seeds(_gibbs_batchsize);
+			auto start_time = std::chrono::system_clock::now();
+			for(int batch_start = 0;batch_start < num_data;batch_start += _gibbs_batchsize){
+				if (PyErr_CheckSignals() != 0) {	// ctrl+cが押されたかチェック
+					interrupted = true;
+					break;
+				}
+				int batch_end = std::min(batch_start + _gibbs_batchsize, num_data);
+				// 古い分割をモデルから削除
+				// まだモデルに追加されていない文はサンプリングせずに初期の分割をそのまま追加する
+				batch.clear();
+				for(int i = batch_start;i < batch_end;i++){
+					int data_index = _rand_indices_train_u[i];
+					assert(data_index < _dataset_u->get_size_train());
+					Sentence* sentence = _dataset_u->_sentences_train[data_index];
+					assert(sentence->_features != NULL);
+					if(_added_to_npylm_u[data_index] == true){
+						_npycrf->with(sentence);	// g0のキャッシュは文ごとに消す
+						for(int t = 2;t < sentence->get_num_segments();t++){
+							npylm->remove_customer_at_time_t(sentence, t);
+						}
+						seeds[batch.size()] = sampler::mt();
+						batch.push_back(sentence);
+					}
+				}
+				// 固定したモデルから並列にサンプリング
+				int batch_size = batch.size();
+				std::atomic<int> next(0);
+				auto sample = [this, &batch, &segments_of_batch, &seeds, &next, batch_size](InferenceContext* context){
+					std::mt19937 mt;
+					while(true){
+						int b = next.fetch_add(1);
+						if(b >= batch_size){
+							break;
+						}
+						mt.seed(seeds[b]);
+						context->blocked_gibbs(batch[b], segments_of_batch[b], mt);
+					}
+				};
+				int num_workers = std::min(num_threads, batch_size);
+				if(num_workers <= 1){
+					sample(contexts[0]);
+				}else{
+					std::vector<std::thread> workers;
+					for(int n = 0;n < num_workers;n++){
+						workers.emplace_back(sample, contexts[n]);
+					}
+					for(std::thread &worker: workers){
+						worker.join();
+					}
+				}
+				for(int b = 0;b < batch_size;b++){
+					batch[b]->split(segments_of_batch[b]);
+				}
+				// 新しい分割結果をバッチの順にモデルに追加
+				for(int i = batch_start;i < batch_end;i++){
+					int data_index = _rand_indices_train_u[i];
+					Sentence* sentence = _dataset_u->_sentences_train[data_index];
+					_npycrf->with(sentence);
+					for(int t = 2;t < sentence->get_num_segments();t++){
+						npylm->add_customer_at_time_t(sentence, t);
+					}
+					_added_to_npylm_u[data_index] = true;
+				}
+
+				auto diff = std::chrono::system_clock::now() - start_time;
+				double elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(diff).count() / 1000.0;
+				double gibbs_per_sec = (double)batch_end / elapsed_time;
+				double percent = (double)batch_end / (double)num_data * 100.0;
+				std::cout << "\r\033[2K" << batch_end << "/" << num_data << " (" << std::fixed << std::setprecision(2) << percent << "%) " << gibbs_per_sec << " gibbs/s" << std::flush;
+			}
+			std::cout << "\r\033[2K" << std::flush;
+
+			// 客数チェック
+			assert(npylm->_hpylm->_root->_num_tables <= npylm->_vpylm->get_num_customers());
+			return interrupted == false;
+		}
 		void Trainer::add_labeled_data_to_npylm(){
 			_gibbs_labeled();
 		}
@@ -377,46 +531,54 @@ namespace npycrf {
 				}
 			}
 		}
+		// ミニバッチ内の各文の勾配は複数のスレッドで並列に求める
+		// 勾配は文ごとのバッファに記録しておき、文の順に足し込むので結果はスレッド数によらない
 		void Trainer::sgd(double learning_rate, int batchsize, bool pure_crf_mode){
 			shuffle(_rand_indices_train_l.begin(), _rand_indices_train_l.end(), sampler::mt);		// データをシャッフル
 			int total_batches = (double)_rand_indices_train_l.size() / (double)batchsize + ((_rand_indices_train_l.size() % batchsize) ? 1 : 0);
+			int num_threads = _num_threads;
+			if(num_threads <= 0){
+				num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+			}
+			num_threads = std::min(num_threads, batchsize);
+			// スレッドごとのラティス
+			// 1スレッドの場合はこれまで通り共有のラティスを使う
+			// 作業領域は反復をまたいで使い回す
+			std::vector<Lattice*> lattices;
+			if(num_threads > 1){
+				int max_sentence_length = _dataset_l->get_max_sentence_length();
+				while((int)_sgd_contexts.size() < num_threads){
+					InferenceContext* context = new InferenceContext(_npycrf->_npylm, _npycrf->_crf, false);
+					context->reserve(max_sentence_length);
+					_sgd_contexts.push_back(context);
+				}
+				for(int n = 0;n < num_threads;n++){
+					_sgd_contexts[n]->_lattice->set_log_domain_mode(_npycrf->_lattice->get_log_domain_mode());
+					lattices.push_back(_sgd_contexts[n]->_lattice);
+				}
+			}else{
+				lattices.push_back(_npycrf->_lattice);
+			}
+			std::vector<Sentence*> batch;
 			int num_completed = 0;
 			auto start_time = std::chrono::system_clock::now();
 			for(int b = 0;b < total_batches;b++){
-				_sgd->clear_grads();
+				if (PyErr_CheckSignals() != 0) {	// ctrl+cが押されたかチェック
+					break;
+				}
 				int size = std::min(batchsize, (int)(_rand_indices_train_l.size() - batchsize * b));
+				batch.clear();
 				for(int i = 0;i < size;i++){
-					if (PyErr_CheckSignals() != 0) {	// ctrl+cが押されたかチェック
-						return;		
-					}
 					int data_index = _rand_indices_train_l[i + batchsize * b];
-
-					// NPYLMのg0キャッシュを消去（消す理由は単に重くなるから）
-
-					// std::cout << "data_index: " << data_index << std::endl;
 					Sentence* sentence = _dataset_l->_sentences_train[data_index];
 					assert(sentence->_features != NULL);
-
-					if(_npycrf->with(sentence)){
-						Lattice* lattice = _npycrf->_lattice;
-						lattice->set_pure_crf_mode(pure_crf_mode);
-
-						mat::tri<double> &pz_s = lattice->_pz_s;				// ラベルの周辺確率P(z_t, z_{t+1}|x)
-						// 以下は\lambda_0の勾配計算に必要
-						mat::quad<double> &p_conc_tkji = lattice->_p_conc_tkji;	// 単語列の周辺確率P(c_{t-k+1}^t, c_{t-k-j+1}^{t-k}, c_{t-k-j-i+1}^{t-k-j}|x)
-						mat::quad<double> &pw_h_tkji = lattice->_pw_h_tkji;		// NPYLM 単体の遷移確率P(c_{t-k+1}^t|c_{t-k-j+1}^{t-k}, c_{t-k-j-i+1}^{t-k-j})
-
-						if(pure_crf_mode){
-							// CRF単体の学習では\lambda_0を学習する必要はないためラベルの周辺確率だけ求めればよい
-							lattice->enumerate_marginal_p_z_given_sentence(sentence, pz_s);
-							_sgd->backward_crf(sentence, pz_s);
-						}else{
-							lattice->enumerate_marginal_p_z_and_trigram_given_sentence(sentence, p_conc_tkji, pw_h_tkji, pz_s);
-							_sgd->backward_crf(sentence, pz_s);
-							_sgd->backward_lambda_0(sentence, p_conc_tkji, pw_h_tkji, lattice->_max_word_length);
-						}
-					}
+					batch.push_back(sentence);
+				}
+				// 遅らせていた正則化をこのバッチで使う重みにかけておく
+				for(Sentence* sentence: batch){
+					_sgd->apply_pending_decay(sentence);
 				}
+				_sgd->compute_batch_gradient(batch, lattices, pure_crf_mode);
 				_sgd->update(learning_rate / (double)size);	// 勾配の平均をとるため学習率を調整
 
 				// ログ表示
@@ -428,6 +590,7 @@ namespace npycrf {
 				std::cout << "\r\033[2K" << num_completed << "/" << _rand_indices_train_l.size() << " (" << std::fixed << std::setprecision(2) << percent << "%) " << sgd_per_sec << " sgd/s" << std::flush;
 			}
 			std::cout << "\r\033[2K" << std::flush;
+			_sgd->apply_pending_decay();	// 以降は全ての重みを使う
 		}
 		double Trainer::compute_perplexity_train(){
 			return _compute_perplexity(_dataset_u->_sentences_train);
@@ -447,6 +610,7 @@ namespace npycrf {
 					return 0;		
 				}
 				Sentence* sentence = dataset[data_index]->copy();	// 干渉を防ぐためコピー
+				_npycrf->with(sentence);	// NPYLMのg0キャッシュはラティスと別なので消しておく
 				_npycrf->_lattice->viterbi_decode(sentence, segments);
 				sentence->split(segments);
 				ppl += _npycrf->_npylm->compute_log_p_y_given_sentence(sentence) / ((double)sentence->get_num_segments() - 2);
@@ -16,6 +16,7 @@ namespace npycrf {
 			double _compute_perplexity(std::vector<Sentence*> &dataset);
 			double _compute_log_likelihood(std::vector<Sentence*> &dataset, bool labeled = false);
 			void _gibbs_labeled();
+			bool _gibbs_unlabeled_batch();
 		public:
 			std::vector<int> _rand_indices_train_u;
 			std::vector<int> _rand_indices_train_l;
@@ -30,7 +31,12 @@ namespace npycrf {
 			npycrf::array<bool> _added_to_npylm_u;
 			npycrf::array<bool> _added_to_npylm_l;
 			int _total_gibbs_iterations;
-			Trainer(Dataset* dataset_l, Dataset* dataset_u, Dictionary* dict, NPYCRF* npycrf, double crf_regularization_constant);
+			int _gibbs_batchsize;	// 1より大きければこの数の文をまとめて並列にサンプリングする
+			int _num_threads;		// 0ならハードウェアのスレッド数
+			std::vector<InferenceContext*> _gibbs_contexts;	// ミニバッチのギブスサンプリングのスレッドごとの作業領域. 反復をまたいで使い回す
+			std::vector<InferenceContext*> _sgd_contexts;	// CRFの勾配計算のスレッドごとの作業領域. 反復をまたいで使い回す
+			Trainer(Dataset* dataset_l, Dataset* dataset_u, Dictionary* dict, NPYCRF* npycrf, double crf_regularization_constant, double crf_l1_regularization_constant = 0);
+			~Trainer();
 			void remove_all_data();
 			void add_labeled_data_to_npylm();
 			void gibbs(bool include_labeled_data = false);
@@ -53,6 +59,9 @@ namespace npycrf {
 			void print_p_k_vpylm();
 			int detect_hash_collision(int max_word_length);
 			bool with(Sentence* sentence);
+			void set_substring_word_id_precomputation(bool enabled);
+			void set_gibbs_batchsize(int batchsize);
+			void set_num_threads(int num_threads);
 		};
 	}
 }
\ No newline at end of file
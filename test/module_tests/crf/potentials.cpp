@@ -0,0 +1,58 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include "../random_model.h"
+using namespace npycrf;
+using std::cout;
+using std::flush;
+using std::endl;
+
+// パスのコストの累積和から定数時間で求めたγ(s, t)が、パスのコストを順に足した値と一致することを確認する
+
+int num_character_ids = 8;
+
+void test_compute_gamma(int hash_bits){
+	crf::feature::FeatureExtractor* extractor = new crf::feature::FeatureExtractor(num_character_ids, CTYPE_NUM_TYPES, -2, 2, -2, 1, -2, 1, -3, 1, hash_bits);
+	std::vector<Sentence*> dataset;
+	for(int n = 0;n < 50;n++){
+		Sentence* sentence = test::generate_sentence(sampler::uniform_int(1, 30), num_character_ids);
+		// 素性IDの表を使う場合は出現した素性を登録する
+		delete extractor->extract(sentence, true);
+		dataset.push_back(sentence);
+	}
+	crf::Parameter* parameter = new crf::Parameter(extractor->get_num_features(), 1.0, 1.0);
+	for(int k = 0;k < parameter->_weights.size();k++){
+		parameter->_weights[k] = sampler::normal(0, 1);
+	}
+	parameter->update_version();
+	crf::CRF* crf = new crf::CRF(extractor, parameter);
+
+	crf::Potentials potentials(1);
+	crf::Potentials potentials_without_features(1);
+	for(Sentence* sentence: dataset){
+		int size = sentence->size();
+		crf->enumerate_path_costs_without_features(sentence, &potentials_without_features);
+		sentence->_features = crf->extract_features(sentence, false);
+		crf->enumerate_potentials(sentence, &potentials);
+		for(int s = 1;s <= size + 1;s++){
+			int limit_t = (s == size + 1) ? size + 2 : size + 1;
+			for(int t = s + 1;t <= limit_t;t++){
+				double gamma = crf->compute_gamma(sentence, s, t);
+				assert(std::abs(potentials.compute_gamma(s, t) - gamma) < 1e-10);
+				assert(std::abs(potentials_without_features.compute_gamma(s, t) - gamma) < 1e-10);
+			}
+		}
+		delete sentence;
+	}
+	delete crf;
+}
+
+int main(){
+	sampler::set_seed(0);
+	test_compute_gamma(0);
+	cout << "OK" << endl;
+	test_compute_gamma(12);
+	cout << "OK" << endl;
+	return 0;
+}
@@ -0,0 +1,115 @@
+#include <iostream>
+#include <cassert>
+#include <algorithm>
+#include <vector>
+#include "../random_model.h"
+using namespace npycrf;
+using namespace npycrf::test;
+using std::cout;
+using std::flush;
+using std::endl;
+
+// 出現回数による素性の刈り込みを、全ての素性関数に素性IDを割り当てた場合と比べる
+// 残る素性関数はテンプレートごとの閾値以上のものだけで、素性IDは最初に出現した順のまま詰められる
+
+crf::feature::FeatureExtractor* generate_extractor(int num_character_ids){
+	return new crf::feature::FeatureExtractor(num_character_ids, CTYPE_NUM_TYPES, -2, 2, -2, 1, -2, 1, -3, 1, 0);
+}
+
+// テンプレートごとの残った数と除いた数をtotal_kept, total_droppedに足す
+void test_prune(int num_character_ids, int num_sentences, int* min_count, int* total_kept, int* total_dropped){
+	std::vector<Sentence*> dataset;
+	for(int n = 0;n < num_sentences;n++){
+		dataset.push_back(generate_sentence(sampler::uniform_int(1, 20), num_character_ids));
+	}
+
+	// 全ての素性関数に最初に出現した順で素性IDを割り当て、素性IDごとの出現回数を数える
+	crf::feature::FeatureExtractor* full_extractor = generate_extractor(num_character_ids);
+	std::vector<int> true_counts;
+	for(Sentence* sentence: dataset){
+		crf::FeatureIndices* features = full_extractor->extract(sentence, true);
+		true_counts.resize(full_extractor->get_num_features(), 0);
+		for(int k: features->_ids){
+			true_counts[k] += 1;
+		}
+		delete features;
+	}
+	int num_features = full_extractor->get_num_features();
+	std::vector<int64_t> function_ids(num_features);
+	for(auto &elem: full_extractor->_function_id_to_feature_id){
+		function_ids[elem.second] = elem.first;
+	}
+
+	// 2周で刈り込む
+	crf::feature::FeatureExtractor* extractor = generate_extractor(num_character_ids);
+	hashmap<int64_t, int> counts;
+	for(Sentence* sentence: dataset){
+		extractor->count_function_ids(sentence, counts);
+	}
+	assert((int)counts.size() == num_features);
+	for(int k = 0;k < num_features;k++){
+		assert(counts[function_ids[k]] == true_counts[k]);
+	}
+	for(Sentence* sentence: dataset){
+		extractor->register_frequent_function_ids(sentence, counts, min_count);
+	}
+
+	// 閾値以上の素性関数だけが元の順に並ぶ
+	int true_num_seen[FEATURE_NUM_TEMPLATES] = {0};
+	int true_num_kept[FEATURE_NUM_TEMPLATES] = {0};
+	int new_feature_id = 0;
+	for(int k = 0;k < num_features;k++){
+		int feature_template = full_extractor->get_feature_template(function_ids[k]);
+		true_num_seen[feature_template] += 1;
+		auto itr = extractor->_function_id_to_feature_id.find(function_ids[k]);
+		if(true_counts[k] >= min_count[feature_template]){
+			assert(itr != extractor->_function_id_to_feature_id.end());
+			assert(itr->second == new_feature_id);
+			new_feature_id += 1;
+			true_num_kept[feature_template] += 1;
+		}else{
+			assert(itr == extractor->_function_id_to_feature_id.end());
+		}
+	}
+	assert(extractor->get_num_features() == new_feature_id);
+
+	int num_seen[FEATURE_NUM_TEMPLATES];
+	int num_kept[FEATURE_NUM_TEMPLATES];
+	extractor->count_features_per_template(counts, num_seen, num_kept);
+	for(int feature_template = 0;feature_template < FEATURE_NUM_TEMPLATES;feature_template++){
+		assert(num_seen[feature_template] == true_num_seen[feature_template]);
+		assert(num_kept[feature_template] == true_num_kept[feature_template]);
+		total_kept[feature_template] += num_kept[feature_template];
+		total_dropped[feature_template] += num_seen[feature_template] - num_kept[feature_template];
+	}
+
+	for(Sentence* sentence: dataset){
+		delete sentence;
+	}
+	delete extractor;
+	delete full_extractor;
+}
+
+int main(){
+	sampler::set_seed(0);
+	int total_kept[FEATURE_NUM_TEMPLATES] = {0};
+	int total_dropped[FEATURE_NUM_TEMPLATES] = {0};
+	int min_count[FEATURE_NUM_TEMPLATES];
+	for(int num_character_ids: {4, 16, 64}){
+		for(int num_sentences: {1, 10, 50}){
+			for(int n = 0;n < 10;n++){
+				for(int feature_template = 0;feature_template < FEATURE_NUM_TEMPLATES;feature_template++){
+					min_count[feature_template] = sampler::uniform_int(1, 5);
+				}
+				test_prune(num_character_ids, num_sentences, min_count, total_kept, total_dropped);
+			}
+		}
+	}
+	// 文字に依存するテンプレートでは残る素性と除かれる素性の両方が現れている
+	for(int feature_template: {FEATURE_TEMPLATE_UNIGRAM, FEATURE_TEMPLATE_BIGRAM, FEATURE_TEMPLATE_IDENTICAL}){
+		assert(total_kept[feature_template] > 0);
+		assert(total_dropped[feature_template] > 0);
+	}
+	cout << "OK" << endl;
+	return 0;
+}
@@ -0,0 +1,166 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../../../src/npycrf/solver/sgd.h"
+#include "../random_model.h"
+using namespace npycrf;
+using std::cout;
+using std::flush;
+using std::endl;
+
+// 量子化したモデルのパスのコストが元のモデルと量子化誤差の範囲で一致し、
+// 素性IDを展開せずに計算した場合とFeatureIndicesを使う場合で完全に一致することを確認する
+// 重みが0の素性を除いたモデルのパスのコストは元のモデルと完全に一致する
+
+// 文字種が混ざるようにする
+std::wstring characters = L"あいアイ漢字ab12";
+
+void test_quantize(int hash_bits, int bits){
+	int num_character_ids = characters.size();
+	crf::feature::FeatureExtractor* extractor = new crf::feature::FeatureExtractor(num_character_ids, CTYPE_NUM_TYPES, -2, 2, -2, 1, -2, 1, -3, 1, hash_bits);
+	std::vector<Sentence*> dataset;
+	for(int n = 0;n < 50;n++){
+		Sentence* sentence = test::generate_sentence(sampler::uniform_int(1, 20), characters);
+		// 素性IDの表を使う場合は出現した素性を登録する
+		delete extractor->extract(sentence, true);
+		dataset.push_back(sentence);
+	}
+	crf::Parameter* parameter = new crf::Parameter(extractor->get_num_features(), 1.0, 1.0);
+	for(int k = 0;k < parameter->_weights.size();k++){
+		// テンプレートごとにスケールが変わるように大きさを変える
+		parameter->_weights[k] = sampler::normal(0, 1) * (1 + k % 5);
+	}
+	parameter->update_version();
+	crf::CRF* crf = new crf::CRF(extractor, parameter);
+	crf::CRF* quantized_crf = crf->copy_quantized(bits, 0);
+	crf::QuantizedWeights* quantized = quantized_crf->_parameter->_quantized;
+	assert(quantized != NULL);
+	double max_scale = 0;
+	for(int t = 0;t < FEATURE_NUM_TEMPLATES;t++){
+		max_scale = std::max(max_scale, quantized->_scale[t]);
+	}
+
+	for(Sentence* sentence: dataset){
+		int size = sentence->size();
+		crf::Potentials potentials(size);
+		crf::Potentials quantized_potentials(size);
+		crf->enumerate_path_costs_without_features(sentence, &potentials);
+		quantized_crf->enumerate_path_costs_without_features(sentence, &quantized_potentials);
+		sentence->_features = crf->extract_features(sentence, false);
+		crf::FeatureIndices* features = sentence->_features;
+		for(int i = 2;i <= size + 2;i++){
+			int start_y_i = (i > size) ? 1 : 0;
+			for(int y_i_1 = 0;y_i_1 <= 1;y_i_1++){
+				for(int y_i = start_y_i;y_i <= 1;y_i++){
+					// 各重みの誤差はスケールの半分以下
+					int num_fired = (features->end_u(i, y_i) - features->begin_u(i, y_i)) + (features->end_b(i, y_i_1, y_i) - features->begin_b(i, y_i_1, y_i));
+					double error = std::abs(quantized_potentials._path_cost(i, y_i_1, y_i) - potentials._path_cost(i, y_i_1, y_i));
+					assert(error <= num_fired * max_scale / 2 + 1e-12);
+					assert(potentials._path_cost(i, y_i_1, y_i) == crf->compute_path_cost(sentence, i - 1, i, y_i_1, y_i));
+				}
+			}
+		}
+		delete sentence->_features;
+		sentence->_features = NULL;
+		sentence->_features = quantized_crf->extract_features(sentence, false);
+		for(int i = 2;i <= size + 2;i++){
+			int start_y_i = (i > size) ? 1 : 0;
+			for(int y_i_1 = 0;y_i_1 <= 1;y_i_1++){
+				for(int y_i = start_y_i;y_i <= 1;y_i++){
+					assert(quantized_potentials._path_cost(i, y_i_1, y_i) == quantized_crf->compute_path_cost(sentence, i - 1, i, y_i_1, y_i));
+				}
+			}
+		}
+		delete sentence;
+	}
+	// 量子化したモデルは学習・再量子化できない
+	bool thrown = false;
+	try{
+		solver::SGD sgd(quantized_crf, 1.0, 0);
+	}catch(std::runtime_error &e){
+		thrown = true;
+	}
+	assert(thrown);
+	thrown = false;
+	try{
+		delete quantized_crf->copy_without_zero_weights();
+	}catch(std::runtime_error &e){
+		thrown = true;
+	}
+	assert(thrown);
+	thrown = false;
+	try{
+		delete crf->copy_quantized(4, 0);
+	}catch(std::invalid_argument &e){
+		thrown = true;
+	}
+	assert(thrown);
+	delete quantized_crf;
+	delete crf;
+}
+
+void test_copy_without_zero_weights(int hash_bits){
+	int num_character_ids = characters.size();
+	crf::feature::FeatureExtractor* extractor = new crf::feature::FeatureExtractor(num_character_ids, CTYPE_NUM_TYPES, -2, 2, -2, 1, -2, 1, -3, 1, hash_bits);
+	std::vector<Sentence*> dataset;
+	for(int n = 0;n < 50;n++){
+		Sentence* sentence = test::generate_sentence(sampler::uniform_int(1, 20), characters);
+		delete extractor->extract(sentence, true);
+		dataset.push_back(sentence);
+	}
+	crf::Parameter* parameter = new crf::Parameter(extractor->get_num_features(), 1.0, 1.0);
+	for(int k = 0;k < parameter->_weights.size();k++){
+		// L1正則化で切り詰めたように半分ほどの重みを0にする
+		parameter->_weights[k] = (sampler::uniform(0, 1) < 0.5) ? 0 : sampler::normal(0, 1);
+	}
+	parameter->update_version();
+	crf::CRF* crf = new crf::CRF(extractor, parameter);
+	int num_zero_weights = parameter->get_num_zero_weights();
+	assert(num_zero_weights > 0);
+	crf::CRF* compact_crf = crf->copy_without_zero_weights();
+	if(hash_bits == 0){
+		assert(compact_crf->_parameter->get_num_features() == parameter->get_num_features() - num_zero_weights);
+		assert(compact_crf->_parameter->get_num_zero_weights() == 0);
+	}else{
+		// ハッシュモードでは重みの位置を変えられないので詰めない
+		assert(compact_crf->_parameter->get_num_features() == parameter->get_num_features());
+	}
+	assert(compact_crf->_parameter->_lambda_0 == parameter->_lambda_0);
+	assert(compact_crf->_parameter->_bias == parameter->_bias);
+
+	for(Sentence* sentence: dataset){
+		int size = sentence->size();
+		crf::Potentials potentials(size);
+		crf::Potentials compact_potentials(size);
+		crf->enumerate_path_costs_without_features(sentence, &potentials);
+		compact_crf->enumerate_path_costs_without_features(sentence, &compact_potentials);
+		for(int i = 2;i <= size + 2;i++){
+			int start_y_i = (i > size) ? 1 : 0;
+			for(int y_i_1 = 0;y_i_1 <= 1;y_i_1++){
+				for(int y_i = start_y_i;y_i <= 1;y_i++){
+					assert(compact_potentials._path_cost(i, y_i_1, y_i) == potentials._path_cost(i, y_i_1, y_i));
+				}
+			}
+		}
+		delete sentence;
+	}
+	delete compact_crf;
+	delete crf;
+}
+
+int main(){
+	sampler::set_seed(0);
+	for(int bits: {8, 16}){
+		test_quantize(0, bits);
+		cout << "OK" << endl;
+		test_quantize(12, bits);
+		cout << "OK" << endl;
+	}
+	test_copy_without_zero_weights(0);
+	test_copy_without_zero_weights(12);
+	cout << "OK" << endl;
+	return 0;
+}
@@ -0,0 +1,93 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "../../../src/npycrf/logsumexp.h"
+#include "../random_model.h"
+using namespace npycrf;
+using namespace npycrf::test;
+using std::cout;
+using std::flush;
+using std::endl;
+
+// 3-gramの文脈がないiを(t-k, j)ごとにまとめた前向き確率・ビタビアルゴリズムを
+// 単語長L以下の全ての分割を列挙した結果と比べる
+// 文字の種類を減らして3-gramの文脈がある場合とない場合の両方が現れるようにする
+
+// 3-gramの文脈がある(t-k, j, i)の数
+int count_contexts(Lattice* lattice, int size){
+	int num_contexts = 0;
+	for(int s = 1;s <= size;s++){
+		for(int j = 1;j <= std::min(s - 1, lattice->_max_word_length);j++){
+			num_contexts += lattice->_num_context_i(s, j);
+		}
+	}
+	return num_contexts;
+}
+
+int test_backoff(RandomModel* var, int size){
+	int max_word_length = var->max_word_length;
+	Lattice* lattice = var->lattice;
+	Sentence* sentence = generate_sentence(size, var->num_character_ids);
+	sentence->_features = var->crf->extract_features(sentence, false);
+
+	std::vector<std::vector<int>> all_segments;
+	std::vector<int> segments;
+	enumerate_segmentations(size, max_word_length, segments, all_segments);
+	int num_segmentations = all_segments.size();
+	std::vector<double> scores;
+	double log_Zs = -std::numeric_limits<double>::infinity();
+	int argmax = 0;
+	for(int n = 0;n < num_segmentations;n++){
+		double score = var->compute_score(sentence, all_segments[n]);
+		scores.push_back(score);
+		log_Zs = logaddexp(log_Zs, score);
+		if(score > scores[argmax]){
+			argmax = n;
+		}
+	}
+
+	// 正規化定数
+	var->npylm->clear_g0_cache(size);
+	double Zs = lattice->compute_normalizing_constant(sentence, true);
+	assert(std::abs(log_Zs - log(Zs)) < 1e-8);
+	int num_contexts = count_contexts(lattice, size);
+	double _log_Zs = lattice->compute_log_normalizing_constant(sentence, true);
+	assert(std::abs(log_Zs - _log_Zs) < 1e-8);
+
+	// 対数モード
+	lattice->set_log_domain_mode(true);
+	_log_Zs = lattice->compute_log_normalizing_constant(sentence, true);
+	assert(std::abs(log_Zs - _log_Zs) < 1e-8);
+	lattice->set_log_domain_mode(false);
+
+	// ビタビアルゴリズム
+	lattice->viterbi_decode(sentence, segments);
+	assert(std::abs(var->compute_score(sentence, segments) - scores[argmax]) < 1e-10);
+
+	delete sentence;
+	return num_contexts;
+}
+
+int main(){
+	sampler::set_seed(0);
+	for(int max_word_length = 2;max_word_length <= 4;max_word_length++){
+		RandomModel* var = new RandomModel(3, max_word_length);
+		// 3-gramの格子は2-gramのテーブルを確保しない
+		assert(var->lattice->get_bigram_mode() == false);
+		assert(var->lattice->_log_alpha_tk._array == nullptr);
+		assert(var->lattice->_viterbi_backward_tk._array == nullptr);
+		assert(var->lattice->_log_beta_tk._array == nullptr);
+		assert(var->lattice->_p_conc_tkj._array == nullptr);
+		int num_contexts = 0;
+		for(int size = 1;size <= 12;size++){
+			num_contexts += test_backoff(var, size);
+		}
+		// 3-gramの文脈がある場合も確認している
+		assert(num_contexts > 0);
+		delete var;
+	}
+	cout << "OK" << endl;
+	return 0;
+}
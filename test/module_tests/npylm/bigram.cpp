@@ -0,0 +1,112 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "../../../src/npycrf/logsumexp.h"
+#include "../random_model.h"
+using namespace npycrf;
+using namespace npycrf::test;
+using std::cout;
+using std::flush;
+using std::endl;
+
+// 2-gramのNPYLMでの前向き確率・周辺確率・ビタビアルゴリズムを
+// 単語長L以下の全ての分割を列挙した結果と比べる
+
+void test_bigram(RandomModel* var, int size){
+	int max_word_length = var->max_word_length;
+	Lattice* lattice = var->lattice;
+	Sentence* sentence = generate_sentence(size, var->num_character_ids);
+	sentence->_features = var->crf->extract_features(sentence, false);
+
+	std::vector<std::vector<int>> all_segments;
+	std::vector<int> segments;
+	enumerate_segmentations(size, max_word_length, segments, all_segments);
+	int num_segmentations = all_segments.size();
+	std::vector<double> scores;
+	double log_Zs = -std::numeric_limits<double>::infinity();
+	int argmax = 0;
+	for(int n = 0;n < num_segmentations;n++){
+		double score = var->compute_score(sentence, all_segments[n]);
+		scores.push_back(score);
+		log_Zs = logaddexp(log_Zs, score);
+		if(score > scores[argmax]){
+			argmax = n;
+		}
+	}
+
+	// 正規化定数
+	var->npylm->clear_g0_cache(size);
+	double Zs = lattice->compute_normalizing_constant(sentence, true);
+	assert(std::abs(log_Zs - log(Zs)) < 1e-8);
+	double _log_Zs = lattice->compute_log_normalizing_constant(sentence, true);
+	assert(std::abs(log_Zs - _log_Zs) < 1e-8);
+
+	// 周辺確率
+	// p_conc_tkjは長さjの単語の直後に長さkの単語がtで終わる確率. j=0は<bos>、t=N+1は<eos>
+	mat::tri<double> _pz_s(size + 2, 2, 2);
+	mat::tri<double> _p_conc_tkj(size + 2, max_word_length + 1, max_word_length + 1);
+	for(int n = 0;n < num_segmentations;n++){
+		std::vector<int> y(size + 3, 0);
+		double p = exp(scores[n] - log_Zs);
+		int t = 0;
+		int j = 0;
+		for(int word_length: all_segments[n]){
+			y[t + 1] = 1;
+			t += word_length;
+			_p_conc_tkj(t, word_length, j) += p;
+			j = word_length;
+		}
+		_p_conc_tkj(size + 1, 1, j) += p;
+		y[size + 1] = 1;
+		y[size + 2] = 1;
+		_pz_s(0, 1, 1) = 1;
+		for(int i = 2;i <= size + 2;i++){
+			_pz_s(i - 1, y[i - 1], y[i]) += p;
+		}
+	}
+	mat::tri<double> pz_s(size + 2, 2, 2);
+	lattice->enumerate_marginal_p_z_given_sentence(sentence, pz_s);
+	for(int i = 0;i <= size;i++){
+		for(int y_i_1 = 0;y_i_1 <= 1;y_i_1++){
+			for(int y_i = 0;y_i <= 1;y_i++){
+				assert(std::abs(pz_s(i, y_i_1, y_i) - _pz_s(i, y_i_1, y_i)) < 1e-8);
+			}
+		}
+	}
+	lattice->enumerate_marginal_p_z_and_bigram_given_sentence(sentence, lattice->_p_conc_tkj, lattice->_pw_h_tkj, pz_s);
+	for(int t = 1;t <= size + 1;t++){
+		int limit_k = (t == size + 1) ? 1 : std::min(t, max_word_length);
+		for(int k = 1;k <= limit_k;k++){
+			for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, max_word_length);j++){
+				assert(std::abs(lattice->_p_conc_tkj(t, k, j) - _p_conc_tkj(t, k, j)) < 1e-8);
+			}
+		}
+	}
+
+	// ビタビアルゴリズム
+	lattice->viterbi_decode(sentence, segments);
+	assert(std::abs(var->compute_score(sentence, segments) - scores[argmax]) < 1e-10);
+
+	delete sentence;
+}
+
+int main(){
+	sampler::set_seed(0);
+	for(int max_word_length = 2;max_word_length <= 4;max_word_length++){
+		RandomModel* var = new RandomModel(8, max_word_length, 100, 2);
+		// 2-gramの格子は3-gramのテーブルを確保しない
+		assert(var->lattice->get_bigram_mode());
+		assert(var->lattice->_alpha._array == nullptr);
+		assert(var->lattice->_beta._array == nullptr);
+		assert(var->lattice->_p_transition_tkji._array == nullptr);
+		assert(var->lattice->_p_conc_tkji._array == nullptr);
+		for(int size = 1;size <= 12;size++){
+			test_bigram(var, size);
+		}
+		delete var;
+	}
+	cout << "OK" << endl;
+	return 0;
+}
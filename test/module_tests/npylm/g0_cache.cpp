@@ -0,0 +1,76 @@
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "../../../src/npycrf/hash.h"
+#include "../random_model.h"
+using namespace npycrf;
+using namespace npycrf::test;
+using std::cout;
+using std::flush;
+using std::endl;
+
+// 文をまたぐg0キャッシュから返る値がVPYLMで直接計算した値と一致することを確認する
+// VPYLMを更新したあとは古い値を返さないこと、容量が小さく追い出しが起きても正しいことも確認する
+
+int num_character_ids = 3;
+
+void add_customers(npylm::NPYLM* npylm, Sentence* sentence, int max_word_length){
+	std::vector<int> segments = generate_segments(sentence->size(), max_word_length);
+	sentence->split(segments);
+	npylm->clear_g0_cache(sentence->size());
+	for(int t = 2;t < sentence->get_num_segments();t++){
+		npylm->add_customer_at_time_t(sentence, t);
+	}
+}
+
+// 全ての部分文字列について2回ずつ引き、どちらもVPYLMの値と一致すること
+void check_all_substrings(npylm::NPYLM* npylm, Sentence* sentence, int max_word_length){
+	for(int repeat = 0;repeat < 2;repeat++){
+		for(int start = 0;start < sentence->size();start++){
+			for(int end = start;end < std::min(sentence->size(), start + max_word_length);end++){
+				id word_id = hash_substring_ptr(sentence->_characters, start, end);
+				double pw = npylm->compute_vpylm_p_w(sentence->_character_ids, start, end, word_id);
+				assert(pw == npylm->_vpylm->compute_p_w(sentence->_character_ids, start, end));
+			}
+		}
+	}
+}
+
+void test_g0_cache(size_t capacity){
+	int max_word_length = 8;
+	npylm::NPYLM* npylm = new npylm::NPYLM(max_word_length, 100, 1.0 / num_character_ids, 4, 1, 4, 1);
+	npylm->reserve(100);
+	npylm->_g0_cache.set_capacity(capacity);
+	std::vector<Sentence*> dataset;
+	for(int n = 0;n < 20;n++){
+		Sentence* sentence = generate_sentence(sampler::uniform_int(5, 30), num_character_ids);
+		add_customers(npylm, sentence, max_word_length);
+		dataset.push_back(sentence);
+	}
+	for(Sentence* sentence: dataset){
+		check_all_substrings(npylm, sentence, max_word_length);
+	}
+	// VPYLMを更新すると以前の値は使われない
+	for(int n = 0;n < 5;n++){
+		Sentence* sentence = generate_sentence(sampler::uniform_int(5, 30), num_character_ids);
+		add_customers(npylm, sentence, max_word_length);
+		dataset.push_back(sentence);
+		for(Sentence* sentence: dataset){
+			check_all_substrings(npylm, sentence, max_word_length);
+		}
+	}
+	assert(npylm->_g0_cache.size() <= npylm->_g0_cache.get_capacity() + G0_CACHE_NUM_SHARDS);
+	for(Sentence* sentence: dataset){
+		delete sentence;
+	}
+	delete npylm;
+}
+
+int main(){
+	sampler::mt.seed(0);
+	test_g0_cache(1 << 18);
+	cout << "OK" << endl;
+	test_g0_cache(G0_CACHE_NUM_SHARDS * 2);
+	cout << "OK" << endl;
+	return 0;
+}
@@ -4,6 +4,7 @@
 #include <cassert>
 #include <unordered_set>
 #include <string>
+#include <vector>
 #include "../../../src/npycrf/common.h"
 #include "../../../src/npycrf/hash.h"
 using std::cout;
@@ -14,16 +15,34 @@ void test_hash_substring(){
 	std::wstring sentence_str = L"本論文 では, 教師 データ や 辞書 を 必要 とせず, あらゆる言語に適用できる教師なし形態素解析器および言語モデルを提案する. 観測された文字列を, 文字 nグラム-単語 nグラムをノンパラメトリックベイズ法の枠組で統合した確率モデルからの出力とみなし, MCMC 法と動的計画法を用いて, 繰り返し隠れた「単語」を推定する. 提案法は, あらゆる言語の生文字列から直接, 全く知識なしに Kneser-Ney と同等に高精度にスムージングされ, 未知語のない nグラム言語モデルを構築する方法とみなすこともできる.話し言葉や古文を含む日本語, および中国語単語分割の標準的なデータセットでの実験により, 提案法の有効性および効率性を確認した.";
 	for(int t = 0;t < sentence_str.size();t++){
 		for(int k = 0;k < std::min((size_t)t, sentence_str.size());k++){
-			size_t hash = npylm::hash_substring(sentence_str, t - k, t);
+			size_t hash = npycrf::hash_substring(sentence_str, t - k, t);
 			std::wstring substr(sentence_str.begin() + t - k, sentence_str.begin() + t + 1);
-			size_t _hash = npylm::hash_wstring(substr);
+			size_t _hash = npycrf::hash_wstring(substr);
 			assert(hash == _hash);
 		}
 	}
 }
 
+void test_hash_all_substrings(){
+	std::wstring sentence_str = L"本論文では, 教師データや辞書を必要とせず, あらゆる言語に適用できる教師なし形態素解析器および言語モデルを提案する.";
+	for(int size = 1;size <= (int)sentence_str.size();size++){
+		for(int max_length = 1;max_length <= 9;max_length++){
+			int stride = max_length + 1;
+			std::vector<size_t> hashes(size * stride, 0);
+			npycrf::hash_all_substrings(sentence_str.data(), size, max_length, hashes.data(), stride);
+			for(int end = 0;end < size;end++){
+				for(int length = 1;length <= std::min(max_length, end + 1);length++){
+					size_t hash = npycrf::hash_substring_ptr(sentence_str.data(), end - length + 1, end);
+					assert(hashes[end * stride + length] == hash);
+				}
+			}
+		}
+	}
+}
+
 int main(){
 	test_hash_substring();
+	test_hash_all_substrings();
 	cout << "OK" << endl;
 	return 0;
 }
\ No newline at end of file
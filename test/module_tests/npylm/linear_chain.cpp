@@ -0,0 +1,111 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "../../../src/npycrf/logsumexp.h"
+#include "../random_model.h"
+using namespace npycrf;
+using namespace npycrf::test;
+using std::cout;
+using std::flush;
+using std::endl;
+
+// 純粋なCRFの線形連鎖による正規化定数・周辺確率・ビタビアルゴリズムを
+// 単語長L以下の全ての分割を列挙した結果と比べる
+
+// 分割のパスのコストの和
+double compute_score(crf::Potentials &potentials, std::vector<int> &segments, int size){
+	std::vector<int> y(size + 3, 0);
+	int t = 1;
+	for(int word_length: segments){
+		y[t] = 1;
+		t += word_length;
+	}
+	assert(t == size + 1);
+	y[size + 1] = 1;
+	y[size + 2] = 1;
+	double score = 0;
+	for(int i = 2;i <= size + 2;i++){
+		score += potentials._path_cost(i, y[i - 1], y[i]);
+	}
+	return score;
+}
+
+void test_linear_chain(int max_word_length, int size){
+	RandomModel* var = new RandomModel(8, max_word_length);
+	var->lattice->set_pure_crf_mode(true);
+	// 線形連鎖のテーブルは使うときに確保する
+	assert(var->lattice->_chain_alpha._array == nullptr);
+	assert(var->lattice->_chain_beta._array == nullptr);
+	Sentence* sentence = generate_sentence(size, var->num_character_ids);
+	crf::Potentials potentials(size);
+	var->crf->enumerate_path_costs_without_features(sentence, &potentials);
+
+	std::vector<std::vector<int>> all_segments;
+	std::vector<int> segments;
+	enumerate_segmentations(size, max_word_length, segments, all_segments);
+	int num_segmentations = all_segments.size();
+	std::vector<double> scores;
+	double log_Zs = -std::numeric_limits<double>::infinity();
+	int argmax = 0;
+	for(int n = 0;n < num_segmentations;n++){
+		double score = compute_score(potentials, all_segments[n], size);
+		scores.push_back(score);
+		log_Zs = logaddexp(log_Zs, score);
+		if(score > scores[argmax]){
+			argmax = n;
+		}
+	}
+	// 正規化定数
+	double _log_Zs = var->lattice->compute_log_normalizing_constant(sentence);
+	assert(std::abs(log_Zs - _log_Zs) < 1e-8);
+
+	// 周辺確率
+	mat::tri<double> pz_s(size + 2, 2, 2);
+	mat::tri<double> _pz_s(size + 2, 2, 2);
+	for(int n = 0;n < num_segmentations;n++){
+		std::vector<int> y(size + 3, 0);
+		int t = 1;
+		for(int word_length: all_segments[n]){
+			y[t] = 1;
+			t += word_length;
+		}
+		y[size + 1] = 1;
+		y[size + 2] = 1;
+		double p = exp(scores[n] - log_Zs);
+		_pz_s(0, 1, 1) = 1;
+		for(int i = 2;i <= size + 2;i++){
+			_pz_s(i - 1, y[i - 1], y[i]) += p;
+		}
+	}
+	var->lattice->enumerate_marginal_p_z_given_sentence(sentence, pz_s);
+	for(int i = 0;i <= size + 1;i++){
+		for(int y_i_1 = 0;y_i_1 <= 1;y_i_1++){
+			for(int y_i = 0;y_i <= 1;y_i++){
+				assert(std::abs(pz_s(i, y_i_1, y_i) - _pz_s(i, y_i_1, y_i)) < 1e-8);
+			}
+		}
+	}
+
+	// ビタビアルゴリズム
+	var->lattice->viterbi_decode(sentence, segments);
+	for(int word_length: segments){
+		assert(word_length <= max_word_length);
+	}
+	assert(std::abs(compute_score(potentials, segments, size) - scores[argmax]) < 1e-10);
+
+	delete sentence;
+	delete var;
+}
+
+int main(){
+	sampler::set_seed(0);
+	for(int max_word_length = 2;max_word_length <= 4;max_word_length++){
+		for(int size = 1;size <= 12;size++){
+			test_linear_chain(max_word_length, size);
+		}
+	}
+	cout << "OK" << endl;
+	return 0;
+}
@@ -0,0 +1,78 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include "../random_model.h"
+using namespace npycrf;
+using namespace npycrf::test;
+using std::cout;
+using std::flush;
+using std::endl;
+
+// 対数領域の前向き確率とスケーリング係数を使う前向き確率を同じ文で比べる
+// スケーリングを戻した前向き確率の対数が全ての(t, k, j)で一致する
+
+int max_sentence_length = 300;
+
+void test_log_domain(RandomModel* var, int size, bool pure_npylm_mode){
+	Lattice* lattice = var->lattice;
+	int max_word_length = var->max_word_length;
+	if(pure_npylm_mode){
+		lattice->set_pure_npylm_mode(true);
+	}else{
+		lattice->set_npycrf_mode();
+	}
+	Sentence* sentence = generate_sentence(size, var->num_character_ids);
+	sentence->_features = var->crf->extract_features(sentence, false);
+
+	// スケーリング係数を使う前向き確率
+	lattice->set_log_domain_mode(false);
+	var->npylm->clear_g0_cache(size);
+	double log_Zs = lattice->compute_log_normalizing_constant(sentence, true);
+	std::vector<double> log_alpha;
+	double log_scaling = 0;
+	for(int t = 1;t <= size;t++){
+		log_scaling -= log(lattice->_scaling[t]);
+		for(int k = 1;k <= std::min(t, max_word_length);k++){
+			for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, max_word_length);j++){
+				assert(lattice->_alpha(t, k, j) > 0);
+				log_alpha.push_back(log(lattice->_alpha(t, k, j)) + log_scaling);
+			}
+		}
+	}
+
+	// 対数領域の前向き確率
+	lattice->set_log_domain_mode(true);
+	var->npylm->clear_g0_cache(size);
+	double _log_Zs = lattice->compute_log_normalizing_constant(sentence, true);
+	assert(std::abs(log_Zs - _log_Zs) < 1e-12 * std::abs(log_Zs) + 1e-12);
+	int n = 0;
+	for(int t = 1;t <= size;t++){
+		for(int k = 1;k <= std::min(t, max_word_length);k++){
+			for(int j = (t - k == 0) ? 0 : 1;j <= std::min(t - k, max_word_length);j++){
+				double _log_alpha = lattice->_alpha(t, k, j);
+				assert(std::abs(log_alpha[n] - _log_alpha) < 1e-12 * std::abs(_log_alpha) + 1e-12);
+				n++;
+			}
+		}
+	}
+	lattice->set_log_domain_mode(false);
+	delete sentence;
+}
+
+int main(){
+	sampler::set_seed(0);
+	for(int max_word_length = 2;max_word_length <= 8;max_word_length++){
+		RandomModel* var = new RandomModel(8, max_word_length, max_sentence_length);
+		for(bool pure_npylm_mode: {false, true}){
+			for(int size = 1;size <= 20;size++){
+				test_log_domain(var, size, pure_npylm_mode);
+			}
+			// スケーリング係数が積み重なる長い文
+			test_log_domain(var, max_sentence_length, pure_npylm_mode);
+		}
+		delete var;
+	}
+	cout << "OK" << endl;
+	return 0;
+}
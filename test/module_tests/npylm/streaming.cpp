@@ -0,0 +1,72 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include "../random_model.h"
+using namespace npycrf;
+using namespace npycrf::test;
+using std::cout;
+using std::flush;
+using std::endl;
+
+// リングバッファを使うビタビアルゴリズムの分割を通常のビタビアルゴリズムと比べる
+// 合流点を強制しなかった場合は完全に一致し、強制した場合も正しい分割でスコアは最大値以下になる
+
+int max_sentence_length = 2000;
+
+// 合流点を強制した回数を返す
+int test_streaming(RandomModel* var, Sentence* sentence, int window, std::vector<int> &full_segments, double full_score){
+	Lattice* lattice = new Lattice(var->npylm, var->crf);
+	lattice->set_viterbi_window(window);
+	lattice->reserve(var->max_word_length, sentence->size());
+	std::vector<int> segments;
+	lattice->viterbi_decode(sentence, segments);
+	int num_forced = lattice->_viterbi_num_forced;
+	// 純粋なCRFの線形連鎖のテーブルは確保しない
+	assert(lattice->_chain_alpha._array == nullptr);
+	assert(lattice->_chain_backward.size() == 0);
+	delete lattice;
+
+	int sum = 0;
+	for(int word_length: segments){
+		assert(1 <= word_length && word_length <= var->max_word_length);
+		sum += word_length;
+	}
+	assert(sum == sentence->size());
+	if(num_forced == 0){
+		assert(segments == full_segments);
+		return 0;
+	}
+	// 近似なので最大値を超えることはない
+	double score = var->compute_score(sentence, segments);
+	assert(score <= full_score + 1e-8 * std::abs(full_score));
+	return num_forced;
+}
+
+int main(){
+	sampler::set_seed(0);
+	for(int max_word_length = 2;max_word_length <= 6;max_word_length++){
+		RandomModel* var = new RandomModel(8, max_word_length, max_sentence_length);
+		var->lattice->set_viterbi_only_mode(true);
+		int min_window = 2 * (max_word_length + 1) + 1;
+		int num_forced_min_window = 0;
+		for(int size: {1, 10, 100, 500, max_sentence_length}){
+			Sentence* sentence = generate_sentence(size, var->num_character_ids);
+			sentence->_features = var->crf->extract_features(sentence, false);
+			std::vector<int> full_segments;
+			var->npylm->clear_g0_cache(size);
+			var->lattice->viterbi_decode(sentence, full_segments);
+			double full_score = var->compute_score(sentence, full_segments);
+			// 十分な列数があれば必ず合流する
+			for(int window: {64, 256, max_sentence_length + 1}){
+				assert(test_streaming(var, sentence, window, full_segments, full_score) == 0);
+			}
+			// 最小の列数では合流する前にリングバッファが一杯になる
+			num_forced_min_window += test_streaming(var, sentence, min_window, full_segments, full_score);
+		}
+		assert(num_forced_min_window > 0);
+		delete var;
+	}
+	cout << "OK" << endl;
+	return 0;
+}
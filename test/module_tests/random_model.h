@@ -0,0 +1,124 @@
+#pragma once
+#include <cassert>
+#include <vector>
+#include "../../src/npycrf/sampler.h"
+#include "../../src/npycrf/array.h"
+#include "../../src/npycrf/ctype.h"
+#include "../../src/npycrf/sentence.h"
+#include "../../src/npycrf/lattice.h"
+#include "../../src/npycrf/crf/crf.h"
+#include "../../src/npycrf/npylm/npylm.h"
+
+// モジュールテスト共通の乱数で作ったモデルと、分割を全て列挙する補助関数
+
+namespace npycrf {
+	namespace test {
+		Sentence* generate_sentence(int size, int num_character_ids){
+			std::wstring sentence_str;
+			array<int> character_ids(size);
+			for(int i = 0;i < size;i++){
+				int character_id = sampler::uniform_int(0, num_character_ids - 1);
+				sentence_str.push_back(L'あ' + character_id);
+				character_ids[i] = character_id;
+			}
+			return new Sentence(sentence_str, character_ids);
+		}
+		// 文字IDをcharactersの位置とし、文字種が混ざった文を作る
+		Sentence* generate_sentence(int size, const std::wstring &characters){
+			std::wstring sentence_str;
+			array<int> character_ids(size);
+			for(int i = 0;i < size;i++){
+				int character_id = sampler::uniform_int(0, characters.size() - 1);
+				sentence_str.push_back(characters[character_id]);
+				character_ids[i] = character_id;
+			}
+			return new Sentence(sentence_str, character_ids);
+		}
+		std::vector<int> generate_segments(int size, int max_word_length){
+			std::vector<int> segments;
+			int remaining = size;
+			while(remaining > 0){
+				int word_length = sampler::uniform_int(1, std::min(remaining, max_word_length));
+				segments.push_back(word_length);
+				remaining -= word_length;
+			}
+			return segments;
+		}
+		// 重みがN(0,1)のCRF
+		// 素性を取る範囲はテンプレートごとに変えられる
+		crf::CRF* generate_crf(int num_character_ids, int hash_bits,
+			int x_unigram_start = -2, int x_unigram_end = 2,
+			int x_bigram_start = -2, int x_bigram_end = 1,
+			int x_identical_1_start = -2, int x_identical_1_end = 1,
+			int x_identical_2_start = -3, int x_identical_2_end = 1){
+			crf::feature::FeatureExtractor* extractor = new crf::feature::FeatureExtractor(num_character_ids, CTYPE_NUM_TYPES,
+				x_unigram_start, x_unigram_end, x_bigram_start, x_bigram_end,
+				x_identical_1_start, x_identical_1_end, x_identical_2_start, x_identical_2_end, hash_bits);
+			crf::Parameter* parameter = new crf::Parameter(extractor->get_num_features(), 1.0, 1.0);
+			for(int k = 0;k < parameter->_weights.size();k++){
+				parameter->_weights[k] = sampler::normal(0, 1);
+			}
+			parameter->update_version();
+			return new crf::CRF(extractor, parameter);
+		}
+		// CRFはgenerate_crf、NPYLMにはランダムに分割した文の客を追加して文脈ノードを作っておく
+		class RandomModel {
+		public:
+			npylm::NPYLM* npylm;
+			crf::CRF* crf;
+			Lattice* lattice;
+			std::vector<Sentence*> dataset;
+			int num_character_ids;
+			int max_word_length;
+			RandomModel(int num_character_ids, int max_word_length, int max_sentence_length = 100, int ngram = 3){
+				this->num_character_ids = num_character_ids;
+				this->max_word_length = max_word_length;
+				npylm = new npylm::NPYLM(max_word_length, max_sentence_length, 1.0 / num_character_ids, 4, 1, 4, 1, ngram);
+				crf = generate_crf(num_character_ids, 12);
+				lattice = new Lattice(npylm, crf);
+				lattice->reserve(max_word_length, max_sentence_length);
+				npylm->reserve(max_sentence_length);
+				for(int n = 0;n < 20;n++){
+					Sentence* sentence = generate_sentence(sampler::uniform_int(5, 30), num_character_ids);
+					std::vector<int> segments = generate_segments(sentence->size(), max_word_length);
+					sentence->split(segments);
+					npylm->clear_g0_cache(sentence->size());
+					for(int t = 2;t < sentence->get_num_segments();t++){
+						npylm->add_customer_at_time_t(sentence, t);
+					}
+					dataset.push_back(sentence);
+				}
+			}
+			~RandomModel(){
+				for(Sentence* sentence: dataset){
+					delete sentence;
+				}
+				delete lattice;
+				delete crf;
+				delete npylm;
+			}
+			// 分割のlog p(y|x)の分子
+			double compute_score(Sentence* sentence, std::vector<int> &segments){
+				Sentence* _sentence = sentence->copy();
+				_sentence->split(segments);
+				npylm->clear_g0_cache(_sentence->size());
+				double log_crf = crf->compute_log_p_y_given_sentence(_sentence);
+				double log_npylm = npylm->compute_log_p_y_given_sentence(_sentence);
+				delete _sentence;
+				return log_crf + crf->_parameter->_lambda_0 * log_npylm;
+			}
+		};
+		// 単語長L以下の全ての分割
+		void enumerate_segmentations(int remaining, int max_word_length, std::vector<int> &segments, std::vector<std::vector<int>> &all_segments){
+			if(remaining == 0){
+				all_segments.push_back(segments);
+				return;
+			}
+			for(int k = 1;k <= std::min(remaining, max_word_length);k++){
+				segments.push_back(k);
+				enumerate_segmentations(remaining - k, max_word_length, segments, all_segments);
+				segments.pop_back();
+			}
+		}
+	}
+}
@@ -0,0 +1,81 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include "../../../src/npycrf/solver/sgd.h"
+#include "../random_model.h"
+using namespace npycrf;
+using namespace npycrf::test;
+using std::cout;
+using std::flush;
+using std::endl;
+
+// FeatureIndicesから求めたCRFの勾配が、素性関数ごとに素性IDを引いて求めた勾配と一致することを確認する
+
+int num_character_ids = 8;
+
+void test_backward_crf(crf::CRF* crf, int size){
+	solver::SGD* sgd = new solver::SGD(crf, 1.0);
+	Sentence* sentence = generate_sentence(size, num_character_ids);
+	std::vector<int> segments = generate_segments(size, 4);
+	sentence->split(segments);
+	sentence->_features = crf->extract_features(sentence, true);
+	// 勾配の比較には周辺確率の値そのものは関係ないので乱数で埋める
+	// ただし文頭の<bos>は必ず単語の区切りなので、位置1の素性の発火と期待値は打ち消しあう
+	mat::tri<double> pz_s(size + 2, 2, 2);
+	pz_s(0, 1, 1) = 1;
+	for(int i = 1;i <= size + 1;i++){
+		for(int y_i_1 = 0;y_i_1 <= 1;y_i_1++){
+			for(int y_i = 0;y_i <= 1;y_i++){
+				pz_s(i, y_i_1, y_i) = sampler::uniform(0, 1);
+			}
+		}
+	}
+
+	solver::Gradient grad;
+	sgd->backward_crf(sentence, pz_s, grad);
+	solver::Gradient true_grad;
+	sgd->_backward_unigram(sentence, pz_s, true_grad);
+	sgd->_backward_bigram(sentence, pz_s, true_grad);
+	sgd->_backward_identical_1(sentence, pz_s, true_grad);
+	sgd->_backward_identical_2(sentence, pz_s, true_grad);
+	sgd->_backward_unigram_type(sentence, pz_s, true_grad);
+	sgd->_backward_bigram_type(sentence, pz_s, true_grad);
+	sgd->_backward_label(sentence, pz_s, true_grad);
+
+	hashmap<int, double> diff;
+	for(size_t n = 0;n < grad._feature_ids.size();n++){
+		diff[grad._feature_ids[n]] += grad._values[n];
+	}
+	for(size_t n = 0;n < true_grad._feature_ids.size();n++){
+		if(true_grad._feature_ids[n] == -1){	// 刈り込まれた素性
+			continue;
+		}
+		diff[true_grad._feature_ids[n]] -= true_grad._values[n];
+	}
+	for(auto &elem: diff){
+		assert(std::abs(elem.second) < 1e-10);
+	}
+
+	delete sentence;
+	delete sgd;
+}
+
+int main(){
+	sampler::set_seed(0);
+	for(int hash_bits: {0, 12}){
+		std::vector<crf::CRF*> crfs;
+		crfs.push_back(generate_crf(num_character_ids, hash_bits));
+		// 素性テンプレートごとに開始位置が異なる場合
+		crfs.push_back(generate_crf(num_character_ids, hash_bits, -1, 2, -3, 1, -2, 0, -1, 2));
+		crfs.push_back(generate_crf(num_character_ids, hash_bits, -3, 1, -1, 2, -1, 1, -2, 1));
+		for(crf::CRF* crf: crfs){
+			for(int size = 1;size <= 30;size++){
+				test_backward_crf(crf, size);
+			}
+			delete crf;
+		}
+	}
+	cout << "OK" << endl;
+	return 0;
+}
@@ -0,0 +1,81 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include "../../../src/npycrf/solver/sgd.h"
+#include "../random_model.h"
+using namespace npycrf;
+using namespace npycrf::test;
+using std::cout;
+using std::flush;
+using std::endl;
+
+// ミニバッチの勾配を複数のスレッドで求めた結果が、1スレッドで求めた結果とビット単位で一致することを確認する
+
+void test_batch_gradient(int max_word_length, int ngram, bool pure_crf_mode, int num_threads){
+	RandomModel* var = new RandomModel(8, max_word_length, 100, ngram);
+	std::vector<Sentence*> batch;
+	for(int n = 0;n < 32;n++){
+		Sentence* sentence = generate_sentence(sampler::uniform_int(1, 40), var->num_character_ids);
+		std::vector<int> segments = generate_segments(sentence->size(), max_word_length);
+		sentence->split(segments);
+		sentence->_features = var->crf->extract_features(sentence, false);
+		batch.push_back(sentence);
+	}
+	solver::SGD* sgd = new solver::SGD(var->crf, 1.0);
+
+	// 1スレッド
+	std::vector<Lattice*> lattices = {var->lattice};
+	sgd->compute_batch_gradient(batch, lattices, pure_crf_mode);
+	int num_features = var->crf->_parameter->get_num_features();
+	std::vector<double> grad_weight(num_features);
+	int num_active = 0;
+	for(int k = 0;k < num_features;k++){
+		grad_weight[k] = sgd->_grad_weight[k];
+		if(grad_weight[k] != 0){
+			num_active++;
+		}
+	}
+	double grad_lambda_0 = sgd->_grad_lambda_0;
+	assert(num_active > 0);
+	if(pure_crf_mode == false){
+		assert(grad_lambda_0 != 0);
+	}
+
+	// スレッドごとのラティス
+	lattices.clear();
+	for(int n = 0;n < num_threads;n++){
+		Lattice* lattice = new Lattice(var->npylm, var->crf);
+		lattice->reserve(max_word_length, 100);
+		lattices.push_back(lattice);
+	}
+	sgd->compute_batch_gradient(batch, lattices, pure_crf_mode);
+	for(int k = 0;k < num_features;k++){
+		assert(sgd->_grad_weight[k] == grad_weight[k]);
+	}
+	assert(sgd->_grad_lambda_0 == grad_lambda_0);
+
+	for(Lattice* lattice: lattices){
+		delete lattice;
+	}
+	for(Sentence* sentence: batch){
+		delete sentence;
+	}
+	delete sgd;
+	delete var;
+}
+
+int main(){
+	sampler::set_seed(0);
+	for(int max_word_length = 2;max_word_length <= 4;max_word_length++){
+		for(int ngram: {2, 3}){
+			for(bool pure_crf_mode: {false, true}){
+				for(int num_threads: {2, 3, 8}){
+					test_batch_gradient(max_word_length, ngram, pure_crf_mode, num_threads);
+				}
+			}
+		}
+	}
+	cout << "OK" << endl;
+	return 0;
+}
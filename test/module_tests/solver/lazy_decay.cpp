@@ -0,0 +1,175 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include "../../../src/npycrf/solver/sgd.h"
+#include "../random_model.h"
+using namespace npycrf;
+using namespace npycrf::test;
+using std::cout;
+using std::flush;
+using std::endl;
+
+// 勾配を持つ重みのみ更新してL2正則化の縮小を遅らせた結果が、
+// 毎ステップ全ての重みを縮小した場合と一致することを確認する
+
+void test_lazy_decay(double regularization_constant){
+	crf::CRF* crf = generate_crf(8, 8);
+	crf::Parameter* params = crf->_parameter;
+	int num_features = params->get_num_features();
+	std::vector<double> weights(num_features);
+	for(int k = 0;k < num_features;k++){
+		weights[k] = params->_weights[k];
+	}
+	double lambda_0 = params->_lambda_0;
+
+	solver::SGD* sgd = new solver::SGD(crf, regularization_constant);
+	solver::Gradient grad;
+	std::vector<double> grad_weight(num_features);
+	for(int step = 0;step < 200;step++){
+		double learning_rate = sampler::uniform(0.001, 0.1);
+		// 一部の重みだけが勾配を持つ. 同じ素性が何度も出てもよい
+		grad.clear();
+		std::fill(grad_weight.begin(), grad_weight.end(), 0);
+		int num_active = sampler::uniform_int(0, 20);
+		for(int n = 0;n < num_active;n++){
+			int k = sampler::uniform_int(0, num_features - 1);
+			double value = sampler::normal(0, 1);
+			grad.add(k, value);
+			grad_weight[k] += value;
+		}
+		grad._lambda_0 = sampler::normal(0, 1);
+		sgd->clear_grads();
+		sgd->accumulate(grad);
+		sgd->update(learning_rate);
+
+		// 全ての重みを毎回縮小する
+		for(int k = 0;k < num_features;k++){
+			weights[k] += learning_rate * grad_weight[k] - regularization_constant * learning_rate * weights[k];
+		}
+		lambda_0 += learning_rate * grad._lambda_0 - regularization_constant * learning_rate * (lambda_0 - 1);
+
+		// 遅らせている縮小を掛ければ一致する
+		for(int k = 0;k < num_features;k++){
+			double decay = exp(sgd->_log_decay.back() - sgd->_log_decay[sgd->_last_step[k]]);
+			assert(std::abs(params->_weights[k] * decay - weights[k]) < 1e-10);
+		}
+		assert(std::abs(params->_lambda_0 - lambda_0) < 1e-10);
+
+		// 途中で全ての重みを最新にしても結果は変わらない
+		if(step % 50 == 49){
+			sgd->apply_pending_decay();
+			for(int k = 0;k < num_features;k++){
+				assert(std::abs(params->_weights[k] - weights[k]) < 1e-10);
+			}
+		}
+	}
+	sgd->apply_pending_decay();
+	for(int k = 0;k < num_features;k++){
+		assert(std::abs(params->_weights[k] - weights[k]) < 1e-10);
+	}
+	delete sgd;
+	delete crf;
+}
+
+// L1正則化の累積ペナルティによる切り詰めを、毎ステップ全ての重みに掛けた場合と比べる
+// 切り詰めは累積ペナルティの差分だけで決まるので、遅らせても結果は変わらない
+void test_lazy_l1_penalty(double l1_regularization_constant){
+	crf::CRF* crf = generate_crf(8, 8);
+	crf::Parameter* params = crf->_parameter;
+	int num_features = params->get_num_features();
+	std::vector<double> weights(num_features);
+	std::vector<double> penalty_applied(num_features, 0);
+	for(int k = 0;k < num_features;k++){
+		weights[k] = params->_weights[k];
+	}
+	double cumulative_penalty = 0;
+
+	solver::SGD* sgd = new solver::SGD(crf, 0, l1_regularization_constant);
+	solver::Gradient grad;
+	std::vector<double> grad_weight(num_features);
+	for(int step = 0;step < 200;step++){
+		double learning_rate = sampler::uniform(0.001, 0.1);
+		grad.clear();
+		std::fill(grad_weight.begin(), grad_weight.end(), 0);
+		int num_active = sampler::uniform_int(0, 20);
+		for(int n = 0;n < num_active;n++){
+			int k = sampler::uniform_int(0, num_features - 1);
+			double value = sampler::normal(0, 1);
+			grad.add(k, value);
+			grad_weight[k] += value;
+		}
+		sgd->clear_grads();
+		sgd->accumulate(grad);
+		sgd->update(learning_rate);
+
+		// Tsuruoka et al.の切り詰めを全ての重みに毎回かける
+		cumulative_penalty += l1_regularization_constant * learning_rate;
+		for(int k = 0;k < num_features;k++){
+			weights[k] += learning_rate * grad_weight[k];
+			double z = weights[k];
+			if(weights[k] > 0){
+				weights[k] = std::max(0.0, weights[k] - (cumulative_penalty + penalty_applied[k]));
+			}else if(weights[k] < 0){
+				weights[k] = std::min(0.0, weights[k] + (cumulative_penalty - penalty_applied[k]));
+			}
+			penalty_applied[k] += weights[k] - z;
+		}
+
+		// 勾配を持つ重みは最新になっている
+		for(int k: sgd->_active_feature_ids){
+			assert(std::abs(params->_weights[k] - weights[k]) < 1e-10);
+			assert((params->_weights[k] == 0) == (weights[k] == 0));
+		}
+		if(step % 50 == 49){
+			sgd->apply_pending_decay();
+			for(int k = 0;k < num_features;k++){
+				assert(std::abs(params->_weights[k] - weights[k]) < 1e-10);
+				assert((params->_weights[k] == 0) == (weights[k] == 0));
+			}
+		}
+	}
+	sgd->apply_pending_decay();
+	int num_zero_weights = 0;
+	for(int k = 0;k < num_features;k++){
+		assert(std::abs(params->_weights[k] - weights[k]) < 1e-10);
+		// 0で止まった重みは正確に0
+		assert((params->_weights[k] == 0) == (weights[k] == 0));
+		if(weights[k] == 0){
+			num_zero_weights++;
+		}
+	}
+	assert(num_zero_weights > 0);
+	assert(num_zero_weights == params->get_num_zero_weights());
+	delete sgd;
+	delete crf;
+}
+
+int main(){
+	sampler::set_seed(0);
+	test_lazy_decay(0);
+	test_lazy_decay(0.1);
+	test_lazy_decay(1.0);
+	test_lazy_l1_penalty(0.1);
+	test_lazy_l1_penalty(1.0);
+	test_lazy_l1_penalty(10.0);
+	// 縮小率が0以下になる学習率は重みを変えずに弾く
+	crf::CRF* crf = generate_crf(8, 8);
+	double weight = crf->_parameter->_weights[0];
+	solver::SGD* sgd = new solver::SGD(crf, 1.0);
+	bool thrown = false;
+	try{
+		sgd->update(1.0);
+	}catch(std::invalid_argument &e){
+		thrown = true;
+	}
+	assert(thrown);
+	assert(sgd->_log_decay.size() == 1);
+	assert(crf->_parameter->_weights[0] == weight);
+	delete sgd;
+	delete crf;
+	cout << "OK" << endl;
+	return 0;
+}
@@ -0,0 +1,78 @@
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include "../module_tests/random_model.h"
+using namespace npycrf;
+using namespace npycrf::test;
+using std::cout;
+using std::flush;
+using std::endl;
+
+// 対数領域の前向き・後向き確率がスケーリング係数を使う場合と比べてどれだけ遅いかを測る
+// 前向き確率（log Z）と周辺確率p(z|x)の計算時間を文の長さと最大単語長ごとに出力する
+// 他のプロセスの影響を減らすため、num_trials回測った中で最も速いものを使う
+
+int num_trials = 5;
+int num_repeat = 5;
+
+// 1文あたりのミリ秒
+double measure(Lattice* lattice, RandomModel* var, std::vector<Sentence*> &dataset, bool log_domain_mode, bool marginal){
+	lattice->set_log_domain_mode(log_domain_mode);
+	int size = dataset[0]->size();
+	mat::tri<double> pz_s(size + 2, 2, 2);
+	double checksum = 0;
+	double min_elapsed_time = 0;
+	for(int trial = 0;trial < num_trials;trial++){
+		auto start_time = std::chrono::system_clock::now();
+		for(int repeat = 0;repeat < num_repeat;repeat++){
+			for(Sentence* sentence: dataset){
+				var->npylm->clear_g0_cache(size);
+				if(marginal){
+					lattice->enumerate_marginal_p_z_given_sentence(sentence, pz_s);
+					checksum += pz_s(1, 1, 1);
+				}else{
+					checksum += lattice->compute_log_normalizing_constant(sentence, true);
+				}
+			}
+		}
+		auto diff = std::chrono::system_clock::now() - start_time;
+		double elapsed_time = std::chrono::duration_cast<std::chrono::microseconds>(diff).count() / 1000.0;
+		if(trial == 0 || elapsed_time < min_elapsed_time){
+			min_elapsed_time = elapsed_time;
+		}
+	}
+	if(checksum != checksum){
+		cout << "NaN" << endl;
+	}
+	return min_elapsed_time / (num_repeat * dataset.size());
+}
+
+int main(){
+	sampler::set_seed(0);
+	cout << "L\tsize\tlogZ(scaled)\tlogZ(log)\tratio\tp(z|x)(scaled)\tp(z|x)(log)\tratio" << endl;
+	for(int max_word_length: {4, 8, 16}){
+		RandomModel* var = new RandomModel(64, max_word_length, 400);
+		Lattice* lattice = var->lattice;
+		lattice->set_npycrf_mode();
+		for(int size: {50, 200, 400}){
+			std::vector<Sentence*> dataset;
+			for(int n = 0;n < 10;n++){
+				Sentence* sentence = generate_sentence(size, var->num_character_ids);
+				sentence->_features = var->crf->extract_features(sentence, false);
+				dataset.push_back(sentence);
+			}
+			double forward_scaled = measure(lattice, var, dataset, false, false);
+			double forward_log = measure(lattice, var, dataset, true, false);
+			double marginal_scaled = measure(lattice, var, dataset, false, true);
+			double marginal_log = measure(lattice, var, dataset, true, true);
+			cout << max_word_length << "\t" << size << "\t";
+			cout << forward_scaled << "\t" << forward_log << "\t" << forward_log / forward_scaled << "\t";
+			cout << marginal_scaled << "\t" << marginal_log << "\t" << marginal_log / marginal_scaled << endl;
+			for(Sentence* sentence: dataset){
+				delete sentence;
+			}
+		}
+		delete var;
+	}
+	return 0;
+}